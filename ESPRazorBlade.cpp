@@ -1,12 +1,14 @@
 #include "ESPRazorBlade.h"
 #include "esp_system.h"
-
-// Static instance pointer for callback access
-ESPRazorBlade* ESPRazorBlade::instance = nullptr;
+#include "lwip/sockets.h"
+#include <unistd.h>
 
 #ifndef DEVICE_ID
 #define DEVICE_ID "ESPRazorBlade"
 #endif
+#ifndef MQTT_CLIENT_ID
+#define MQTT_CLIENT_ID "ESPRazorBlade_Client"
+#endif
 #ifndef WIFI_SIGNAL_INTERVAL_MS
 #define WIFI_SIGNAL_INTERVAL_MS 30000
 #endif
@@ -16,24 +18,80 @@ ESPRazorBlade* ESPRazorBlade::instance = nullptr;
 #ifndef FREE_HEAP_INTERVAL_MS
 #define FREE_HEAP_INTERVAL_MS 30000
 #endif
+#ifndef HEALTH_INTERVAL_MS
+#define HEALTH_INTERVAL_MS 0  // Memory and stack health telemetry (0 = disabled)
+#endif
+#ifndef MQTT_PROBE_INTERVAL_MS
+#define MQTT_PROBE_INTERVAL_MS 0  // Broker loopback probe interval (0 = disabled)
+#endif
+#ifndef MQTT_PROBE_TIMEOUT_MS
+#define MQTT_PROBE_TIMEOUT_MS 10000  // A probe not echoed within this time counts as failed
+#endif
+#ifndef MQTT_PROBE_MAX_RTT_MS
+#define MQTT_PROBE_MAX_RTT_MS 5000  // A probe echoed slower than this counts as failed
+#endif
+#ifndef MQTT_PROBE_MAX_FAILURES
+#define MQTT_PROBE_MAX_FAILURES 2  // Consecutive failed probes before forcing a reconnect
+#endif
+#ifdef TELEMETRY_TRANSPORT_UDP
+#ifndef UDP_GATEWAY_PORT
+#define UDP_GATEWAY_PORT 1885  // MQTT-SN gateway port
+#endif
+#ifndef UDP_TOPIC_ID_BASE
+#define UDP_TOPIC_ID_BASE 0  // Topic ids are UDP_TOPIC_ID_BASE + slot + 1
+#endif
+#ifndef UDP_REGISTER_INTERVAL_MS
+#define UDP_REGISTER_INTERVAL_MS 60000  // Topic ids are registered again this often (gateway restarts)
+#endif
+#endif
+#ifndef COMPRESSION_THRESHOLD_BYTES
+#define COMPRESSION_THRESHOLD_BYTES 0  // Min payload size compressed on enableCompression() topics (0 = any)
+#endif
 
 // Built-in telemetry callback helpers (static, used by registerTelemetry)
-static String readWiFiRSSI() {
-    return String(WiFi.RSSI());
+// Buffer-based so built-in telemetry never allocates
+static void readWiFiRSSI(char* buffer, size_t size) {
+    snprintf(buffer, size, "%d", (int)WiFi.RSSI());
 }
 
-static String readFreeHeap() {
-    return String(ESP.getFreeHeap());
+static void readFreeHeap(char* buffer, size_t size) {
+    snprintf(buffer, size, "%lu", (unsigned long)ESP.getFreeHeap());
 }
 
-static String readTimeAlive() {
+static void readTimeAlive(char* buffer, size_t size) {
     unsigned long totalSec = millis() / 1000UL;
     unsigned int hours = (unsigned int)(totalSec / 3600UL);
     unsigned int minutes = (unsigned int)((totalSec % 3600UL) / 60UL);
     unsigned int seconds = (unsigned int)(totalSec % 60UL);
-    char buf[11];
-    snprintf(buf, sizeof(buf), "%03uh%02um%02us", hours, minutes, seconds);
-    return String(buf);
+    snprintf(buffer, size, "%03uh%02um%02us", hours, minutes, seconds);
+}
+
+// Prometheus metric name for a telemetry topic: "esprazorblade_" followed by the topic
+// without the device prefix, with every character outside [a-zA-Z0-9_] mapped to '_'
+static void metricNameForTopic(const char* deviceId, const char* topic, char* name, size_t size) {
+    size_t prefixLen = strlen(deviceId);
+    if (strncmp(topic, deviceId, prefixLen) == 0 && topic[prefixLen] == '/') {
+        topic += prefixLen + 1;
+    }
+    size_t len = snprintf(name, size, "esprazorblade_");
+    for (; *topic != '\0' && len < size - 1; topic++) {
+        name[len++] = isalnum((unsigned char)*topic) ? *topic : '_';
+    }
+    name[len] = '\0';
+}
+
+// Copies an id into a fixed buffer; returns false if it had to be truncated
+static bool copyId(char* dest, size_t size, const char* id) {
+    strncpy(dest, id, size - 1);
+    dest[size - 1] = '\0';
+    return strlen(id) < size;
+}
+
+// True if str ends with suffix
+static bool endsWith(const char* str, const char* suffix) {
+    size_t strLen = strlen(str);
+    size_t suffixLen = strlen(suffix);
+    return strLen >= suffixLen && strcmp(str + strLen - suffixLen, suffix) == 0;
 }
 
 static const char* getResetReasonString() {
@@ -61,42 +119,237 @@ const int WIFI_CHECK_INTERVAL_MS = 5000;
 // MQTT connection settings
 const int MQTT_MAX_RETRIES = 10;
 const int MQTT_RETRY_DELAY_MS = 2000;
-const int MQTT_POLL_INTERVAL_MS = 100;
+const int MQTT_POLL_INTERVAL_MS = 100;     // Loop interval while connecting, and retry backoff for failed publishes
+const int MQTT_MAX_IDLE_WAIT_MS = 5000;    // Max time the connected MQTT task sleeps waiting for socket data
+const int MQTT_KEEPALIVE_MS = 60000;       // MQTT keepalive interval (PINGREQ is sent by poll())
 const int MQTT_INITIAL_DELAY_MS = 3000; // Wait 3 seconds after WiFi connects before first MQTT attempt
+const int MQTT_PUBLISH_TIMEOUT_MS = 1000; // Max wait for the MQTT connection when publishing
+const int BULK_DRAIN_PER_CYCLE = 4;       // Max queued bulk messages sent per MQTT task cycle
+
+// Payload compression format (see README): "RZ", format version, original length (16-bit big-endian),
+// then LZ groups of one flag byte followed by up to 8 tokens (flag bit set = 2-byte match, else literal).
+// On compression topics a raw payload that itself starts with "RZ" is escaped as "RZ", 0x00, payload.
+const uint8_t COMPRESSION_MAGIC_0 = 'R';
+const uint8_t COMPRESSION_MAGIC_1 = 'Z';
+const uint8_t COMPRESSION_FORMAT = 1;
+const uint8_t COMPRESSION_FORMAT_RAW = 0;      // Escaped raw payload (payloads never contain 0x00)
+const size_t COMPRESSION_HEADER_LEN = 5;
+const size_t COMPRESSION_ESCAPE_LEN = 3;
+const size_t COMPRESSION_MIN_PAYLOAD = 16;     // Smaller payloads never shrink enough to be worth it
+const size_t COMPRESSION_MAX_PAYLOAD = 65534;  // Original length must fit the 16-bit header field
+const size_t COMPRESSION_WINDOW = 4096;        // Max match offset (12 bits)
+const size_t COMPRESSION_MIN_MATCH = 3;
+const size_t COMPRESSION_MAX_MATCH = 18;       // Min match + 4-bit length field
+const uint16_t COMPRESSION_HASH_EMPTY = 0xFFFF;
+
+// MQTT-SN REGISTER and PUBLISH framing used by the UDP telemetry transport
+const uint8_t MQTTSN_REGISTER = 0x0A;
+const uint8_t MQTTSN_PUBLISH = 0x0C;
+const uint8_t MQTTSN_FLAGS_QOS_M1_PREDEFINED = 0x61;  // QoS -1 (no connection needed), predefined topic id
+const size_t MQTTSN_REGISTER_HEADER_LEN = 6;          // Length, type, topic id (2), message id (2)
+const size_t MQTTSN_PUBLISH_HEADER_LEN = 7;           // Length, type, flags, topic id (2), message id (2)
+
+// Topic-filter trie used to dispatch inbound messages to subscriptions
+const uint8_t TRIE_LEVEL_DONE = 0xFF;     // Build offset of a filter with no levels left
+const int TRIE_MAX_DEPTH = 32;            // A 63-character filter has at most 32 levels
+const int SUBSCRIPTION_MAX_MATCHES = 8;   // Max handlers called for one inbound message
+
+// Kinds of filter levels, in the order the trie build sorts them
+enum TrieLevelKind {
+    TRIE_LEVEL_END,
+    TRIE_LEVEL_HASH,
+    TRIE_LEVEL_PLUS,
+    TRIE_LEVEL_LITERAL
+};
+
+static TrieLevelKind trieLevelKind(const char* filter, uint8_t offset, size_t* length) {
+    if (offset == TRIE_LEVEL_DONE) {
+        *length = 0;
+        return TRIE_LEVEL_END;
+    }
+    const char* level = filter + offset;
+    *length = strcspn(level, "/");
+    if (*length == 1 && level[0] == '#') {
+        return TRIE_LEVEL_HASH;
+    }
+    if (*length == 1 && level[0] == '+') {
+        return TRIE_LEVEL_PLUS;
+    }
+    return TRIE_LEVEL_LITERAL;
+}
+
+// Order of literal levels (length first, then bytes); sibling nodes are sorted by it
+static int compareTrieLevels(const char* a, size_t aLength, const char* b, size_t bLength) {
+    if (aLength != bLength) {
+        return aLength < bLength ? -1 : 1;
+    }
+    return memcmp(a, b, aLength);
+}
 
-// Task stack sizes (in words, 4 bytes each on ESP32)
-const int WIFI_TASK_STACK_SIZE = 4096;
-const int MQTT_TASK_STACK_SIZE = 4096;
+// Order of two filters by the level at the given offsets (0 = same trie child)
+static int compareFilterLevels(const char* a, uint8_t aOffset, const char* b, uint8_t bOffset) {
+    size_t aLength;
+    size_t bLength;
+    TrieLevelKind aKind = trieLevelKind(a, aOffset, &aLength);
+    TrieLevelKind bKind = trieLevelKind(b, bOffset, &bLength);
+    if (aKind != bKind) {
+        return aKind < bKind ? -1 : 1;
+    }
+    if (aKind != TRIE_LEVEL_LITERAL) {
+        return 0;
+    }
+    return compareTrieLevels(a + aOffset, aLength, b + bOffset, bLength);
+}
+
+// MQTT topic filter: + and # only as whole levels, # only as the last level
+static bool validTopicFilter(const char* filter) {
+    size_t len = filter != nullptr ? strlen(filter) : 0;
+    if (len == 0 || len >= 64) {
+        return false;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (filter[i] != '+' && filter[i] != '#') {
+            continue;
+        }
+        bool wholeLevel = (i == 0 || filter[i - 1] == '/') && (i + 1 == len || filter[i + 1] == '/');
+        if (!wholeLevel || (filter[i] == '#' && i + 1 != len)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Metrics HTTP endpoint settings
+const int HTTP_ACCEPT_INTERVAL_MS = 50;   // How often the idle HTTP task checks for a new scrape
+const int HTTP_READ_INTERVAL_MS = 5;     // How often slots waiting for a request head are read
+const int HTTP_REQUEST_TIMEOUT_MS = 500; // Max time to receive a request head
 
 // Task priorities
 const int WIFI_TASK_PRIORITY = 1;
 const int MQTT_TASK_PRIORITY = 2;
+const int HTTP_TASK_PRIORITY = 1;
 
-ESPRazorBlade::ESPRazorBlade() 
-    : mqttClient(&wifiClient),
+ESPRazorBlade::ESPRazorBlade(const char* deviceId, const char* clientId)
+    : mqttClient(&wifiClient, this),
+#ifdef METRICS_HTTP_PORT
+      metricsServer(METRICS_HTTP_PORT, METRICS_HTTP_MAX_CLIENTS),
+#endif
       wifiTaskHandle(nullptr),
       mqttTaskHandle(nullptr),
+      httpTaskHandle(nullptr),
+      wakeSocket(-1),
+      wakeSignalled(false),
       mqttMutex(nullptr),
+      queueMutex(nullptr),
+      sampleMutex(nullptr),
+      subscriptionMutex(nullptr),
       wifiConnected(false),
       mqttConnected(false),
       mqttConnecting(false),
       wifiConnectedTime(0),
       firstMQTTAttempt(true),
       telemetryCallbackCount(0),
+      registryGeneration(0),
+      schedulerEpoch(0),
       resetReasonPublished(false),
       configTimeoutsPublished(false),
-      configTopicsSubscribed(false) {
-    // Set static instance pointer for callback access
-    instance = this;
+      configTopicsSubscribed(false),
+      lastHealthPublish(0),
+      probeSequence(0),
+      probeOutstanding(false),
+      probeSentAt(0),
+      lastProbe(0),
+      probeFailures(0),
+      mqttRestartRequested(false),
+      brokerRttMs(-1),
+      activeSubscriptionSet(0),
+      subscriptionIdCounter(0),
+      subscriptionGeneration(0),
+      subscriptionReadEpoch(0),
+      syncedSubscriptionGeneration(0),
+      pendingUnsubscribeCount(0),
+      deferredHead(0),
+      deferredCount(0),
+      deferredDropped(0),
+      compressedTopicCount(0)
+#ifdef TELEMETRY_TRANSPORT_UDP
+      , udpGatewayResolved(false)
+      , lastUdpRegister(0)
+      , udpRegisterMessageId(0)
+#endif
+      {
+    // A device id alone also names the client, so instances made with distinct ids never share a session
+    bool idsFit = copyId(this->deviceId, sizeof(this->deviceId), deviceId != nullptr ? deviceId : DEVICE_ID);
+    idsFit &= copyId(this->clientId, sizeof(this->clientId),
+                     clientId != nullptr ? clientId : (deviceId != nullptr ? deviceId : MQTT_CLIENT_ID));
+    idTruncated = !idsFit;
     
     // Initialize telemetry callback array
+    portMUX_INITIALIZE(&registryLock);
     for (int i = 0; i < MAX_TELEMETRY_CALLBACKS; i++) {
-        telemetryCallbacks[i].active = false;
-        telemetryCallbacks[i].topic[0] = '\0';
-        telemetryCallbacks[i].callback = nullptr;
-        telemetryCallbacks[i].intervalMs = 0;
+        telemetryCallbacks[i].config.active = false;
+        telemetryCallbacks[i].config.topic[0] = '\0';
+        telemetryCallbacks[i].config.callback = nullptr;
+        telemetryCallbacks[i].config.bufferCallback = nullptr;
+        telemetryCallbacks[i].config.intervalMs = 0;
+        telemetryCallbacks[i].config.priority = PRIORITY_NORMAL;
+        telemetryCallbacks[i].config.generation = 0;
+        telemetryCallbacks[i].sequence = 0;
         telemetryCallbacks[i].lastExecution = 0;
+        telemetryCallbacks[i].scheduledGeneration = 0;
+#ifdef TELEMETRY_TRANSPORT_UDP
+        telemetryCallbacks[i].udpRegisteredGeneration = 0;
+#endif
+        telemetryCallbacks[i].lastValue[0] = '\0';
+        telemetryCallbacks[i].hasSample = false;
+        telemetryCallbacks[i].sampleGeneration = 0;
     }
+    
+    // Initialize subscription sets (empty trie: root node only)
+    for (int s = 0; s < 2; s++) {
+        for (int i = 0; i < MAX_SUBSCRIPTIONS; i++) {
+            subscriptionSets[s].entries[i].filter[0] = '\0';
+            subscriptionSets[s].entries[i].handler = nullptr;
+            subscriptionSets[s].entries[i].context = nullptr;
+            subscriptionSets[s].entries[i].handlerContext = HANDLER_CONTEXT_MQTT_TASK;
+            subscriptionSets[s].entries[i].id = 0;
+        }
+        buildTopicTrie(subscriptionSets[s]);
+    }
+    for (int i = 0; i < MAX_SUBSCRIPTIONS; i++) {
+        brokerSubscriptionIds[i] = 0;
+    }
+    
+    // Initialize outbound priority queues
+    for (int p = 0; p < PRIORITY_CLASS_COUNT; p++) {
+        outboundHead[p] = 0;
+        outboundCount[p] = 0;
+        outboundDataTail[p] = 0;
+        outboundSending[p] = false;
+        outboundDropped[p] = 0;
+    }
+    
+#ifdef METRICS_HTTP_PORT
+    for (int i = 0; i < METRICS_HTTP_MAX_CLIENTS; i++) {
+        metricsClients[i].active = false;
+    }
+#endif
+    
+#ifdef STREAM_CHANNELS
+    // Initialize streaming channels
+    for (int c = 0; c < STREAM_CHANNELS; c++) {
+        streamChannels[c].open = false;
+        streamChannels[c].topic[0] = '\0';
+        streamChannels[c].head = 0;
+        streamChannels[c].readyCount = 0;
+        streamChannels[c].fillIndex = -1;
+        streamChannels[c].fillLength = 0;
+        streamChannels[c].droppedBytes = 0;
+        streamChannels[c].sequence = 0;
+        streamChannels[c].overruns = 0;
+        portMUX_INITIALIZE(&streamChannels[c].lock);
+    }
+#endif
 }
 
 ESPRazorBlade::~ESPRazorBlade() {
@@ -107,9 +360,21 @@ ESPRazorBlade::~ESPRazorBlade() {
     if (mqttTaskHandle != nullptr) {
         vTaskDelete(mqttTaskHandle);
     }
+    if (httpTaskHandle != nullptr) {
+        vTaskDelete(httpTaskHandle);
+    }
     if (mqttMutex != nullptr) {
         vSemaphoreDelete(mqttMutex);
     }
+    if (queueMutex != nullptr) {
+        vSemaphoreDelete(queueMutex);
+    }
+    if (sampleMutex != nullptr) {
+        vSemaphoreDelete(sampleMutex);
+    }
+    if (subscriptionMutex != nullptr) {
+        vSemaphoreDelete(subscriptionMutex);
+    }
 }
 
 bool ESPRazorBlade::begin() {
@@ -118,18 +383,81 @@ bool ESPRazorBlade::begin() {
     
     Serial.println("\n=== ESPRazorBlade Library - WiFi + MQTT + Telemetry ===");
     
+    if (idTruncated || deviceId[0] == '\0' || strpbrk(deviceId, "/+#") != nullptr) {
+        Serial.print("ERROR: Invalid device or client id (device id max ");
+        Serial.print(DEVICE_ID_MAX_LEN);
+        Serial.print(" characters, one topic level; client id max ");
+        Serial.print(CLIENT_ID_MAX_LEN);
+        Serial.println(" characters)");
+        return false;
+    }
+    
     // Create mutex for thread-safe MQTT operations
+#ifdef ESPRAZORBLADE_STATIC_ALLOCATION
+    mqttMutex = xSemaphoreCreateMutexStatic(&mqttMutexBuffer);
+#else
     mqttMutex = xSemaphoreCreateMutex();
+#endif
     if (mqttMutex == nullptr) {
         Serial.println("ERROR: Failed to create MQTT mutex");
         return false;
     }
     
+    // Create mutex for the outbound priority queues
+#ifdef ESPRAZORBLADE_STATIC_ALLOCATION
+    queueMutex = xSemaphoreCreateMutexStatic(&queueMutexBuffer);
+#else
+    queueMutex = xSemaphoreCreateMutex();
+#endif
+    if (queueMutex == nullptr) {
+        Serial.println("ERROR: Failed to create queue mutex");
+        return false;
+    }
+    
+    // Create mutex for the cached last samples
+#ifdef ESPRAZORBLADE_STATIC_ALLOCATION
+    sampleMutex = xSemaphoreCreateMutexStatic(&sampleMutexBuffer);
+#else
+    sampleMutex = xSemaphoreCreateMutex();
+#endif
+    if (sampleMutex == nullptr) {
+        Serial.println("ERROR: Failed to create sample mutex");
+        return false;
+    }
+    
+    // Create mutex serializing subscribe()/unsubscribe()
+#ifdef ESPRAZORBLADE_STATIC_ALLOCATION
+    subscriptionMutex = xSemaphoreCreateMutexStatic(&subscriptionMutexBuffer);
+#else
+    subscriptionMutex = xSemaphoreCreateMutex();
+#endif
+    if (subscriptionMutex == nullptr) {
+        Serial.println("ERROR: Failed to create subscription mutex");
+        return false;
+    }
+    
     // MQTT client is already initialized with wifiClient in constructor
     // No begin() method needed - we'll use connect() when WiFi is ready
     
+    // Start the network stack and open the wake socket here, so no socket is taken from
+    // the lwIP heap once the tasks run
+    WiFi.mode(WIFI_STA);
+    openWakeSocket();
+    
     // Create WiFi management task
     // ESP32-C3 is single-core, so pin to core 0
+#ifdef ESPRAZORBLADE_STATIC_ALLOCATION
+    wifiTaskHandle = xTaskCreateStaticPinnedToCore(
+        wifiTask,
+        "WiFiTask",
+        WIFI_TASK_STACK_SIZE,
+        this,
+        WIFI_TASK_PRIORITY,
+        wifiTaskStack,
+        &wifiTaskBuffer,
+        0  // Pin to core 0 (ESP32-C3 only has one core)
+    );
+#else
     xTaskCreatePinnedToCore(
         wifiTask,
         "WiFiTask",
@@ -139,6 +467,7 @@ bool ESPRazorBlade::begin() {
         &wifiTaskHandle,
         0  // Pin to core 0 (ESP32-C3 only has one core)
     );
+#endif
     
     if (wifiTaskHandle == nullptr) {
         Serial.println("ERROR: Failed to create WiFi task");
@@ -146,6 +475,18 @@ bool ESPRazorBlade::begin() {
     }
     
     // Create MQTT management task
+#ifdef ESPRAZORBLADE_STATIC_ALLOCATION
+    mqttTaskHandle = xTaskCreateStaticPinnedToCore(
+        mqttTask,
+        "MQTTTask",
+        MQTT_TASK_STACK_SIZE,
+        this,
+        MQTT_TASK_PRIORITY,
+        mqttTaskStack,
+        &mqttTaskBuffer,
+        0  // Pin to core 0 (ESP32-C3 only has one core)
+    );
+#else
     xTaskCreatePinnedToCore(
         mqttTask,
         "MQTTTask",
@@ -155,22 +496,79 @@ bool ESPRazorBlade::begin() {
         &mqttTaskHandle,
         0  // Pin to core 0 (ESP32-C3 only has one core)
     );
+#endif
     
     if (mqttTaskHandle == nullptr) {
         Serial.println("ERROR: Failed to create MQTT task");
         return false;
     }
     
+#ifdef METRICS_HTTP_PORT
+    // Create metrics HTTP task (serves scrapes from the sample cache, never runs callbacks)
+#ifdef ESPRAZORBLADE_STATIC_ALLOCATION
+    httpTaskHandle = xTaskCreateStaticPinnedToCore(
+        httpTask,
+        "HTTPTask",
+        HTTP_TASK_STACK_SIZE,
+        this,
+        HTTP_TASK_PRIORITY,
+        httpTaskStack,
+        &httpTaskBuffer,
+        0  // Pin to core 0 (ESP32-C3 only has one core)
+    );
+#else
+    xTaskCreatePinnedToCore(
+        httpTask,
+        "HTTPTask",
+        HTTP_TASK_STACK_SIZE,
+        this,
+        HTTP_TASK_PRIORITY,
+        &httpTaskHandle,
+        0  // Pin to core 0 (ESP32-C3 only has one core)
+    );
+#endif
+    
+    if (httpTaskHandle == nullptr) {
+        Serial.println("ERROR: Failed to create HTTP task");
+        return false;
+    }
+#endif
+    
     // Register built-in telemetry (WiFi RSSI, time alive, free heap)
-    registerTelemetry(DEVICE_ID "/telemetry/wifi_rssi", readWiFiRSSI, WIFI_SIGNAL_INTERVAL_MS);
-    registerTelemetry(DEVICE_ID "/telemetry/time_alive", readTimeAlive, TIME_ALIVE_INTERVAL_MS);
-    registerTelemetry(DEVICE_ID "/telemetry/free_heap", readFreeHeap, FREE_HEAP_INTERVAL_MS);
+    char topic[64];
+    snprintf(topic, sizeof(topic), "%s/telemetry/wifi_rssi", deviceId);
+    registerTelemetry(topic, readWiFiRSSI, WIFI_SIGNAL_INTERVAL_MS);
+    snprintf(topic, sizeof(topic), "%s/telemetry/time_alive", deviceId);
+    registerTelemetry(topic, readTimeAlive, TIME_ALIVE_INTERVAL_MS);
+    snprintf(topic, sizeof(topic), "%s/telemetry/free_heap", deviceId);
+    registerTelemetry(topic, readFreeHeap, FREE_HEAP_INTERVAL_MS);
 
     Serial.println("ESPRazorBlade initialized successfully");
     Serial.println("WiFi and MQTT connection tasks started");
+    Serial.print("Library memory footprint: ");
+    Serial.print((unsigned long)getMemoryFootprint());
+#ifdef ESPRAZORBLADE_STATIC_ALLOCATION
+    Serial.println(" bytes (static allocation)");
+#else
+    Serial.println(" bytes");
+#endif
     return true;
 }
 
+size_t ESPRazorBlade::getMemoryFootprint() const {
+#ifdef ESPRAZORBLADE_STATIC_ALLOCATION
+    // Task stacks, task control blocks and mutexes all live inside the object
+    return sizeof(ESPRazorBlade);
+#else
+    // Task stacks are allocated separately (ESP32 stack depth is in bytes)
+    size_t footprint = sizeof(ESPRazorBlade) + WIFI_TASK_STACK_SIZE + MQTT_TASK_STACK_SIZE;
+    if (httpTaskHandle != nullptr) {
+        footprint += HTTP_TASK_STACK_SIZE;
+    }
+    return footprint;
+#endif
+}
+
 void ESPRazorBlade::wifiTask(void* parameter) {
     ESPRazorBlade* instance = static_cast<ESPRazorBlade*>(parameter);
     
@@ -228,17 +626,180 @@ bool ESPRazorBlade::isWiFiConnected() {
     return wifiConnected && (WiFi.status() == WL_CONNECTED);
 }
 
+void ESPRazorBlade::httpTask(void* parameter) {
+#ifdef METRICS_HTTP_PORT
+    ESPRazorBlade* instance = static_cast<ESPRazorBlade*>(parameter);
+    
+    Serial.println("HTTP metrics task started");
+    
+    bool serverStarted = false;
+    while (true) {
+        if (!instance->wifiConnected) {
+            vTaskDelay(pdMS_TO_TICKS(WIFI_CHECK_INTERVAL_MS));
+            continue;
+        }
+        
+        if (!serverStarted) {
+            instance->metricsServer.begin();
+            serverStarted = true;
+            Serial.print("Metrics endpoint: http://");
+            Serial.print(WiFi.localIP().toString());
+            Serial.print(":");
+            Serial.print(METRICS_HTTP_PORT);
+            Serial.println("/metrics");
+        }
+        
+        // Slow or idle clients only hold their own slot until HTTP_REQUEST_TIMEOUT_MS; when
+        // all slots are busy, new connections wait in the listen backlog
+        bool busy = instance->acceptMetricsClients();
+        unsigned long now = millis();
+        for (int i = 0; i < METRICS_HTTP_MAX_CLIENTS; i++) {
+            MetricsClient& slot = instance->metricsClients[i];
+            if (slot.active && instance->readMetricsRequest(slot, now)) {
+                slot.client.stop();
+                slot.active = false;
+            }
+            busy |= slot.active;
+        }
+        vTaskDelay(pdMS_TO_TICKS(busy ? HTTP_READ_INTERVAL_MS : HTTP_ACCEPT_INTERVAL_MS));
+    }
+#else
+    vTaskDelete(nullptr);
+#endif
+}
+
+#ifdef METRICS_HTTP_PORT
+bool ESPRazorBlade::acceptMetricsClients() {
+    bool accepted = false;
+    for (int i = 0; i < METRICS_HTTP_MAX_CLIENTS; i++) {
+        MetricsClient& slot = metricsClients[i];
+        if (slot.active) {
+            continue;
+        }
+        slot.client = metricsServer.available();
+        if (!slot.client) {
+            break;  // No connection pending
+        }
+        slot.active = true;
+        slot.acceptedAt = millis();
+        slot.requestLen = 0;
+        slot.requestLineDone = false;
+        slot.lineEmpty = true;
+        accepted = true;
+    }
+    return accepted;
+}
+
+bool ESPRazorBlade::readMetricsRequest(MetricsClient& slot, unsigned long now) {
+    // Read what has arrived of the request head, up to the blank line; only the request
+    // line is kept. A bounded amount per pass, so one client cannot hold the task
+    for (int budget = 512; budget > 0 && slot.client.available() > 0; budget--) {
+        char c = (char)slot.client.read();
+        if (c == '\n') {
+            if (slot.lineEmpty && slot.requestLineDone) {
+                slot.requestLine[slot.requestLen] = '\0';
+                serveMetrics(slot.client, slot.requestLine);
+                return true;
+            }
+            slot.requestLineDone = true;
+            slot.lineEmpty = true;
+        } else if (c != '\r') {
+            slot.lineEmpty = false;
+            if (!slot.requestLineDone && slot.requestLen < sizeof(slot.requestLine) - 1) {
+                slot.requestLine[slot.requestLen++] = c;
+            }
+        }
+    }
+    
+    // Client went away, or is too slow to send a request
+    return !slot.client.connected() || (now - slot.acceptedAt) >= (unsigned long)HTTP_REQUEST_TIMEOUT_MS;
+}
+#endif
+
+void ESPRazorBlade::serveMetrics(WiFiClient& client, const char* requestLine) {
+    if (strncmp(requestLine, "GET /metrics ", 13) != 0 && strncmp(requestLine, "GET /metrics?", 13) != 0) {
+        client.print("HTTP/1.1 404 Not Found\r\nContent-Type: text/plain\r\nConnection: close\r\n\r\nNot Found\n");
+        return;
+    }
+    
+    client.print("HTTP/1.1 200 OK\r\n"
+                 "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                 "Connection: close\r\n\r\n");
+    
+    char line[256];
+    int len = snprintf(line, sizeof(line),
+                       "# TYPE esprazorblade_uptime_seconds gauge\n"
+                       "esprazorblade_uptime_seconds{device=\"%s\"} %lu\n",
+                       deviceId, millis() / 1000UL);
+    client.write((const uint8_t*)line, len);
+    
+    // Values come from the sample cache; the lock is only held to copy one entry
+    TelemetryConfig config;
+    for (int i = 0; i < MAX_TELEMETRY_CALLBACKS; i++) {
+        if (!readTelemetryConfig(i, config)) {
+            continue;
+        }
+        char value[sizeof(telemetryCallbacks[i].lastValue)];
+        bool hasSample = false;
+        if (xSemaphoreTake(sampleMutex, pdMS_TO_TICKS(HTTP_REQUEST_TIMEOUT_MS)) != pdTRUE) {
+            continue;
+        }
+        // Samples taken before the metric was re-registered or updated are not served
+        if (telemetryCallbacks[i].hasSample && telemetryCallbacks[i].sampleGeneration == config.generation) {
+            memcpy(value, telemetryCallbacks[i].lastValue, sizeof(value));
+            hasSample = true;
+        }
+        xSemaphoreGive(sampleMutex);
+        
+        if (!hasSample) {
+            continue;
+        }
+        
+        // Prometheus values must be numeric; text metrics (e.g. time_alive) are skipped.
+        // Numeric values are served exactly as sampled
+        char* end = nullptr;
+        strtod(value, &end);
+        bool numeric = (isdigit((unsigned char)value[0]) || value[0] == '-' || value[0] == '+' || value[0] == '.') &&
+                       end != value && *end == '\0' && strpbrk(value, "xX") == nullptr;
+        if (!numeric) {
+            continue;
+        }
+        
+        char name[96];
+        metricNameForTopic(deviceId, config.topic, name, sizeof(name));
+        len = snprintf(line, sizeof(line), "# TYPE %s gauge\n%s{device=\"%s\"} %s\n",
+                       name, name, deviceId, value);
+        if (len > 0 && (size_t)len < sizeof(line)) {
+            client.write((const uint8_t*)line, len);
+        }
+    }
+}
+
 void ESPRazorBlade::mqttTask(void* parameter) {
     ESPRazorBlade* instance = static_cast<ESPRazorBlade*>(parameter);
     
     Serial.println("MQTT task started");
     
     while (true) {
+#ifndef MQTT_BROKER
+        // No broker configured (LAN scrape only): keep the sample cache fresh for the metrics endpoint
+        if (instance->wifiConnected) {
+            instance->refreshSampleCache();
+        }
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(instance->nextWakeDelayMs()));
+        continue;
+#endif
+        
         // Only process MQTT if WiFi is connected
         if (instance->wifiConnected) {
             // Check MQTT connection
             if (!instance->mqttClient.connected()) {
                 instance->mqttConnected = false;
+                instance->resetSessionState(); // Broker-only drops too: the clean session lost our subscriptions
+#ifdef METRICS_HTTP_PORT
+                // Keep the sample cache fresh for the metrics endpoint while the broker is down
+                instance->refreshSampleCache();
+#endif
                 // Only attempt connection if we're not already trying
                 // Wait 2 seconds after WiFi connects before first MQTT attempt
                 if (!instance->mqttConnecting) {
@@ -252,34 +813,69 @@ void ESPRazorBlade::mqttTask(void* parameter) {
                 instance->mqttConnected = true;
                 instance->mqttConnecting = false; // Clear connecting flag when connected
                 
-                // Subscribe to config topics if not already subscribed
-                // This handles cases where device was already connected when code was updated
+                // Telemetry and subscription callbacks may run from here (inbound messages are
+                // also processed while waiting for a SUBACK); unregisterTelemetry() and
+                // unsubscribe() wait for the epoch to move on
+                __atomic_add_fetch(&instance->schedulerEpoch, 1, __ATOMIC_SEQ_CST);
+                
+                // Subscribe to config topics after every (re)connect. Only done here, inside the
+                // epoch, because subscribe() delivers inbound messages while waiting for the SUBACK
                 if (!instance->configTopicsSubscribed) {
                     instance->subscribeToConfigTopics();
                 }
                 
+                // Mirror subscribe()/unsubscribe() calls (and restore them after a reconnect)
+                instance->syncSubscriptions();
+                
                 // Poll MQTT to maintain connection and process messages
                 instance->mqttClient.poll();
                 
                 // Process telemetry callbacks
                 instance->processTelemetry();
+                
+                // A probe failure seen in a message callback only requests the reconnect; the
+                // client is stopped here, after poll() has returned
+                if (instance->mqttRestartRequested) {
+                    instance->restartMQTTConnection();
+                }
+                
+                __atomic_add_fetch(&instance->schedulerEpoch, 1, __ATOMIC_SEQ_CST);
+                
+                // Sleep until inbound data arrives, the next telemetry deadline or the keepalive
+                instance->waitForMQTTActivity(instance->nextWakeDelayMs());
+                continue;
             }
         } else {
             instance->mqttConnected = false;
             instance->mqttConnecting = false; // Clear connecting flag when WiFi disconnects
             instance->wifiConnectedTime = 0; // Reset WiFi connection time
+#ifdef TELEMETRY_TRANSPORT_UDP
+            instance->udpGatewayResolved = false; // Resolve the gateway again on reconnect
+            instance->lastUdpRegister = 0; // Register topic ids again (the address may have changed)
+#endif
             instance->firstMQTTAttempt = true; // Reset for next WiFi connection
             instance->resetReasonPublished = false; // Reset for next MQTT connection
             instance->configTimeoutsPublished = false; // Reset for next MQTT connection
-            instance->configTopicsSubscribed = false; // Reset for next MQTT connection
+            instance->lastHealthPublish = 0; // Publish health right after reconnect
+            instance->resetSessionState();
+#ifdef TELEMETRY_TRANSPORT_UDP
+            for (int i = 0; i < MAX_TELEMETRY_CALLBACKS; i++) {
+                instance->telemetryCallbacks[i].udpRegisteredGeneration = 0;
+            }
+#endif
         }
         
-        // Small delay to prevent tight loop
-        vTaskDelay(pdMS_TO_TICKS(MQTT_POLL_INTERVAL_MS));
+        // Small delay to prevent tight loop while not connected
+        // Woken early when a message is queued so critical messages go out immediately
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(MQTT_POLL_INTERVAL_MS));
     }
 }
 
 void ESPRazorBlade::connectMQTT() {
+#ifndef MQTT_BROKER
+    // LAN-only mode, nothing to connect to
+    return;
+#else
     // Set connecting flag to prevent overlapping attempts
     mqttConnecting = true;
     
@@ -292,7 +888,10 @@ void ESPRazorBlade::connectMQTT() {
     Serial.println(MQTT_PORT);
     
     // Set client ID
-    mqttClient.setId(MQTT_CLIENT_ID);
+    mqttClient.setId(clientId);
+    
+    // The idle wait in mqttTask is derived from this interval
+    mqttClient.setKeepAliveInterval(MQTT_KEEPALIVE_MS);
     
     // Set username/password if provided
     #ifdef MQTT_USERNAME
@@ -313,19 +912,15 @@ void ESPRazorBlade::connectMQTT() {
             return;
         }
         
-        // Attempt connection (connect() takes host and port)
+        // Attempt connection (connect() returns 1 on success, the failure reason is in connectError())
         result = mqttClient.connect(MQTT_BROKER, MQTT_PORT);
         
-        if (result == 0) {
+        if (result != 0) {
             // Verify connection is actually established
             if (mqttClient.connected()) {
                 mqttConnected = true;
                 connected = true;
                 Serial.println("MQTT connected!");
-                
-                // Subscribe to configuration topics
-                subscribeToConfigTopics();
-                
                 mqttConnecting = false;
                 return;
             }
@@ -338,12 +933,21 @@ void ESPRazorBlade::connectMQTT() {
             if (retryCount == (isFirstAttempt ? 1 : 0)) {
                 // Print failure message only after first silent attempt fails
                 Serial.print("MQTT connection failed (rc=");
-                Serial.print(result);
+                Serial.print(mqttClient.connectError());
                 Serial.println("), retrying...");
             }
         }
         retryCount++;
+#ifdef METRICS_HTTP_PORT
+        // The metrics endpoint keeps serving fresh samples while the broker is unreachable
+        unsigned long retryStart = millis();
+        while ((millis() - retryStart) < (unsigned long)MQTT_RETRY_DELAY_MS) {
+            refreshSampleCache();
+            vTaskDelay(pdMS_TO_TICKS(MQTT_POLL_INTERVAL_MS));
+        }
+#else
         vTaskDelay(pdMS_TO_TICKS(MQTT_RETRY_DELAY_MS));
+#endif
     }
     
     // After retry loop, check one final time if we're connected
@@ -352,9 +956,6 @@ void ESPRazorBlade::connectMQTT() {
         mqttConnected = true;
         connected = true;
         Serial.println("MQTT connected!");
-        
-        // Subscribe to configuration topics
-        subscribeToConfigTopics();
     } else if (!connected) {
         // Only print failure if we're definitely not connected
         // Suppress failure message on first attempt to avoid confusing novice users
@@ -366,124 +967,889 @@ void ESPRazorBlade::connectMQTT() {
     }
     
     mqttConnecting = false;
+#endif
 }
 
-bool ESPRazorBlade::isMQTTConnected() {
-    return mqttConnected && mqttClient.connected();
-}
-
-bool ESPRazorBlade::publish(const char* topic, const char* payload, bool retained) {
-    if (!mqttConnected || !mqttClient.connected()) {
-        return false;
+unsigned long ESPRazorBlade::nextWakeDelayMs() {
+    // Queued messages are drained on the next cycle
+    for (int p = 0; p < PRIORITY_CLASS_COUNT; p++) {
+        if (queuedMessageCount((PublishPriority)p) > 0) {
+            return p == PRIORITY_BULK ? MQTT_POLL_INTERVAL_MS : 0;
+        }
     }
     
-    bool result = false;
-    if (xSemaphoreTake(mqttMutex, pdMS_TO_TICKS(1000)) == pdTRUE) {
-        mqttClient.beginMessage(topic, retained);
-        mqttClient.print(payload);
-        mqttClient.endMessage();
-        result = true;
-        xSemaphoreGive(mqttMutex);
+#ifdef STREAM_CHANNELS
+    // Completed stream blocks are uploaded on the next cycle
+    if (streamBlocksReady()) {
+        return 0;
     }
+#endif
     
-    return result;
-}
-
-bool ESPRazorBlade::publish(const char* topic, float value, bool retained) {
-    if (!mqttConnected || !mqttClient.connected()) {
-        return false;
+    // poll() must run at least twice per keepalive interval to send PINGREQ in time
+    unsigned long waitMs = MQTT_KEEPALIVE_MS / 2;
+    if (waitMs > (unsigned long)MQTT_MAX_IDLE_WAIT_MS) {
+        waitMs = MQTT_MAX_IDLE_WAIT_MS;
     }
     
-    bool result = false;
-    if (xSemaphoreTake(mqttMutex, pdMS_TO_TICKS(1000)) == pdTRUE) {
-        mqttClient.beginMessage(topic, retained);
-        mqttClient.print(value);
-        mqttClient.endMessage();
-        result = true;
-        xSemaphoreGive(mqttMutex);
+    unsigned long now = millis();
+    TelemetryConfig config;
+    for (int i = 0; i < MAX_TELEMETRY_CALLBACKS; i++) {
+        if (!readTelemetryConfig(i, config)) {
+            continue;
+        }
+        if (telemetryCallbacks[i].scheduledGeneration != config.generation) {
+            return 0;  // Registered or updated since the last cycle
+        }
+        unsigned long elapsed = now - telemetryCallbacks[i].lastExecution;
+        if (telemetryCallbacks[i].lastExecution == 0 || elapsed >= config.intervalMs) {
+            // Still due right after processTelemetry() means its publish failed or was deferred;
+            // retry after the regular poll interval instead of spinning
+            return MQTT_POLL_INTERVAL_MS;
+        }
+        unsigned long remaining = config.intervalMs - elapsed;
+        if (remaining < waitMs) {
+            waitMs = remaining;
+        }
     }
     
-    return result;
-}
-
-bool ESPRazorBlade::publish(const char* topic, int value, bool retained) {
-    if (!mqttConnected || !mqttClient.connected()) {
-        return false;
+    // Health telemetry is only published while connected
+    const unsigned long healthIntervalMs = HEALTH_INTERVAL_MS;
+    if (healthIntervalMs > 0 && mqttConnected) {
+        unsigned long elapsed = now - lastHealthPublish;
+        if (lastHealthPublish == 0 || elapsed >= healthIntervalMs) {
+            return MQTT_POLL_INTERVAL_MS;
+        }
+        if (healthIntervalMs - elapsed < waitMs) {
+            waitMs = healthIntervalMs - elapsed;
+        }
     }
     
-    bool result = false;
-    if (xSemaphoreTake(mqttMutex, pdMS_TO_TICKS(1000)) == pdTRUE) {
-        mqttClient.beginMessage(topic, retained);
-        mqttClient.print(value);
-        mqttClient.endMessage();
-        result = true;
-        xSemaphoreGive(mqttMutex);
+    // Next probe, or the deadline of the outstanding one
+    const unsigned long probeIntervalMs = MQTT_PROBE_INTERVAL_MS;
+    if (probeIntervalMs > 0 && mqttConnected) {
+        unsigned long deadline = probeOutstanding ? (unsigned long)MQTT_PROBE_TIMEOUT_MS : probeIntervalMs;
+        unsigned long since = probeOutstanding ? probeSentAt : lastProbe;
+        unsigned long elapsed = now - since;
+        if ((!probeOutstanding && lastProbe == 0) || elapsed >= deadline) {
+            return MQTT_POLL_INTERVAL_MS;
+        }
+        if (deadline - elapsed < waitMs) {
+            waitMs = deadline - elapsed;
+        }
     }
     
-    return result;
+    return waitMs;
 }
 
-bool ESPRazorBlade::publish(const char* topic, long value, bool retained) {
-    if (!mqttConnected || !mqttClient.connected()) {
-        return false;
+void ESPRazorBlade::waitForMQTTActivity(unsigned long timeoutMs) {
+    // Arm the wake socket, then take wake-ups given while this cycle ran. wakeMQTTTask()
+    // notifies before it checks the flag, so a wake-up is either taken here or sends a
+    // datagram that select() sees
+    if (wakeSocket >= 0) {
+        __atomic_store_n(&wakeSignalled, false, __ATOMIC_SEQ_CST);
+        uint8_t drain[8];
+        while (recv(wakeSocket, drain, sizeof(drain), MSG_DONTWAIT) > 0) {
+        }
     }
-    
-    bool result = false;
-    if (xSemaphoreTake(mqttMutex, pdMS_TO_TICKS(1000)) == pdTRUE) {
-        mqttClient.beginMessage(topic, retained);
-        mqttClient.print(value);
-        mqttClient.endMessage();
-        result = true;
-        xSemaphoreGive(mqttMutex);
+    if (ulTaskNotifyTake(pdTRUE, 0) > 0) {
+        return;  // Woken while busy: a message was queued or a subscription changed
     }
-    
-    return result;
-}
-
-bool ESPRazorBlade::registerTelemetry(const char* topic, TelemetryCallback callback, unsigned long intervalMs) {
-    // Check if we've reached the maximum number of callbacks
-    if (telemetryCallbackCount >= MAX_TELEMETRY_CALLBACKS) {
-        Serial.print("ERROR: Maximum number of telemetry callbacks (");
-        Serial.print(MAX_TELEMETRY_CALLBACKS);
-        Serial.println(") reached");
-        return false;
+#ifdef STREAM_CHANNELS
+    if (streamBlocksReady()) {
+        return;
     }
+#endif
     
-    // Validate inputs
-    if (topic == nullptr || callback == nullptr || intervalMs == 0) {
-        Serial.println("ERROR: Invalid telemetry registration parameters");
-        return false;
+    if (timeoutMs == 0 || wifiClient.available() > 0) {
+        return;  // Work pending or data already buffered by the client
     }
     
-    // Find an available slot
-    int slot = -1;
-    for (int i = 0; i < MAX_TELEMETRY_CALLBACKS; i++) {
-        if (!telemetryCallbacks[i].active) {
-            slot = i;
-            break;
+    int fd = wifiClient.fd();
+    if (fd < 0 || wakeSocket < 0) {
+        // No socket to wait on: wait for a wake-up and look at the connection every poll interval
+        if (timeoutMs > (unsigned long)MQTT_POLL_INTERVAL_MS) {
+            timeoutMs = MQTT_POLL_INTERVAL_MS;
         }
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(timeoutMs));
+        return;
     }
     
-    if (slot == -1) {
-        Serial.println("ERROR: No available slot for telemetry callback");
+    // Block until the socket is readable (inbound message, or error/close), another task
+    // wakes us, or the timeout expires
+    fd_set readSet;
+    FD_ZERO(&readSet);
+    FD_SET(fd, &readSet);
+    FD_SET(wakeSocket, &readSet);
+    struct timeval timeout;
+    timeout.tv_sec = timeoutMs / 1000;
+    timeout.tv_usec = (timeoutMs % 1000) * 1000;
+    select((fd > wakeSocket ? fd : wakeSocket) + 1, &readSet, nullptr, nullptr, &timeout);
+}
+
+void ESPRazorBlade::openWakeSocket() {
+    // Bound to a loopback port and connected to itself: one send() makes it readable
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        Serial.println("WARNING: Could not open wake socket, MQTT task polls while idle");
+        return;
+    }
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = 0;
+    socklen_t length = sizeof(address);
+    if (bind(fd, (struct sockaddr*)&address, sizeof(address)) != 0 ||
+        getsockname(fd, (struct sockaddr*)&address, &length) != 0 ||
+        connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        close(fd);
+        Serial.println("WARNING: Could not open wake socket, MQTT task polls while idle");
+        return;
+    }
+    __atomic_store_n(&wakeSocket, fd, __ATOMIC_SEQ_CST);
+}
+
+void ESPRazorBlade::wakeMQTTTask() {
+    if (mqttTaskHandle == nullptr) {
+        return;
+    }
+    xTaskNotifyGive(mqttTaskHandle);
+    
+    // One datagram per wait is enough; the MQTT task clears the flag before it blocks
+    int fd = __atomic_load_n(&wakeSocket, __ATOMIC_SEQ_CST);
+    if (fd >= 0 && !__atomic_exchange_n(&wakeSignalled, true, __ATOMIC_SEQ_CST)) {
+        uint8_t wake = 0;
+        send(fd, &wake, 1, MSG_DONTWAIT);
+    }
+}
+
+bool ESPRazorBlade::isMQTTConnected() {
+    return mqttConnected && mqttClient.connected();
+}
+
+long ESPRazorBlade::getBrokerRTT() {
+    return brokerRttMs;
+}
+
+bool ESPRazorBlade::publish(const char* topic, const char* payload, bool retained, PublishPriority priority) {
+    if (topic == nullptr || payload == nullptr || mqttMutex == nullptr) {
+        return false;
+    }
+    
+    bool connected = mqttConnected && mqttClient.connected();
+    
+    // The MQTT task runs the scheduler and drains the queues itself, so it always sends directly
+    if (xTaskGetCurrentTaskHandle() == mqttTaskHandle) {
+        return connected && sendMessage(topic, payload, retained, pdMS_TO_TICKS(MQTT_PUBLISH_TIMEOUT_MS));
+    }
+    
+    if (!connected) {
+        // Critical messages are held and sent first once the broker is reachable again
+        if (priority == PRIORITY_CRITICAL) {
+            return enqueueMessage(topic, payload, retained, priority);
+        }
         return false;
     }
     
-    // Copy topic (ensure it fits)
-    int topicLen = strlen(topic);
-    if (topicLen >= 64) {
+    switch (priority) {
+        case PRIORITY_CRITICAL:
+            // Never wait behind another publish; the MQTT task sends queued critical
+            // messages between telemetry publishes
+            if (queuedMessageCount(PRIORITY_CRITICAL) == 0 && sendMessage(topic, payload, retained, 0)) {
+                return true;
+            }
+            return enqueueMessage(topic, payload, retained, priority);
+        
+        case PRIORITY_BULK:
+            // Only take the direct path when nothing else is waiting
+            if (queuedMessageCount(PRIORITY_CRITICAL) == 0 && queuedMessageCount(PRIORITY_NORMAL) == 0 &&
+                queuedMessageCount(PRIORITY_BULK) == 0 && sendMessage(topic, payload, retained, 0)) {
+                return true;
+            }
+            return enqueueMessage(topic, payload, retained, priority);
+        
+        case PRIORITY_NORMAL:
+        default:
+            if (sendMessage(topic, payload, retained, pdMS_TO_TICKS(MQTT_PUBLISH_TIMEOUT_MS))) {
+                return true;
+            }
+            return enqueueMessage(topic, payload, retained, PRIORITY_NORMAL);
+    }
+}
+
+bool ESPRazorBlade::publish(const char* topic, float value, bool retained, PublishPriority priority) {
+    char buf[24];
+    snprintf(buf, sizeof(buf), "%.2f", value);
+    return publish(topic, buf, retained, priority);
+}
+
+bool ESPRazorBlade::publish(const char* topic, int value, bool retained, PublishPriority priority) {
+    char buf[12];
+    snprintf(buf, sizeof(buf), "%d", value);
+    return publish(topic, buf, retained, priority);
+}
+
+bool ESPRazorBlade::publish(const char* topic, long value, bool retained, PublishPriority priority) {
+    char buf[24];
+    snprintf(buf, sizeof(buf), "%ld", value);
+    return publish(topic, buf, retained, priority);
+}
+
+bool ESPRazorBlade::publish(const char* topic, const char* payload, PublishPriority priority) {
+    return publish(topic, payload, false, priority);
+}
+
+bool ESPRazorBlade::publish(const char* topic, float value, PublishPriority priority) {
+    return publish(topic, value, false, priority);
+}
+
+bool ESPRazorBlade::publish(const char* topic, int value, PublishPriority priority) {
+    return publish(topic, value, false, priority);
+}
+
+bool ESPRazorBlade::publish(const char* topic, long value, PublishPriority priority) {
+    return publish(topic, value, false, priority);
+}
+
+bool ESPRazorBlade::sendMessage(const char* topic, const char* payload, bool retained, TickType_t waitTicks) {
+    if (!mqttConnected || !mqttClient.connected()) {
+        return false;
+    }
+    
+    bool result = false;
+    if (xSemaphoreTake(mqttMutex, waitTicks) == pdTRUE) {
+        size_t payloadLen = strlen(payload);
+        bool framed = isCompressionTopic(topic);  // Receivers run the RZ decoder on this topic
+        size_t compressedLen = 0;
+        if (framed && shouldCompress(payloadLen)) {
+            // First pass only counts, so the exact size is known up front and the
+            // compressed stream can be written straight into the client
+            compressedLen = COMPRESSION_HEADER_LEN + compressPayload((const uint8_t*)payload, payloadLen, nullptr);
+            if (compressedLen >= payloadLen) {
+                compressedLen = 0;  // Incompressible, send as is
+            }
+        }
+        
+        if (compressedLen > 0) {
+            uint8_t header[COMPRESSION_HEADER_LEN] = {
+                COMPRESSION_MAGIC_0, COMPRESSION_MAGIC_1, COMPRESSION_FORMAT,
+                (uint8_t)(payloadLen >> 8), (uint8_t)(payloadLen & 0xFF)
+            };
+            mqttClient.beginMessage(topic, (unsigned long)compressedLen, retained);
+            mqttClient.write(header, sizeof(header));
+            compressPayload((const uint8_t*)payload, payloadLen, &mqttClient);
+        } else if (framed && payload[0] == COMPRESSION_MAGIC_0 && payload[1] == COMPRESSION_MAGIC_1) {
+            // Escaped so the decoder cannot mistake it for a compressed payload
+            uint8_t escape[COMPRESSION_ESCAPE_LEN] = {COMPRESSION_MAGIC_0, COMPRESSION_MAGIC_1, COMPRESSION_FORMAT_RAW};
+            mqttClient.beginMessage(topic, (unsigned long)(COMPRESSION_ESCAPE_LEN + payloadLen), retained);
+            mqttClient.write(escape, sizeof(escape));
+            mqttClient.write((const uint8_t*)payload, payloadLen);
+        } else {
+            mqttClient.beginMessage(topic, retained);
+            mqttClient.print(payload);
+        }
+        mqttClient.endMessage();
+        result = true;
+        xSemaphoreGive(mqttMutex);
+    }
+    
+    return result;
+}
+
+bool ESPRazorBlade::enableCompression(const char* topicPrefix) {
+    if (topicPrefix == nullptr || topicPrefix[0] == '\0' ||
+        strlen(topicPrefix) >= sizeof(compressedTopics[0])) {
+        Serial.println("ERROR: Invalid compression topic prefix");
+        return false;
+    }
+    if (compressedTopicCount >= MAX_COMPRESSED_TOPICS) {
+        Serial.print("ERROR: Maximum number of compressed topic prefixes (");
+        Serial.print(MAX_COMPRESSED_TOPICS);
+        Serial.println(") reached");
+        return false;
+    }
+    
+    strncpy(compressedTopics[compressedTopicCount], topicPrefix, sizeof(compressedTopics[0]) - 1);
+    compressedTopics[compressedTopicCount][sizeof(compressedTopics[0]) - 1] = '\0';
+    compressedTopicCount++;
+    
+    Serial.print("Compression enabled for topics: ");
+    Serial.print(topicPrefix);
+    Serial.println("*");
+    return true;
+}
+
+#ifdef STREAM_CHANNELS
+int ESPRazorBlade::openStream(const char* topic) {
+    if (topic == nullptr || topic[0] == '\0' || strlen(topic) >= sizeof(streamChannels[0].topic)) {
+        Serial.println("ERROR: Invalid stream topic");
+        return -1;
+    }
+    
+    for (int c = 0; c < STREAM_CHANNELS; c++) {
+        StreamChannel& stream = streamChannels[c];
+        
+        portENTER_CRITICAL(&stream.lock);
+        if (stream.open || stream.readyCount > 0) {
+            // In use, or closed with blocks still waiting for upload
+            portEXIT_CRITICAL(&stream.lock);
+            continue;
+        }
+        strncpy(stream.topic, topic, sizeof(stream.topic) - 1);
+        stream.topic[sizeof(stream.topic) - 1] = '\0';
+        stream.head = 0;
+        stream.readyCount = 0;
+        stream.fillIndex = -1;
+        stream.fillLength = 0;
+        stream.droppedBytes = 0;
+        stream.sequence = 0;
+        stream.overruns = 0;
+        stream.open = true;
+        portEXIT_CRITICAL(&stream.lock);
+        
+        Serial.print("Stream opened: ");
+        Serial.println(topic);
+        return c;
+    }
+    
+    Serial.print("ERROR: Maximum number of stream channels (");
+    Serial.print(STREAM_CHANNELS);
+    Serial.println(") reached");
+    return -1;
+}
+
+size_t ESPRazorBlade::streamWrite(int channel, const void* data, size_t len) {
+    return streamWriteInternal(channel, (const uint8_t*)data, len, false);
+}
+
+size_t IRAM_ATTR ESPRazorBlade::streamWriteFromISR(int channel, const void* data, size_t len) {
+    return streamWriteInternal(channel, (const uint8_t*)data, len, true);
+}
+
+size_t IRAM_ATTR ESPRazorBlade::streamWriteInternal(int channel, const uint8_t* data, size_t len, bool fromISR) {
+    if (channel < 0 || channel >= STREAM_CHANNELS || data == nullptr || !streamChannels[channel].open) {
+        return 0;
+    }
+    StreamChannel& stream = streamChannels[channel];
+    
+    // One critical section per block, so interrupts and the other core are held off for
+    // at most one STREAM_BLOCK_SIZE copy however long the write is
+    size_t accepted = 0;
+    bool completed = false;
+    bool dropped = false;
+    while (accepted < len && !dropped) {
+        if (fromISR) {
+            portENTER_CRITICAL_ISR(&stream.lock);
+        } else {
+            portENTER_CRITICAL(&stream.lock);
+        }
+        
+        if (!stream.open) {
+            dropped = true;  // Closed by another task mid-write
+        } else if (stream.fillIndex < 0 && stream.readyCount >= STREAM_BLOCK_COUNT) {
+            // Upload is behind: drop the rest, one sequence number per block's worth
+            stream.droppedBytes += len - accepted;
+            while (stream.droppedBytes >= (size_t)STREAM_BLOCK_SIZE) {
+                stream.droppedBytes -= STREAM_BLOCK_SIZE;
+                stream.sequence++;
+                stream.overruns++;
+            }
+            dropped = true;
+        } else {
+            if (stream.fillIndex < 0) {
+                if (stream.droppedBytes > 0) {
+                    // A partially dropped block still counts as lost
+                    stream.droppedBytes = 0;
+                    stream.sequence++;
+                    stream.overruns++;
+                }
+                stream.fillIndex = (stream.head + stream.readyCount) % STREAM_BLOCK_COUNT;
+                stream.fillLength = 0;
+            }
+            
+            size_t chunk = STREAM_BLOCK_SIZE - stream.fillLength;
+            if (chunk > len - accepted) {
+                chunk = len - accepted;
+            }
+            memcpy(stream.blocks[stream.fillIndex] + STREAM_HEADER_LEN + stream.fillLength, data + accepted, chunk);
+            stream.fillLength += chunk;
+            accepted += chunk;
+            
+            if (stream.fillLength == (size_t)STREAM_BLOCK_SIZE) {
+                completeStreamBlock(stream);
+                completed = true;
+            }
+        }
+        
+        if (fromISR) {
+            portEXIT_CRITICAL_ISR(&stream.lock);
+        } else {
+            portEXIT_CRITICAL(&stream.lock);
+        }
+    }
+    
+    // Wake the MQTT task to upload the block
+    if (completed && mqttTaskHandle != nullptr) {
+        if (fromISR) {
+            // send() is not ISR-safe: the notification covers a busy MQTT task, and the
+            // timer service task sends the wake datagram that ends a select() wait
+            BaseType_t higherPriorityTaskWoken = pdFALSE;
+            vTaskNotifyGiveFromISR(mqttTaskHandle, &higherPriorityTaskWoken);
+            if (__atomic_load_n(&wakeSocket, __ATOMIC_SEQ_CST) >= 0 &&
+                !__atomic_load_n(&wakeSignalled, __ATOMIC_SEQ_CST)) {
+                xTimerPendFunctionCallFromISR(wakeMQTTTaskPended, this, 0, &higherPriorityTaskWoken);
+            }
+            if (higherPriorityTaskWoken == pdTRUE) {
+                portYIELD_FROM_ISR();
+            }
+        } else {
+            wakeMQTTTask();
+        }
+    }
+    
+    return accepted;
+}
+
+void ESPRazorBlade::wakeMQTTTaskPended(void* instance, uint32_t unused) {
+    ((ESPRazorBlade*)instance)->wakeMQTTTask();
+}
+
+void IRAM_ATTR ESPRazorBlade::completeStreamBlock(StreamChannel& stream) {
+    // Header is written in place so the block is published without another copy
+    uint8_t* block = stream.blocks[stream.fillIndex];
+    block[0] = (uint8_t)(stream.sequence >> 24);
+    block[1] = (uint8_t)(stream.sequence >> 16);
+    block[2] = (uint8_t)(stream.sequence >> 8);
+    block[3] = (uint8_t)(stream.sequence & 0xFF);
+    block[4] = (uint8_t)(stream.overruns >> 24);
+    block[5] = (uint8_t)(stream.overruns >> 16);
+    block[6] = (uint8_t)(stream.overruns >> 8);
+    block[7] = (uint8_t)(stream.overruns & 0xFF);
+    stream.blockLength[stream.fillIndex] = stream.fillLength;
+    stream.sequence++;
+    stream.readyCount++;
+    stream.fillIndex = -1;
+    stream.fillLength = 0;
+}
+
+bool ESPRazorBlade::streamFlush(int channel) {
+    if (channel < 0 || channel >= STREAM_CHANNELS || !streamChannels[channel].open) {
+        return false;
+    }
+    StreamChannel& stream = streamChannels[channel];
+    
+    bool completed = false;
+    portENTER_CRITICAL(&stream.lock);
+    if (stream.fillIndex >= 0 && stream.fillLength > 0) {
+        completeStreamBlock(stream);
+        completed = true;
+    }
+    portEXIT_CRITICAL(&stream.lock);
+    
+    if (completed) {
+        wakeMQTTTask();
+    }
+    return completed;
+}
+
+bool ESPRazorBlade::closeStream(int channel) {
+    if (channel < 0 || channel >= STREAM_CHANNELS) {
+        return false;
+    }
+    StreamChannel& stream = streamChannels[channel];
+    
+    bool wasOpen = false;
+    bool completed = false;
+    portENTER_CRITICAL(&stream.lock);
+    if (stream.open) {
+        wasOpen = true;
+        if (stream.fillIndex >= 0 && stream.fillLength > 0) {
+            completeStreamBlock(stream);
+            completed = true;
+        }
+        stream.fillIndex = -1;
+        stream.fillLength = 0;
+        stream.open = false;
+    }
+    portEXIT_CRITICAL(&stream.lock);
+    
+    if (!wasOpen) {
+        return false;
+    }
+    if (completed) {
+        wakeMQTTTask();
+    }
+    Serial.print("Stream closed: ");
+    Serial.println(stream.topic);
+    return true;
+}
+
+unsigned long ESPRazorBlade::getStreamOverruns(int channel) {
+    if (channel < 0 || channel >= STREAM_CHANNELS) {
+        return 0;
+    }
+    // Single aligned read, no lock needed for a snapshot
+    return streamChannels[channel].overruns;
+}
+
+bool ESPRazorBlade::streamBlocksReady() {
+    for (int c = 0; c < STREAM_CHANNELS; c++) {
+        if (streamChannels[c].readyCount > 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void ESPRazorBlade::drainStreams() {
+    for (int c = 0; c < STREAM_CHANNELS; c++) {
+        StreamChannel& stream = streamChannels[c];
+        // Closed channels are drained too, so closeStream() loses no completed block
+        for (;;) {
+            portENTER_CRITICAL(&stream.lock);
+            int count = stream.readyCount;
+            int index = stream.head;
+            portEXIT_CRITICAL(&stream.lock);
+            if (count == 0) {
+                break;
+            }
+            
+            // The block belongs to the uploader until head advances, so it is written
+            // to the client straight from the ring
+            if (!mqttConnected || !mqttClient.connected() ||
+                xSemaphoreTake(mqttMutex, pdMS_TO_TICKS(MQTT_PUBLISH_TIMEOUT_MS)) != pdTRUE) {
+                return;  // Keep the block for the next cycle
+            }
+            size_t length = STREAM_HEADER_LEN + stream.blockLength[index];
+            mqttClient.beginMessage(stream.topic, (unsigned long)length, false);
+            mqttClient.write(stream.blocks[index], length);
+            bool sent = mqttClient.endMessage() == 1;
+            xSemaphoreGive(mqttMutex);
+            if (!sent) {
+                return;  // Connection dropped; retry the block after reconnect
+            }
+            
+            portENTER_CRITICAL(&stream.lock);
+            stream.head = (stream.head + 1) % STREAM_BLOCK_COUNT;
+            stream.readyCount--;
+            portEXIT_CRITICAL(&stream.lock);
+            
+            // Critical messages are not held back behind a burst of blocks
+            drainOutboundQueue(PRIORITY_CRITICAL, OUTBOUND_QUEUE_SIZE);
+        }
+    }
+}
+#endif
+
+bool ESPRazorBlade::isCompressionTopic(const char* topic) {
+    // Only topics the application opted in with enableCompression() carry compressed or
+    // escaped payloads; every other topic keeps its wire format
+    for (int i = 0; i < compressedTopicCount; i++) {
+        if (strncmp(topic, compressedTopics[i], strlen(compressedTopics[i])) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ESPRazorBlade::shouldCompress(size_t payloadLen) {
+    if (payloadLen < COMPRESSION_MIN_PAYLOAD || payloadLen > COMPRESSION_MAX_PAYLOAD) {
+        return false;
+    }
+    const size_t thresholdBytes = COMPRESSION_THRESHOLD_BYTES;
+    return payloadLen >= thresholdBytes;
+}
+
+size_t ESPRazorBlade::compressPayload(const uint8_t* data, size_t len, Print* out) {
+    // LZSS over the payload itself: matches point back into the input, so the only
+    // state is the hash table of last positions (no window copy, no output buffer)
+    for (int i = 0; i < COMPRESSION_HASH_SIZE; i++) {
+        compressionHash[i] = COMPRESSION_HASH_EMPTY;
+    }
+    
+    uint8_t group[1 + 8 * 2];  // Flag byte + up to 8 tokens of at most 2 bytes
+    size_t groupLen = 1;
+    int tokenCount = 0;
+    size_t total = 0;
+    group[0] = 0;
+    
+    size_t pos = 0;
+    while (pos < len) {
+        size_t matchLen = 0;
+        size_t matchOffset = 0;
+        
+        if (pos + COMPRESSION_MIN_MATCH <= len) {
+            uint16_t hash = compressionHashOf(data + pos);
+            uint16_t candidate = compressionHash[hash];
+            compressionHash[hash] = (uint16_t)pos;
+            if (candidate != COMPRESSION_HASH_EMPTY && pos - candidate <= COMPRESSION_WINDOW) {
+                size_t maxLen = len - pos < COMPRESSION_MAX_MATCH ? len - pos : COMPRESSION_MAX_MATCH;
+                while (matchLen < maxLen && data[candidate + matchLen] == data[pos + matchLen]) {
+                    matchLen++;
+                }
+                matchOffset = pos - candidate;
+            }
+        }
+        
+        if (matchLen >= COMPRESSION_MIN_MATCH) {
+            // Match token: 12-bit (offset - 1), 4-bit (length - 3)
+            group[0] |= (uint8_t)(1 << tokenCount);
+            group[groupLen++] = (uint8_t)((matchOffset - 1) & 0xFF);
+            group[groupLen++] = (uint8_t)((((matchOffset - 1) >> 8) << 4) | (matchLen - COMPRESSION_MIN_MATCH));
+            
+            // Index the positions covered by the match so later data can refer to them
+            for (size_t k = 1; k < matchLen && pos + k + COMPRESSION_MIN_MATCH <= len; k++) {
+                compressionHash[compressionHashOf(data + pos + k)] = (uint16_t)(pos + k);
+            }
+            pos += matchLen;
+        } else {
+            group[groupLen++] = data[pos++];
+        }
+        
+        if (++tokenCount == 8 || pos >= len) {
+            if (out != nullptr) {
+                out->write(group, groupLen);
+            }
+            total += groupLen;
+            groupLen = 1;
+            tokenCount = 0;
+            group[0] = 0;
+        }
+    }
+    
+    return total;
+}
+
+uint16_t ESPRazorBlade::compressionHashOf(const uint8_t* p) {
+    uint32_t v = (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16);
+    return (uint16_t)(((uint32_t)(v * 2654435761UL) >> 24) & (COMPRESSION_HASH_SIZE - 1));
+}
+
+bool ESPRazorBlade::enqueueMessage(const char* topic, const char* payload, bool retained, PublishPriority priority) {
+    if (queueMutex == nullptr) {
+        return false;
+    }
+    size_t topicLen = strlen(topic);
+    size_t payloadLen = strlen(payload);
+    size_t size = topicLen + 1 + payloadLen + 1;
+    if (size > OUTBOUND_QUEUE_BYTES) {
+        Serial.print("ERROR: Message too large to queue (OUTBOUND_QUEUE_BYTES): ");
+        Serial.println(topic);
+        return false;
+    }
+    
+    bool queued = false;
+    bool shed = false;
+    if (xSemaphoreTake(queueMutex, pdMS_TO_TICKS(MQTT_PUBLISH_TIMEOUT_MS)) == pdTRUE) {
+        int p = (int)priority;
+        int offset = -1;
+        while (true) {
+            if (outboundCount[p] < OUTBOUND_QUEUE_SIZE) {
+                offset = reserveOutboundBytes(p, size);
+                if (offset >= 0) {
+                    break;
+                }
+            }
+            // Shed the oldest bulk messages to make room for the newest one (not the one
+            // the MQTT task is sending right now)
+            if (priority != PRIORITY_BULK || outboundCount[p] == 0 || outboundSending[p]) {
+                break;
+            }
+            removeOldestMessage(p);
+            outboundDropped[p]++;
+            shed = true;
+        }
+        if (offset >= 0) {
+            OutboundMessage& slot = outboundQueue[p][(outboundHead[p] + outboundCount[p]) % OUTBOUND_QUEUE_SIZE];
+            memcpy(&outboundData[p][offset], topic, topicLen + 1);
+            memcpy(&outboundData[p][offset + topicLen + 1], payload, payloadLen + 1);
+            slot.offset = (uint16_t)offset;
+            slot.size = (uint16_t)size;
+            slot.retained = retained;
+            outboundDataTail[p] = (uint16_t)(offset + size);
+            __atomic_store_n(&outboundCount[p], outboundCount[p] + 1, __ATOMIC_RELEASE);
+            queued = true;
+        } else {
+            outboundDropped[p]++;
+        }
+        xSemaphoreGive(queueMutex);
+    }
+    
+    if (shed) {
+        Serial.println("WARNING: Bulk queue full, dropped oldest bulk message");
+    }
+    if (!queued) {
+        Serial.print("ERROR: Outbound queue full, message dropped: ");
+        Serial.println(topic);
+    }
+    
+    // Wake the MQTT task so the message does not wait for the next poll interval
+    if (queued) {
+        wakeMQTTTask();
+    }
+    
+    return queued;
+}
+
+int ESPRazorBlade::reserveOutboundBytes(int p, size_t size) {
+    if (outboundCount[p] == 0) {
+        return size <= OUTBOUND_QUEUE_BYTES ? 0 : -1;  // Empty: start over at the beginning
+    }
+    // Free space is strictly less than the gap, so tail == head only when the ring is empty
+    size_t head = outboundQueue[p][outboundHead[p]].offset;
+    size_t tail = outboundDataTail[p];
+    if (tail > head) {
+        if (tail + size <= OUTBOUND_QUEUE_BYTES) {
+            return (int)tail;
+        }
+        return size < head ? 0 : -1;  // Wrap; the bytes after tail stay unused until then
+    }
+    return tail + size < head ? (int)tail : -1;
+}
+
+void ESPRazorBlade::removeOldestMessage(int p) {
+    outboundHead[p] = (outboundHead[p] + 1) % OUTBOUND_QUEUE_SIZE;
+    __atomic_store_n(&outboundCount[p], outboundCount[p] - 1, __ATOMIC_RELEASE);
+}
+
+bool ESPRazorBlade::peekMessage(PublishPriority priority, const char*& topic, const char*& payload, bool& retained) {
+    bool found = false;
+    if (xSemaphoreTake(queueMutex, pdMS_TO_TICKS(MQTT_PUBLISH_TIMEOUT_MS)) == pdTRUE) {
+        int p = (int)priority;
+        if (outboundCount[p] > 0) {
+            // Read in place: producers only write free bytes, and the message cannot be
+            // shed while outboundSending is set
+            const OutboundMessage& message = outboundQueue[p][outboundHead[p]];
+            topic = &outboundData[p][message.offset];
+            payload = topic + strlen(topic) + 1;
+            retained = message.retained;
+            outboundSending[p] = true;
+            found = true;
+        }
+        xSemaphoreGive(queueMutex);
+    }
+    return found;
+}
+
+void ESPRazorBlade::finishMessage(PublishPriority priority, bool sent) {
+    // Taken without a timeout: outboundSending must not stay set
+    xSemaphoreTake(queueMutex, portMAX_DELAY);
+    int p = (int)priority;
+    if (sent) {
+        removeOldestMessage(p);
+    }
+    outboundSending[p] = false;
+    xSemaphoreGive(queueMutex);
+}
+
+int ESPRazorBlade::queuedMessageCount(PublishPriority priority) {
+    return __atomic_load_n(&outboundCount[(int)priority], __ATOMIC_ACQUIRE);
+}
+
+void ESPRazorBlade::drainOutboundQueue(PublishPriority priority, int maxMessages) {
+    if (queueMutex == nullptr) {
+        return;
+    }
+    
+    const char* topic;
+    const char* payload;
+    bool retained;
+    int sent = 0;
+    while (sent < maxMessages && queuedMessageCount(priority) > 0) {
+        if (!peekMessage(priority, topic, payload, retained)) {
+            break;
+        }
+        bool ok = sendMessage(topic, payload, retained, pdMS_TO_TICKS(MQTT_PUBLISH_TIMEOUT_MS));
+        // On failure the connection dropped; the message stays at the front for the next cycle
+        finishMessage(priority, ok);
+        if (!ok) {
+            break;
+        }
+        sent++;
+    }
+}
+
+bool ESPRazorBlade::registerTelemetry(const char* topic, TelemetryCallback callback, unsigned long intervalMs,
+                                      PublishPriority priority) {
+    if (callback == nullptr) {
+        Serial.println("ERROR: Invalid telemetry registration parameters");
+        return false;
+    }
+    return addTelemetryEntry(topic, callback, nullptr, intervalMs, priority);
+}
+
+bool ESPRazorBlade::registerTelemetry(const char* topic, TelemetryBufferCallback callback, unsigned long intervalMs,
+                                      PublishPriority priority) {
+    if (callback == nullptr) {
+        Serial.println("ERROR: Invalid telemetry registration parameters");
+        return false;
+    }
+    return addTelemetryEntry(topic, nullptr, callback, intervalMs, priority);
+}
+
+bool ESPRazorBlade::addTelemetryEntry(const char* topic, TelemetryCallback callback,
+                                      TelemetryBufferCallback bufferCallback, unsigned long intervalMs,
+                                      PublishPriority priority) {
+    // Validate inputs
+    if (topic == nullptr || intervalMs == 0) {
+        Serial.println("ERROR: Invalid telemetry registration parameters");
+        return false;
+    }
+    if (strlen(topic) >= sizeof(telemetryCallbacks[0].config.topic)) {
         Serial.println("ERROR: Topic name too long (max 63 characters)");
         return false;
     }
     
-    strncpy(telemetryCallbacks[slot].topic, topic, 63);
-    telemetryCallbacks[slot].topic[63] = '\0';
-    telemetryCallbacks[slot].callback = callback;
-    telemetryCallbacks[slot].intervalMs = intervalMs;
-    telemetryCallbacks[slot].lastExecution = 0; // Will execute on next check
-    telemetryCallbacks[slot].active = true;
+    // Find a slot and fill it under the writer lock; the scheduler reads without it
+    int slot = -1;
+    bool full = false;
+    bool duplicate = false;
+    portENTER_CRITICAL(&registryLock);
+    if (telemetryCallbackCount >= MAX_TELEMETRY_CALLBACKS) {
+        full = true;
+    } else {
+        for (int i = 0; i < MAX_TELEMETRY_CALLBACKS; i++) {
+            if (telemetryCallbacks[i].config.active) {
+                if (strcmp(telemetryCallbacks[i].config.topic, topic) == 0) {
+                    duplicate = true;
+                    break;
+                }
+            } else if (slot == -1) {
+                slot = i;
+            }
+        }
+        if (!duplicate && slot != -1) {
+            TelemetryEntry& entry = telemetryCallbacks[slot];
+            beginRegistryWrite(entry);
+            strncpy(entry.config.topic, topic, sizeof(entry.config.topic) - 1);
+            entry.config.topic[sizeof(entry.config.topic) - 1] = '\0';
+            entry.config.callback = callback;
+            entry.config.bufferCallback = bufferCallback;
+            entry.config.intervalMs = intervalMs;
+            entry.config.priority = priority;
+            entry.config.generation = nextRegistryGeneration();  // Will execute on next check
+            entry.config.active = true;
+            endRegistryWrite(entry);
+            telemetryCallbackCount++;
+        }
+    }
+    portEXIT_CRITICAL(&registryLock);
     
-    telemetryCallbackCount++;
+    if (full) {
+        Serial.print("ERROR: Maximum number of telemetry callbacks (");
+        Serial.print(MAX_TELEMETRY_CALLBACKS);
+        Serial.println(") reached");
+        return false;
+    }
+    if (duplicate) {
+        Serial.print("ERROR: Telemetry topic already registered: ");
+        Serial.println(topic);
+        return false;
+    }
+    if (slot == -1) {
+        Serial.println("ERROR: No available slot for telemetry callback");
+        return false;
+    }
     
     Serial.print("Registered telemetry: ");
     Serial.print(topic);
@@ -494,52 +1860,498 @@ bool ESPRazorBlade::registerTelemetry(const char* topic, TelemetryCallback callb
     return true;
 }
 
-void ESPRazorBlade::processTelemetry() {
-    if (!mqttConnected || !mqttClient.connected()) {
-        return; // Don't process telemetry if MQTT is not connected
+bool ESPRazorBlade::unregisterTelemetry(const char* topic) {
+    if (topic == nullptr) {
+        return false;
+    }
+    
+    int slot = -1;
+    portENTER_CRITICAL(&registryLock);
+    for (int i = 0; i < MAX_TELEMETRY_CALLBACKS; i++) {
+        TelemetryEntry& entry = telemetryCallbacks[i];
+        if (entry.config.active && strcmp(entry.config.topic, topic) == 0) {
+            beginRegistryWrite(entry);
+            entry.config.active = false;
+            entry.config.generation = nextRegistryGeneration();
+            endRegistryWrite(entry);
+            telemetryCallbackCount--;
+            slot = i;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&registryLock);
+    
+    if (slot == -1) {
+        Serial.print("WARNING: No telemetry entry found for topic: ");
+        Serial.println(topic);
+        return false;
+    }
+    
+    // The MQTT task may still be running the callback from a snapshot taken before the write
+    waitForEpoch(schedulerEpoch);
+    
+    Serial.print("Unregistered telemetry: ");
+    Serial.println(topic);
+    return true;
+}
+
+bool ESPRazorBlade::setTelemetryInterval(const char* topic, unsigned long intervalMs) {
+    if (topic == nullptr || intervalMs == 0) {
+        Serial.println("ERROR: Invalid telemetry interval update");
+        return false;
+    }
+    
+    bool found = false;
+    portENTER_CRITICAL(&registryLock);
+    for (int i = 0; i < MAX_TELEMETRY_CALLBACKS; i++) {
+        TelemetryEntry& entry = telemetryCallbacks[i];
+        if (entry.config.active && strcmp(entry.config.topic, topic) == 0) {
+            beginRegistryWrite(entry);
+            entry.config.intervalMs = intervalMs;
+            entry.config.generation = nextRegistryGeneration();  // Publish on the next cycle
+            endRegistryWrite(entry);
+            found = true;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&registryLock);
+    
+    if (!found) {
+        Serial.print("WARNING: No telemetry entry found for topic: ");
+        Serial.println(topic);
+    }
+    return found;
+}
+
+uint32_t ESPRazorBlade::nextRegistryGeneration() {
+    // Called under registryLock; 0 is reserved for "never used"
+    registryGeneration++;
+    if (registryGeneration == 0) {
+        registryGeneration = 1;
+    }
+    return registryGeneration;
+}
+
+void ESPRazorBlade::beginRegistryWrite(TelemetryEntry& entry) {
+    // Odd sequence: readers retry until the write is complete
+    __atomic_store_n(&entry.sequence, entry.sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void ESPRazorBlade::endRegistryWrite(TelemetryEntry& entry) {
+    __atomic_store_n(&entry.sequence, entry.sequence + 1, __ATOMIC_RELEASE);
+}
+
+bool ESPRazorBlade::readTelemetryConfig(int slot, TelemetryConfig& config) {
+    // Seqlock read: copy, then check no write started or finished meanwhile. Writers hold
+    // a critical section for a few dozen bytes, so a retry only ever spins briefly
+    const TelemetryEntry& entry = telemetryCallbacks[slot];
+    while (true) {
+        uint32_t begin = __atomic_load_n(&entry.sequence, __ATOMIC_ACQUIRE);
+        if ((begin & 1) == 0) {
+            memcpy(&config, &entry.config, sizeof(config));
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&entry.sequence, __ATOMIC_RELAXED) == begin) {
+                return config.active;
+            }
+        }
+    }
+}
+
+int ESPRazorBlade::findTelemetrySlot(const char* topic, TelemetryConfig& config) {
+    for (int i = 0; i < MAX_TELEMETRY_CALLBACKS; i++) {
+        if (readTelemetryConfig(i, config) && strcmp(config.topic, topic) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool ESPRazorBlade::telemetryDue(int slot, const TelemetryConfig& config, unsigned long now) {
+    TelemetryEntry& entry = telemetryCallbacks[slot];
+    if (entry.scheduledGeneration != config.generation) {
+        // Registered or updated since the last check: due now
+        entry.scheduledGeneration = config.generation;
+        entry.lastExecution = 0;
+    }
+    // Handle millis() overflow (wraps around after ~49 days)
+    return entry.lastExecution == 0 || (now - entry.lastExecution) >= config.intervalMs;
+}
+
+void ESPRazorBlade::processTelemetry() {
+    if (!mqttConnected || !mqttClient.connected()) {
+        return; // Don't process telemetry if MQTT is not connected
+    }
+
+    // Critical messages queued while disconnected or contended go out before anything else
+    drainOutboundQueue(PRIORITY_CRITICAL, OUTBOUND_QUEUE_SIZE);
+    
+    // Loopback probe; a silently dead connection is dropped after this cycle instead of at keepalive expiry
+    if (!checkBrokerProbe(millis())) {
+        return;
+    }
+
+    // One-time publish of status and reset reason when MQTT first connects
+    publishBootTelemetry();
+    
+    // One-time publish of configuration timeouts when MQTT first connects
+    publishConfigurationTimeouts();
+    
+    drainOutboundQueue(PRIORITY_NORMAL, OUTBOUND_QUEUE_SIZE);
+    
+#ifdef STREAM_CHANNELS
+    // Completed capture blocks, ahead of telemetry so the producer gets blocks back quickly
+    drainStreams();
+#endif
+    
+    unsigned long now = millis();
+    
+#ifdef TELEMETRY_TRANSPORT_UDP
+    // Topic ids go to the gateway ahead of the first datagram that uses them
+    registerUdpTopicIds(now);
+#endif
+    
+    // Process active telemetry callbacks, highest priority class first.
+    // Each entry is read from a lock-free snapshot, so registration changes never block this loop
+    TelemetryConfig config;
+    for (int p = PRIORITY_CRITICAL; p < PRIORITY_CLASS_COUNT; p++) {
+        for (int i = 0; i < MAX_TELEMETRY_CALLBACKS; i++) {
+            if (!readTelemetryConfig(i, config) || config.priority != p) {
+                continue;
+            }
+            
+            // Check if it's time to execute this callback
+            if (telemetryDue(i, config, now)) {
+                // Shed bulk metrics while higher priority traffic is backed up (retried next cycle)
+                if (p == PRIORITY_BULK &&
+                    (queuedMessageCount(PRIORITY_CRITICAL) > 0 || queuedMessageCount(PRIORITY_NORMAL) > 0)) {
+                    continue;
+                }
+                
+                // Execute callback and publish result
+                char value[TELEMETRY_VALUE_MAX_LEN];
+                readTelemetryValue(config, value, sizeof(value));
+                storeSample(i, config.generation, value);
+                
+#ifdef TELEMETRY_TRANSPORT_UDP
+                // Telemetry goes to the MQTT-SN gateway; config and command traffic stays on MQTT
+                bool ok = sendUdpTelemetry(i, value);
+#else
+                bool ok = publish(config.topic, value);
+#endif
+                if (ok) {
+                    telemetryCallbacks[i].lastExecution = now;
+                }
+                Serial.print("Telemetry published: ");
+                Serial.print(config.topic);
+                Serial.print(" = ");
+                Serial.print(value);
+                Serial.println(ok ? "" : " [FAILED]");
+                
+                // Let critical messages queued meanwhile preempt the rest of the burst
+                drainOutboundQueue(PRIORITY_CRITICAL, OUTBOUND_QUEUE_SIZE);
+            }
+        }
+    }
+    
+    // Optional memory and stack health payload
+    publishHealthTelemetry(now);
+    
+    // Bulk messages go out last, a few per cycle
+    drainOutboundQueue(PRIORITY_BULK, BULK_DRAIN_PER_CYCLE);
+}
+
+void ESPRazorBlade::readTelemetryValue(const TelemetryConfig& config, char* buffer, size_t size) {
+    buffer[0] = '\0';
+    if (config.bufferCallback != nullptr) {
+        config.bufferCallback(buffer, size);
+        buffer[size - 1] = '\0';
+    } else if (config.callback != nullptr) {
+        // String callbacks allocate; use a TelemetryBufferCallback to avoid the heap
+        String value = config.callback();
+        strncpy(buffer, value.c_str(), size - 1);
+        buffer[size - 1] = '\0';
+    }
+}
+
+void ESPRazorBlade::refreshSampleCache() {
+    // Callbacks run here, so unregisterTelemetry() waits for the epoch as in the connected cycle
+    __atomic_add_fetch(&schedulerEpoch, 1, __ATOMIC_SEQ_CST);
+    sampleTelemetry();
+    __atomic_add_fetch(&schedulerEpoch, 1, __ATOMIC_SEQ_CST);
+}
+
+void ESPRazorBlade::sampleTelemetry() {
+    unsigned long now = millis();
+    TelemetryConfig config;
+    for (int i = 0; i < MAX_TELEMETRY_CALLBACKS; i++) {
+        if (!readTelemetryConfig(i, config)) {
+            continue;
+        }
+        if (telemetryDue(i, config, now)) {
+            char value[TELEMETRY_VALUE_MAX_LEN];
+            readTelemetryValue(config, value, sizeof(value));
+            storeSample(i, config.generation, value);
+            telemetryCallbacks[i].lastExecution = now;
+        }
+    }
+}
+
+#ifdef TELEMETRY_TRANSPORT_UDP
+bool ESPRazorBlade::resolveUdpGateway() {
+    // Resolve the gateway once per WiFi connection
+    if (!udpGatewayResolved) {
+        if (!WiFi.hostByName(UDP_GATEWAY_HOST, udpGatewayAddress)) {
+            Serial.print("ERROR: Cannot resolve UDP gateway: ");
+            Serial.println(UDP_GATEWAY_HOST);
+            return false;
+        }
+        udpGatewayResolved = true;
+    }
+    return true;
+}
+
+bool ESPRazorBlade::sendUdpTelemetry(int slot, const char* value) {
+    if (!resolveUdpGateway()) {
+        return false;
+    }
+    
+    // MQTT-SN PUBLISH, QoS -1 with a predefined topic id (message id is 0 for QoS -1)
+    size_t valueLen = strlen(value);
+    uint16_t topicId = (uint16_t)(UDP_TOPIC_ID_BASE + slot + 1);
+    uint8_t packet[MQTTSN_PUBLISH_HEADER_LEN + TELEMETRY_VALUE_MAX_LEN];
+    packet[0] = (uint8_t)(MQTTSN_PUBLISH_HEADER_LEN + valueLen);
+    packet[1] = MQTTSN_PUBLISH;
+    packet[2] = MQTTSN_FLAGS_QOS_M1_PREDEFINED;
+    packet[3] = (uint8_t)(topicId >> 8);
+    packet[4] = (uint8_t)(topicId & 0xFF);
+    packet[5] = 0;
+    packet[6] = 0;
+    memcpy(packet + MQTTSN_PUBLISH_HEADER_LEN, value, valueLen);
+    
+    if (!udpClient.beginPacket(udpGatewayAddress, UDP_GATEWAY_PORT)) {
+        return false;
+    }
+    udpClient.write(packet, MQTTSN_PUBLISH_HEADER_LEN + valueLen);
+    return udpClient.endPacket() == 1;
+}
+
+void ESPRazorBlade::registerUdpTopicIds(unsigned long now) {
+    // Topic ids are only unique per device, so the gateway maps (sender address, topic id)
+    // to the full topic, which carries the device id. REGISTER is sent for new or changed
+    // metrics and for all of them every UDP_REGISTER_INTERVAL_MS, so a restarted gateway
+    // or a lost datagram recovers without an acknowledgement
+    bool refresh = lastUdpRegister == 0 || (now - lastUdpRegister) >= (unsigned long)UDP_REGISTER_INTERVAL_MS;
+    if (!resolveUdpGateway()) {
+        return;
+    }
+    
+    bool allSent = true;
+    TelemetryConfig config;
+    for (int i = 0; i < MAX_TELEMETRY_CALLBACKS; i++) {
+        if (!readTelemetryConfig(i, config) ||
+            (!refresh && telemetryCallbacks[i].udpRegisteredGeneration == config.generation)) {
+            continue;
+        }
+        
+        // MQTT-SN REGISTER: topic id, message id, topic name
+        size_t topicLen = strlen(config.topic);
+        uint16_t topicId = (uint16_t)(UDP_TOPIC_ID_BASE + i + 1);
+        uint16_t messageId = ++udpRegisterMessageId;
+        uint8_t packet[MQTTSN_REGISTER_HEADER_LEN + sizeof(config.topic)];
+        packet[0] = (uint8_t)(MQTTSN_REGISTER_HEADER_LEN + topicLen);
+        packet[1] = MQTTSN_REGISTER;
+        packet[2] = (uint8_t)(topicId >> 8);
+        packet[3] = (uint8_t)(topicId & 0xFF);
+        packet[4] = (uint8_t)(messageId >> 8);
+        packet[5] = (uint8_t)(messageId & 0xFF);
+        memcpy(packet + MQTTSN_REGISTER_HEADER_LEN, config.topic, topicLen);
+        
+        bool sent = udpClient.beginPacket(udpGatewayAddress, UDP_GATEWAY_PORT);
+        if (sent) {
+            udpClient.write(packet, MQTTSN_REGISTER_HEADER_LEN + topicLen);
+            sent = udpClient.endPacket() == 1;
+        }
+        if (sent) {
+            telemetryCallbacks[i].udpRegisteredGeneration = config.generation;
+        } else {
+            allSent = false;
+        }
+    }
+    if (refresh && allSent) {
+        lastUdpRegister = now;
+    }
+}
+#endif
+
+void ESPRazorBlade::storeSample(int slot, uint32_t generation, const char* value) {
+    if (sampleMutex == nullptr) {
+        return;
+    }
+    if (xSemaphoreTake(sampleMutex, portMAX_DELAY) == pdTRUE) {
+        strncpy(telemetryCallbacks[slot].lastValue, value, sizeof(telemetryCallbacks[slot].lastValue) - 1);
+        telemetryCallbacks[slot].lastValue[sizeof(telemetryCallbacks[slot].lastValue) - 1] = '\0';
+        telemetryCallbacks[slot].hasSample = true;
+        telemetryCallbacks[slot].sampleGeneration = generation;
+        xSemaphoreGive(sampleMutex);
+    }
+}
+
+void ESPRazorBlade::publishHealthTelemetry(unsigned long now) {
+    const unsigned long intervalMs = HEALTH_INTERVAL_MS;
+    if (intervalMs == 0) {
+        return;
+    }
+    if (lastHealthPublish != 0 && (now - lastHealthPublish) < intervalMs) {
+        return;
+    }
+    
+    // Heap: current free, minimum ever free, largest allocatable block and
+    // fragmentation (percentage of free heap not usable as one block)
+    uint32_t freeHeap = ESP.getFreeHeap();
+    uint32_t minFreeHeap = ESP.getMinFreeHeap();
+    uint32_t largestBlock = ESP.getMaxAllocHeap();
+    unsigned int fragmentation = freeHeap > 0 ? (unsigned int)(100 - (uint64_t)largestBlock * 100 / freeHeap) : 0;
+    
+    // Stack high-water marks (minimum free stack ever, in bytes on ESP32) of every library task
+    unsigned int wifiStackFree = wifiTaskHandle != nullptr ? (unsigned int)uxTaskGetStackHighWaterMark(wifiTaskHandle) : 0;
+    unsigned int mqttStackFree = (unsigned int)uxTaskGetStackHighWaterMark(nullptr);  // Called from mqttTask
+    
+    char payload[160];
+    int len = snprintf(payload, sizeof(payload),
+                       "{\"heap\":%lu,\"min_heap\":%lu,\"max_block\":%lu,\"frag\":%u,\"wifi_stack\":%u,\"mqtt_stack\":%u",
+                       (unsigned long)freeHeap, (unsigned long)minFreeHeap, (unsigned long)largestBlock,
+                       fragmentation, wifiStackFree, mqttStackFree);
+    if (httpTaskHandle != nullptr) {
+        len += snprintf(payload + len, sizeof(payload) - len, ",\"http_stack\":%u",
+                        (unsigned int)uxTaskGetStackHighWaterMark(httpTaskHandle));
+    }
+    snprintf(payload + len, sizeof(payload) - len, "}");
+    
+    char topic[64];
+    snprintf(topic, sizeof(topic), "%s/telemetry/health", deviceId);
+    bool ok = publish(topic, payload);
+    if (ok) {
+        lastHealthPublish = now;
+    }
+    Serial.print("Health telemetry published: ");
+    Serial.print(payload);
+    Serial.println(ok ? "" : " [FAILED]");
+}
+
+bool ESPRazorBlade::checkBrokerProbe(unsigned long now) {
+    const unsigned long intervalMs = MQTT_PROBE_INTERVAL_MS;
+    if (intervalMs == 0) {
+        return true;
+    }
+    if (mqttRestartRequested) {
+        return false;  // Reconnect pending (mqttTask could not take the client yet)
+    }
+    
+    if (probeOutstanding) {
+        if ((now - probeSentAt) < (unsigned long)MQTT_PROBE_TIMEOUT_MS) {
+            return true;
+        }
+        probeOutstanding = false;
+        Serial.print("WARNING: Broker probe ");
+        Serial.print((unsigned long)probeSequence);
+        Serial.println(" unanswered");
+        if (recordProbeFailure()) {
+            return false;
+        }
+        lastProbe = 0;  // Probe again right away instead of waiting a full interval
+    }
+    
+    if (lastProbe != 0 && (now - lastProbe) < intervalMs) {
+        return true;
+    }
+    
+    // The device subscribes to its own probe topic, so the broker echoes the probe back
+    char payload[12];
+    snprintf(payload, sizeof(payload), "%lu", (unsigned long)(probeSequence + 1));
+    char topic[64];
+    snprintf(topic, sizeof(topic), "%s/probe", deviceId);
+    if (publish(topic, payload)) {
+        probeSequence++;
+        probeOutstanding = true;
+        probeSentAt = millis();
+        lastProbe = now;
+    }
+    return true;
+}
+
+void ESPRazorBlade::handleProbeEcho(const char* payload) {
+    // Late echoes of earlier probes are ignored
+    if (!probeOutstanding || strtoul(payload, nullptr, 10) != (unsigned long)probeSequence) {
+        return;
     }
-
-    // One-time publish of status and reset reason when MQTT first connects
-    publishBootTelemetry();
-    
-    // One-time publish of configuration timeouts when MQTT first connects
-    publishConfigurationTimeouts();
+    probeOutstanding = false;
+    brokerRttMs = (long)(millis() - probeSentAt);
     
-    unsigned long now = millis();
+    char topic[64];
+    snprintf(topic, sizeof(topic), "%s/telemetry/broker_rtt", deviceId);
+    bool ok = publish(topic, brokerRttMs);
+    Serial.print("Broker RTT: ");
+    Serial.print(brokerRttMs);
+    Serial.println(ok ? " ms" : " ms [FAILED]");
     
-    // Process each active telemetry callback
-    for (int i = 0; i < MAX_TELEMETRY_CALLBACKS; i++) {
-        if (!telemetryCallbacks[i].active || telemetryCallbacks[i].callback == nullptr) {
-            continue;
-        }
-        
-        // Check if it's time to execute this callback
-        unsigned long timeSinceLastExecution = now - telemetryCallbacks[i].lastExecution;
-        
-        // Handle millis() overflow (wraps around after ~49 days)
-        if (telemetryCallbacks[i].lastExecution == 0 || timeSinceLastExecution >= telemetryCallbacks[i].intervalMs) {
-            // Execute callback and publish result
-            String value = telemetryCallbacks[i].callback();
-            
-            bool ok = publish(telemetryCallbacks[i].topic, value.c_str());
-            if (ok) {
-                telemetryCallbacks[i].lastExecution = now;
-            }
-            Serial.print("Telemetry published: ");
-            Serial.print(telemetryCallbacks[i].topic);
-            Serial.print(" = ");
-            Serial.print(value);
-            Serial.println(ok ? "" : " [FAILED]");
-        }
+    if (brokerRttMs > (long)MQTT_PROBE_MAX_RTT_MS) {
+        Serial.println("WARNING: Broker RTT above MQTT_PROBE_MAX_RTT_MS");
+        recordProbeFailure();
+    } else {
+        probeFailures = 0;
+    }
+}
+
+bool ESPRazorBlade::recordProbeFailure() {
+    probeFailures++;
+    if (probeFailures < MQTT_PROBE_MAX_FAILURES) {
+        return false;
+    }
+    if (!mqttRestartRequested) {
+        Serial.print("WARNING: ");
+        Serial.print(probeFailures);
+        Serial.println(" broker probes failed, forcing MQTT reconnect");
+    }
+    // Also reached from the message callback inside poll(), where the client must not be
+    // stopped; mqttTask tears the connection down once poll() returns
+    mqttRestartRequested = true;
+    return true;
+}
+
+bool ESPRazorBlade::restartMQTTConnection() {
+    // Another task may be inside a publish on this socket; retry on the next cycle if so
+    if (xSemaphoreTake(mqttMutex, pdMS_TO_TICKS(MQTT_PUBLISH_TIMEOUT_MS)) != pdTRUE) {
+        return false;
     }
+    mqttConnected = false;
+    mqttClient.stop();
+    xSemaphoreGive(mqttMutex);
+    
+    resetSessionState();
+    return true;
+}
+
+void ESPRazorBlade::resetSessionState() {
+    // Clean session: the broker forgot our subscriptions, and probes from the old
+    // connection will not come back
+    configTopicsSubscribed = false;
+    resetBrokerSubscriptions();
+    probeOutstanding = false;
+    probeFailures = 0;
+    lastProbe = 0;  // Probe right after reconnect
+    mqttRestartRequested = false;
 }
 
 void ESPRazorBlade::publishBootTelemetry() {
     if (resetReasonPublished) {
         return;
     }
-    bool okStatus = publish(DEVICE_ID "/status", "online", true);
-    bool okReset = publish(DEVICE_ID "/telemetry/reset_reason", getResetReasonString(), true);
+    char topic[64];
+    snprintf(topic, sizeof(topic), "%s/status", deviceId);
+    bool okStatus = publish(topic, "online", true);
+    snprintf(topic, sizeof(topic), "%s/telemetry/reset_reason", deviceId);
+    bool okReset = publish(topic, getResetReasonString(), true);
     if (okStatus) {
         resetReasonPublished = true;
     }
@@ -553,9 +2365,13 @@ void ESPRazorBlade::publishConfigurationTimeouts() {
     if (configTimeoutsPublished) {
         return;
     }
-    bool okWifiRssi = publish(DEVICE_ID "/config/telemetry/timeouts/wifi_rssi", (long)WIFI_SIGNAL_INTERVAL_MS, true);
-    bool okTimeAlive = publish(DEVICE_ID "/config/telemetry/timeouts/time_alive", (long)TIME_ALIVE_INTERVAL_MS, true);
-    bool okHeapMemory = publish(DEVICE_ID "/config/telemetry/timeouts/heap_memory", (long)FREE_HEAP_INTERVAL_MS, true);
+    char topic[80];
+    snprintf(topic, sizeof(topic), "%s/config/telemetry/timeouts/wifi_rssi", deviceId);
+    bool okWifiRssi = publish(topic, (long)WIFI_SIGNAL_INTERVAL_MS, true);
+    snprintf(topic, sizeof(topic), "%s/config/telemetry/timeouts/time_alive", deviceId);
+    bool okTimeAlive = publish(topic, (long)TIME_ALIVE_INTERVAL_MS, true);
+    snprintf(topic, sizeof(topic), "%s/config/telemetry/timeouts/heap_memory", deviceId);
+    bool okHeapMemory = publish(topic, (long)FREE_HEAP_INTERVAL_MS, true);
     if (okWifiRssi && okTimeAlive && okHeapMemory) {
         configTimeoutsPublished = true;
     }
@@ -575,12 +2391,12 @@ void ESPRazorBlade::subscribeToConfigTopics() {
     // Set message callback handler
     mqttClient.onMessage(onMQTTMessage);
     
-    // Subscribe to configuration timeout topics
+    // Subscribe to configuration timeout topics (isLibrarySubscription() lists the same filters)
     char topic[80];
     bool allSubscribed = true;
     
     // WiFi RSSI timeout topic
-    snprintf(topic, sizeof(topic), "%s/config/telemetry/timeouts/wifi_rssi", DEVICE_ID);
+    snprintf(topic, sizeof(topic), "%s/config/telemetry/timeouts/wifi_rssi", deviceId);
     int result1 = mqttClient.subscribe(topic);
     Serial.print("Subscribed to ");
     Serial.print(topic);
@@ -588,7 +2404,7 @@ void ESPRazorBlade::subscribeToConfigTopics() {
     allSubscribed = allSubscribed && result1;
     
     // Time alive timeout topic
-    snprintf(topic, sizeof(topic), "%s/config/telemetry/timeouts/time_alive", DEVICE_ID);
+    snprintf(topic, sizeof(topic), "%s/config/telemetry/timeouts/time_alive", deviceId);
     int result2 = mqttClient.subscribe(topic);
     Serial.print("Subscribed to ");
     Serial.print(topic);
@@ -596,13 +2412,32 @@ void ESPRazorBlade::subscribeToConfigTopics() {
     allSubscribed = allSubscribed && result2;
     
     // Heap memory timeout topic
-    snprintf(topic, sizeof(topic), "%s/config/telemetry/timeouts/heap_memory", DEVICE_ID);
+    snprintf(topic, sizeof(topic), "%s/config/telemetry/timeouts/heap_memory", deviceId);
     int result3 = mqttClient.subscribe(topic);
     Serial.print("Subscribed to ");
     Serial.print(topic);
     Serial.println(result3 ? " [OK]" : " [FAILED]");
     allSubscribed = allSubscribed && result3;
     
+    // On-demand metric read command topic
+    snprintf(topic, sizeof(topic), "%s/cmd/read/+", deviceId);
+    int result4 = mqttClient.subscribe(topic);
+    Serial.print("Subscribed to ");
+    Serial.print(topic);
+    Serial.println(result4 ? " [OK]" : " [FAILED]");
+    allSubscribed = allSubscribed && result4;
+    
+    // Broker loopback probe topic (echoed back to this device)
+    const unsigned long probeIntervalMs = MQTT_PROBE_INTERVAL_MS;
+    if (probeIntervalMs > 0) {
+        snprintf(topic, sizeof(topic), "%s/probe", deviceId);
+        int result5 = mqttClient.subscribe(topic);
+        Serial.print("Subscribed to ");
+        Serial.print(topic);
+        Serial.println(result5 ? " [OK]" : " [FAILED]");
+        allSubscribed = allSubscribed && result5;
+    }
+    
     if (allSubscribed) {
         configTopicsSubscribed = true;
         Serial.println("All config topics subscribed successfully");
@@ -611,6 +2446,32 @@ void ESPRazorBlade::subscribeToConfigTopics() {
     }
 }
 
+bool ESPRazorBlade::isLibrarySubscription(const char* filter) {
+    // The filters subscribed above, relative to the device id
+    static const char* const LIBRARY_FILTERS[] = {
+        "config/telemetry/timeouts/wifi_rssi",
+        "config/telemetry/timeouts/time_alive",
+        "config/telemetry/timeouts/heap_memory",
+        "cmd/read/+",
+    };
+    size_t idLen = strlen(deviceId);
+    if (strncmp(filter, deviceId, idLen) != 0 || filter[idLen] != '/') {
+        return false;
+    }
+    const char* local = filter + idLen + 1;
+    for (const char* libraryFilter : LIBRARY_FILTERS) {
+        if (strcmp(local, libraryFilter) == 0) {
+            return true;
+        }
+    }
+    const unsigned long probeIntervalMs = MQTT_PROBE_INTERVAL_MS;
+    return probeIntervalMs > 0 && strcmp(local, "probe") == 0;
+}
+
+const char* ESPRazorBlade::getDeviceId() {
+    return deviceId;
+}
+
 String ESPRazorBlade::getIPAddress() {
     if (wifiConnected) {
         return WiFi.localIP().toString();
@@ -618,19 +2479,57 @@ String ESPRazorBlade::getIPAddress() {
     return String("");
 }
 
-void ESPRazorBlade::onMQTTMessage(int messageSize) {
-    // Check if instance is valid
+void ESPRazorBlade::onMQTTMessage(MqttClient* client, int messageSize) {
+    // The client is always our own OwnedMqttClient member
+    ESPRazorBlade* instance = static_cast<OwnedMqttClient*>(client)->owner;
     if (instance == nullptr) {
         return;
     }
     
-    // Get the topic
-    String topic = instance->mqttClient.messageTopic();
+    // Copy the topic into a fixed buffer. messageTopic() returns a String copy, the one
+    // allocation left on this path: ArduinoMqttClient has no accessor for its own buffer
+    char topic[MQTT_RX_TOPIC_MAX_LEN];
+    {
+        String clientTopic = instance->mqttClient.messageTopic();
+        if (clientTopic.length() >= sizeof(topic)) {
+            Serial.print("WARNING: MQTT topic too long, message ignored: ");
+            Serial.println(clientTopic);
+            return;
+        }
+        memcpy(topic, clientTopic.c_str(), clientTopic.length() + 1);
+    }
     
-    // Read the message payload
-    String payload = "";
+    // Read the message payload into a fixed buffer (longer payloads are truncated)
+    char payload[MQTT_RX_PAYLOAD_MAX_LEN];
+    size_t payloadLen = 0;
+    bool truncated = false;
     while (instance->mqttClient.available()) {
-        payload += (char)instance->mqttClient.read();
+        int c = instance->mqttClient.read();
+        if (c < 0) {
+            break;
+        }
+        if (payloadLen < sizeof(payload) - 1) {
+            payload[payloadLen++] = (char)c;
+        } else {
+            truncated = true;
+        }
+    }
+    payload[payloadLen] = '\0';
+    if (truncated) {
+        Serial.println("WARNING: MQTT payload truncated");
+    }
+    
+    // Broker probe echo, handled before logging to keep the RTT measurement tight
+    // Library topics start with "<device-id>/"
+    size_t deviceIdLen = strlen(instance->deviceId);
+    const char* local = nullptr;
+    if (strncmp(topic, instance->deviceId, deviceIdLen) == 0 && topic[deviceIdLen] == '/') {
+        local = topic + deviceIdLen + 1;
+    }
+    
+    if (local != nullptr && strcmp(local, "probe") == 0) {
+        instance->handleProbeEcho(payload);
+        return;
     }
     
     Serial.print("MQTT message received: topic=");
@@ -638,13 +2537,102 @@ void ESPRazorBlade::onMQTTMessage(int messageSize) {
     Serial.print(", payload=");
     Serial.println(payload);
     
+    // Application subscriptions (may also match the library's own topics)
+    bool handled = instance->dispatchMessage(topic, payload, payloadLen) > 0;
+    
+    // On-demand read: "<device-id>/cmd/read/<metric>", payload is an optional correlation id
+    if (local != nullptr && strncmp(local, "cmd/read/", 9) == 0) {
+        instance->handleReadCommand(local + 9, payload);
+        return;
+    }
+    
     // Handle configuration update
-    instance->handleConfigUpdate(topic.c_str(), payload);
+    if (local != nullptr && strncmp(local, "config/telemetry/timeouts/", 26) == 0) {
+        instance->handleConfigUpdate(topic, payload);
+        return;
+    }
+    
+    if (!handled) {
+        Serial.print("WARNING: No handler for topic: ");
+        Serial.println(topic);
+    }
+}
+
+void ESPRazorBlade::handleReadCommand(const char* metric, char* correlationId) {
+    if (metric[0] == '\0' || strchr(metric, '/') != nullptr) {
+        Serial.print("ERROR: Invalid read command metric: ");
+        Serial.println(metric);
+        return;
+    }
+    
+    // Trim surrounding whitespace in place (mosquitto_pub -m "req-42 " and trailing newlines)
+    char* end = correlationId + strlen(correlationId);
+    while (end > correlationId && isspace((unsigned char)end[-1])) {
+        *--end = '\0';
+    }
+    while (isspace((unsigned char)*correlationId)) {
+        correlationId++;
+    }
+    if (strpbrk(correlationId, "/+#") != nullptr) {
+        // A '/' would add topic levels, so subscribers matching response/<metric>/+ miss it
+        Serial.println("ERROR: Correlation id must be a single topic level without wildcards");
+        return;
+    }
+    
+    // Find the telemetry entry whose topic ends with "/<metric>" (or is exactly "<metric>")
+    size_t metricLen = strlen(metric);
+    int slot = -1;
+    TelemetryConfig config;
+    for (int i = 0; i < MAX_TELEMETRY_CALLBACKS; i++) {
+        if (!readTelemetryConfig(i, config)) {
+            continue;
+        }
+        const char* entryTopic = config.topic;
+        size_t topicLen = strlen(entryTopic);
+        if (topicLen < metricLen || strcmp(entryTopic + topicLen - metricLen, metric) != 0) {
+            continue;
+        }
+        if (topicLen == metricLen || entryTopic[topicLen - metricLen - 1] == '/') {
+            slot = i;
+            break;
+        }
+    }
+    
+    if (slot == -1) {
+        Serial.print("WARNING: Read command for unknown metric: ");
+        Serial.println(metric);
+        return;
+    }
+    
+    // Run the callback now; the regular interval schedule is left untouched
+    char value[TELEMETRY_VALUE_MAX_LEN];
+    readTelemetryValue(config, value, sizeof(value));
+    storeSample(slot, config.generation, value);
+    
+    // With a correlation id the value goes to "<device-id>/cmd/response/<metric>/<id>",
+    // otherwise it is published on the metric's regular telemetry topic
+    char responseTopic[128];
+    if (correlationId[0] != '\0') {
+        int len = snprintf(responseTopic, sizeof(responseTopic), "%s/cmd/response/%s/%s", deviceId, metric, correlationId);
+        if (len < 0 || (size_t)len >= sizeof(responseTopic)) {
+            Serial.println("ERROR: Correlation id too long");
+            return;
+        }
+    } else {
+        snprintf(responseTopic, sizeof(responseTopic), "%s", config.topic);
+    }
+    
+    bool ok = publish(responseTopic, value);
+    Serial.print("Read command published: ");
+    Serial.print(responseTopic);
+    Serial.print(" = ");
+    Serial.print(value);
+    Serial.println(ok ? "" : " [FAILED]");
 }
 
-void ESPRazorBlade::handleConfigUpdate(const char* topic, String payload) {
+void ESPRazorBlade::handleConfigUpdate(const char* topic, const char* payload) {
     // Parse the new timeout value from payload
-    long newTimeout = payload.toInt();
+    long newTimeout = atol(payload);
     
     // Validate timeout value (must be >= 1000ms and <= 24 hours)
     if (newTimeout < 1000 || newTimeout > 86400000) {
@@ -657,52 +2645,514 @@ void ESPRazorBlade::handleConfigUpdate(const char* topic, String payload) {
     // Extract metric name from topic
     // Topic format: "<device-id>/config/telemetry/timeouts/<metric>"
     // We need to map config topic to telemetry topic
-    String topicStr = String(topic);
-    String metricName = "";
+    const char* metricName = "";
     char telemetryTopic[80];
     
-    if (topicStr.endsWith("/wifi_rssi")) {
+    if (endsWith(topic, "/wifi_rssi")) {
         metricName = "wifi_rssi";
-        snprintf(telemetryTopic, sizeof(telemetryTopic), "%s/telemetry/wifi_rssi", DEVICE_ID);
-    } else if (topicStr.endsWith("/time_alive")) {
+        snprintf(telemetryTopic, sizeof(telemetryTopic), "%s/telemetry/wifi_rssi", deviceId);
+    } else if (endsWith(topic, "/time_alive")) {
         metricName = "time_alive";
-        snprintf(telemetryTopic, sizeof(telemetryTopic), "%s/telemetry/time_alive", DEVICE_ID);
-    } else if (topicStr.endsWith("/heap_memory")) {
+        snprintf(telemetryTopic, sizeof(telemetryTopic), "%s/telemetry/time_alive", deviceId);
+    } else if (endsWith(topic, "/heap_memory")) {
         metricName = "heap_memory";
-        snprintf(telemetryTopic, sizeof(telemetryTopic), "%s/telemetry/free_heap", DEVICE_ID);
+        snprintf(telemetryTopic, sizeof(telemetryTopic), "%s/telemetry/free_heap", deviceId);
     } else {
         Serial.print("ERROR: Unknown config topic: ");
         Serial.println(topic);
         return;
     }
     
-    // Find the corresponding telemetry entry
-    bool found = false;
-    for (int i = 0; i < MAX_TELEMETRY_CALLBACKS; i++) {
-        if (telemetryCallbacks[i].active && 
-            strcmp(telemetryCallbacks[i].topic, telemetryTopic) == 0) {
-            // Update the interval
-            unsigned long oldTimeout = telemetryCallbacks[i].intervalMs;
-            telemetryCallbacks[i].intervalMs = (unsigned long)newTimeout;
+    // Find the corresponding telemetry entry and update its interval (triggers an immediate publish)
+    TelemetryConfig config;
+    if (findTelemetrySlot(telemetryTopic, config) == -1 ||
+        !setTelemetryInterval(telemetryTopic, (unsigned long)newTimeout)) {
+        Serial.print("WARNING: No telemetry entry found for topic: ");
+        Serial.println(telemetryTopic);
+        return;
+    }
+    
+    Serial.print("Config updated: ");
+    Serial.print(metricName);
+    Serial.print(" timeout changed from ");
+    Serial.print(config.intervalMs);
+    Serial.print("ms to ");
+    Serial.print(newTimeout);
+    Serial.println("ms (will publish immediately)");
+}
+
+bool ESPRazorBlade::subscribe(const char* filter, MessageHandler handler, void* context,
+                              HandlerContext handlerContext) {
+    if (!validTopicFilter(filter) || handler == nullptr) {
+        Serial.print("ERROR: Invalid subscription filter: ");
+        Serial.println(filter != nullptr ? filter : "(null)");
+        return false;
+    }
+    if (subscriptionMutex == nullptr) {
+        Serial.println("ERROR: Call begin() before subscribe()");
+        return false;
+    }
+    
+    // Build the new trie in the inactive set, then swap it in
+    xSemaphoreTake(subscriptionMutex, portMAX_DELAY);
+    int active = activeSubscriptionSet;
+    SubscriptionSet& next = subscriptionSets[1 - active];
+    memcpy(next.entries, subscriptionSets[active].entries, sizeof(next.entries));
+    
+    int slot = -1;
+    bool duplicate = false;
+    for (int i = 0; i < MAX_SUBSCRIPTIONS; i++) {
+        if (next.entries[i].id != 0 && strcmp(next.entries[i].filter, filter) == 0) {
+            duplicate = true;
+        } else if (next.entries[i].id == 0 && slot == -1) {
+            slot = i;
+        }
+    }
+    
+    const char* error = nullptr;
+    if (duplicate) {
+        error = "ERROR: Already subscribed to: ";
+    } else if (slot == -1) {
+        error = "ERROR: Maximum subscriptions reached, cannot subscribe to: ";
+    } else {
+        Subscription& entry = next.entries[slot];
+        strncpy(entry.filter, filter, sizeof(entry.filter) - 1);
+        entry.filter[sizeof(entry.filter) - 1] = '\0';
+        entry.handler = handler;
+        entry.context = context;
+        entry.handlerContext = handlerContext;
+        if (++subscriptionIdCounter == 0) {
+            subscriptionIdCounter = 1;  // 0 marks a free slot
+        }
+        entry.id = subscriptionIdCounter;
+        if (!buildTopicTrie(next)) {
+            error = "ERROR: Subscription trie full (raise SUBSCRIPTION_TRIE_NODES), cannot subscribe to: ";
+        }
+    }
+    if (error == nullptr) {
+        activateSubscriptionSet(1 - active);
+    }
+    xSemaphoreGive(subscriptionMutex);
+    
+    if (error != nullptr) {
+        Serial.print(error);
+        Serial.println(filter);
+        return false;
+    }
+    
+    // Wake the MQTT task to subscribe on the broker
+    wakeMQTTTask();
+    
+    Serial.print("Subscription added: ");
+    Serial.println(filter);
+    return true;
+}
+
+bool ESPRazorBlade::unsubscribe(const char* filter) {
+    if (filter == nullptr || subscriptionMutex == nullptr) {
+        return false;
+    }
+    
+    xSemaphoreTake(subscriptionMutex, portMAX_DELAY);
+    int active = activeSubscriptionSet;
+    SubscriptionSet& next = subscriptionSets[1 - active];
+    memcpy(next.entries, subscriptionSets[active].entries, sizeof(next.entries));
+    
+    uint32_t id = 0;
+    bool pendingFull = false;
+    for (int i = 0; i < MAX_SUBSCRIPTIONS; i++) {
+        Subscription& entry = next.entries[i];
+        if (entry.id != 0 && strcmp(entry.filter, filter) == 0) {
+            id = entry.id;
+            entry.id = 0;
+            entry.handler = nullptr;
+            buildTopicTrie(next);  // Cannot run out of nodes with one filter less
+            activateSubscriptionSet(1 - active);
             
-            // Reset last execution to trigger immediate publish
-            telemetryCallbacks[i].lastExecution = 0;
+            // Remembered for the MQTT task; the filter text leaves the entry with the next rebuild
+            if (pendingUnsubscribeCount < PENDING_UNSUBSCRIBE_SIZE) {
+                strcpy(pendingUnsubscribes[pendingUnsubscribeCount++], filter);
+            } else {
+                pendingFull = true;
+            }
+            break;
+        }
+    }
+    xSemaphoreGive(subscriptionMutex);
+    
+    if (id == 0) {
+        Serial.print("WARNING: No subscription found for filter: ");
+        Serial.println(filter);
+        return false;
+    }
+    if (pendingFull) {
+        Serial.print("WARNING: Too many pending unsubscribes, broker keeps sending: ");
+        Serial.println(filter);
+    }
+    
+    // Discard messages already queued for processMessages()
+    if (xSemaphoreTake(queueMutex, portMAX_DELAY) == pdTRUE) {
+        int kept = 0;
+        for (int i = 0; i < deferredCount; i++) {
+            int from = (deferredHead + i) % SUBSCRIPTION_QUEUE_SIZE;
+            if (deferredMessages[from].subscriptionId == id) {
+                continue;
+            }
+            int to = (deferredHead + kept) % SUBSCRIPTION_QUEUE_SIZE;
+            if (to != from) {
+                deferredMessages[to] = deferredMessages[from];
+            }
+            kept++;
+        }
+        deferredCount = kept;
+        xSemaphoreGive(queueMutex);
+    }
+    
+    // The MQTT task may be running the handler for a message matched before the swap
+    waitForEpoch(schedulerEpoch);
+    
+    wakeMQTTTask();
+    
+    Serial.print("Subscription removed: ");
+    Serial.println(filter);
+    return true;
+}
+
+int ESPRazorBlade::processMessages() {
+    if (queueMutex == nullptr) {
+        return 0;
+    }
+    
+    // Bounded so handlers that keep messages coming cannot hold loop() forever
+    int handled = 0;
+    DeferredMessage message;
+    while (handled < SUBSCRIPTION_QUEUE_SIZE) {
+        bool found = false;
+        if (xSemaphoreTake(queueMutex, portMAX_DELAY) == pdTRUE) {
+            if (deferredCount > 0) {
+                message = deferredMessages[deferredHead];
+                deferredHead = (deferredHead + 1) % SUBSCRIPTION_QUEUE_SIZE;
+                deferredCount--;
+                found = true;
+            }
+            xSemaphoreGive(queueMutex);
+        }
+        if (!found) {
+            break;
+        }
+        message.handler(message.topic, message.payload, message.length, message.context);
+        handled++;
+    }
+    return handled;
+}
+
+void ESPRazorBlade::activateSubscriptionSet(int index) {
+    __atomic_store_n(&activeSubscriptionSet, index, __ATOMIC_SEQ_CST);
+    uint32_t generation = subscriptionGeneration + 1;
+    subscriptionGeneration = generation != 0 ? generation : 1;  // 0 means nothing to sync
+    
+    // The MQTT task may still be matching against the old set; the next writer rebuilds it
+    waitForEpoch(subscriptionReadEpoch);
+}
+
+void ESPRazorBlade::waitForEpoch(volatile uint32_t& epoch) {
+    // Skipped on the MQTT task itself, which is never inside the section when it calls in
+    if (mqttTaskHandle == nullptr || xTaskGetCurrentTaskHandle() == mqttTaskHandle) {
+        return;
+    }
+    uint32_t current = __atomic_load_n(&epoch, __ATOMIC_SEQ_CST);
+    if (current & 1) {
+        while (__atomic_load_n(&epoch, __ATOMIC_SEQ_CST) == current) {
+            vTaskDelay(1);
+        }
+    }
+}
+
+bool ESPRazorBlade::buildTopicTrie(SubscriptionSet& set) {
+    const TopicTrieNode blank = { -1, 0, 0, -1, 0, -1, -1, -1 };
+    
+    int count = 0;
+    for (int i = 0; i < MAX_SUBSCRIPTIONS; i++) {
+        set.entries[i].next = -1;
+        if (set.entries[i].id != 0) {
+            trieBuildOrder[count++] = i;
+            trieBuildLevel[i] = 0;
+        }
+    }
+    set.nodes[0] = blank;
+    set.nodeCount = 1;
+    trieBuildRange[0][0] = 0;
+    trieBuildRange[0][1] = count;
+    
+    // Breadth-first: children are appended after their parent, and each node's subscriptions
+    // are a contiguous range of trieBuildOrder sharing the same filter prefix
+    for (int n = 0; n < set.nodeCount; n++) {
+        int start = trieBuildRange[n][0];
+        int end = trieBuildRange[n][1];
+        
+        // Sort by the next level: ended, #, +, then literal levels in search order
+        for (int i = start + 1; i < end; i++) {
+            int16_t sub = trieBuildOrder[i];
+            int j = i;
+            while (j > start && compareFilterLevels(set.entries[trieBuildOrder[j - 1]].filter, trieBuildLevel[trieBuildOrder[j - 1]],
+                                                    set.entries[sub].filter, trieBuildLevel[sub]) > 0) {
+                trieBuildOrder[j] = trieBuildOrder[j - 1];
+                j--;
+            }
+            trieBuildOrder[j] = sub;
+        }
+        
+        TopicTrieNode& node = set.nodes[n];
+        int i = start;
+        while (i < end) {
+            int16_t sub = trieBuildOrder[i];
+            Subscription& entry = set.entries[sub];
+            uint8_t offset = trieBuildLevel[sub];
+            size_t length;
+            TrieLevelKind kind = trieLevelKind(entry.filter, offset, &length);
+            if (kind == TRIE_LEVEL_END) {
+                entry.next = node.exactSubs;
+                node.exactSubs = sub;
+                i++;
+                continue;
+            }
+            if (kind == TRIE_LEVEL_HASH) {
+                entry.next = node.hashSubs;
+                node.hashSubs = sub;
+                i++;
+                continue;
+            }
             
-            Serial.print("Config updated: ");
-            Serial.print(metricName);
-            Serial.print(" timeout changed from ");
-            Serial.print(oldTimeout);
-            Serial.print("ms to ");
-            Serial.print(newTimeout);
-            Serial.println("ms (will publish immediately)");
+            // All subscriptions with this level share one child
+            int groupEnd = i + 1;
+            while (groupEnd < end &&
+                   compareFilterLevels(entry.filter, offset, set.entries[trieBuildOrder[groupEnd]].filter,
+                                       trieBuildLevel[trieBuildOrder[groupEnd]]) == 0) {
+                groupEnd++;
+            }
+            if (set.nodeCount >= SUBSCRIPTION_TRIE_NODES) {
+                return false;
+            }
+            int child = set.nodeCount++;
+            set.nodes[child] = blank;
+            set.nodes[child].sub = sub;
+            set.nodes[child].offset = offset;
+            set.nodes[child].length = (uint8_t)length;
+            if (kind == TRIE_LEVEL_PLUS) {
+                node.plusChild = child;
+            } else {
+                if (node.childCount == 0) {
+                    node.firstChild = child;  // Literal children are allocated back to back
+                }
+                node.childCount++;
+            }
             
+            // Same prefix, so the level ends at the same offset in every filter of the group
+            size_t levelEnd = offset + length;
+            for (int g = i; g < groupEnd; g++) {
+                int16_t member = trieBuildOrder[g];
+                trieBuildLevel[member] = set.entries[member].filter[levelEnd] == '/' ? (uint8_t)(levelEnd + 1) : TRIE_LEVEL_DONE;
+            }
+            trieBuildRange[child][0] = i;
+            trieBuildRange[child][1] = groupEnd;
+            i = groupEnd;
+        }
+    }
+    return true;
+}
+
+int ESPRazorBlade::dispatchMessage(const char* topic, const char* payload, size_t length) {
+    struct Match {
+        MessageHandler handler;
+        void* context;
+        HandlerContext handlerContext;
+        uint32_t id;
+    };
+    Match matches[SUBSCRIPTION_MAX_MATCHES];
+    int matchCount = 0;
+    bool overflow = false;
+    
+    // Depth-first walk of the trie; each node is reached through one path at most, so a
+    // subscription matches once. Wildcards at the first level do not match $-topics
+    struct Step {
+        int16_t node;
+        bool done;      // Whole topic consumed
+        size_t pos;     // Start of the next topic level
+    };
+    Step stack[TRIE_MAX_DEPTH + 2];
+    int top = 0;
+    size_t topicLen = strlen(topic);
+    bool systemTopic = topic[0] == '$';
+    
+    __atomic_add_fetch(&subscriptionReadEpoch, 1, __ATOMIC_SEQ_CST);  // Writers wait for this section
+    const SubscriptionSet& set = subscriptionSets[__atomic_load_n(&activeSubscriptionSet, __ATOMIC_SEQ_CST)];
+    stack[top++] = { 0, false, 0 };
+    while (top > 0) {
+        Step step = stack[--top];
+        const TopicTrieNode& node = set.nodes[step.node];
+        bool wildcards = !(systemTopic && step.node == 0);
+        
+        int lists[2] = { wildcards ? node.hashSubs : -1, step.done ? node.exactSubs : -1 };
+        for (int l = 0; l < 2; l++) {
+            for (int s = lists[l]; s != -1; s = set.entries[s].next) {
+                if (matchCount == SUBSCRIPTION_MAX_MATCHES) {
+                    overflow = true;
+                    break;
+                }
+                const Subscription& entry = set.entries[s];
+                matches[matchCount++] = { entry.handler, entry.context, entry.handlerContext, entry.id };
+            }
+        }
+        if (step.done || top + 2 > TRIE_MAX_DEPTH + 2) {
+            continue;
+        }
+        
+        const char* level = topic + step.pos;
+        size_t levelLen = strcspn(level, "/");
+        Step child = { -1, step.pos + levelLen == topicLen, step.pos + levelLen + 1 };
+        if (wildcards && node.plusChild != -1) {
+            child.node = node.plusChild;
+            stack[top++] = child;
+        }
+        int low = node.firstChild;
+        int high = node.firstChild + node.childCount - 1;
+        while (low <= high) {
+            int mid = (low + high) / 2;
+            const TopicTrieNode& candidate = set.nodes[mid];
+            int cmp = compareTrieLevels(set.entries[candidate.sub].filter + candidate.offset, candidate.length,
+                                        level, levelLen);
+            if (cmp == 0) {
+                child.node = mid;
+                stack[top++] = child;
+                break;
+            }
+            if (cmp < 0) {
+                low = mid + 1;
+            } else {
+                high = mid - 1;
+            }
+        }
+    }
+    __atomic_add_fetch(&subscriptionReadEpoch, 1, __ATOMIC_SEQ_CST);
+    
+    if (overflow) {
+        Serial.print("WARNING: Too many matching subscriptions, some handlers skipped for: ");
+        Serial.println(topic);
+    }
+    
+    // Handlers run outside the read section so they can subscribe and unsubscribe
+    for (int i = 0; i < matchCount; i++) {
+        const Match& match = matches[i];
+        if (match.handlerContext == HANDLER_CONTEXT_MQTT_TASK) {
+            match.handler(topic, payload, length, match.context);
+            continue;
+        }
+        
+        if (topicLen >= (size_t)MQTT_RX_TOPIC_MAX_LEN) {
+            Serial.print("ERROR: Topic too long to queue for processMessages(): ");
+            Serial.println(topic);
+            continue;
+        }
+        bool queued = false;
+        if (xSemaphoreTake(queueMutex, pdMS_TO_TICKS(MQTT_PUBLISH_TIMEOUT_MS)) == pdTRUE) {
+            if (deferredCount < SUBSCRIPTION_QUEUE_SIZE) {
+                DeferredMessage& slot = deferredMessages[(deferredHead + deferredCount) % SUBSCRIPTION_QUEUE_SIZE];
+                memcpy(slot.topic, topic, topicLen + 1);
+                memcpy(slot.payload, payload, length);
+                slot.payload[length] = '\0';
+                slot.length = length;
+                slot.handler = match.handler;
+                slot.context = match.context;
+                slot.subscriptionId = match.id;
+                deferredCount++;
+                queued = true;
+            } else {
+                deferredDropped++;
+            }
+            xSemaphoreGive(queueMutex);
+        }
+        if (!queued) {
+            Serial.print("WARNING: Message queue full, message dropped: ");
+            Serial.println(topic);
+        }
+    }
+    return matchCount;
+}
+
+void ESPRazorBlade::syncSubscriptions() {
+    uint32_t generation = subscriptionGeneration;
+    if (generation == syncedSubscriptionGeneration) {
+        return;
+    }
+    bool complete = true;
+    
+    // Removed filters first, so a filter removed and added again ends up subscribed
+    while (true) {
+        char filter[64];
+        bool found = false;
+        if (xSemaphoreTake(subscriptionMutex, pdMS_TO_TICKS(MQTT_PUBLISH_TIMEOUT_MS)) != pdTRUE) {
+            return;  // Retry on the next cycle
+        }
+        if (pendingUnsubscribeCount > 0) {
+            strcpy(filter, pendingUnsubscribes[--pendingUnsubscribeCount]);
             found = true;
+        }
+        xSemaphoreGive(subscriptionMutex);
+        if (!found) {
             break;
         }
+        
+        // The broker keeps one subscription per filter, so unsubscribing a filter the library
+        // subscribed itself would silence its config or command topic
+        if (isLibrarySubscription(filter)) {
+            Serial.print("Kept library subscription to ");
+            Serial.println(filter);
+            continue;
+        }
+        
+        int result = mqttClient.unsubscribe(filter);
+        Serial.print("Unsubscribed from ");
+        Serial.print(filter);
+        Serial.println(result ? " [OK]" : " [FAILED]");
+    }
+    
+    // Subscribe every slot whose subscription is not on the broker yet
+    for (int i = 0; i < MAX_SUBSCRIPTIONS; i++) {
+        char filter[64];
+        __atomic_add_fetch(&subscriptionReadEpoch, 1, __ATOMIC_SEQ_CST);
+        const Subscription& entry = subscriptionSets[__atomic_load_n(&activeSubscriptionSet, __ATOMIC_SEQ_CST)].entries[i];
+        uint32_t id = entry.id;
+        memcpy(filter, entry.filter, sizeof(filter));
+        __atomic_add_fetch(&subscriptionReadEpoch, 1, __ATOMIC_SEQ_CST);
+        
+        if (id == brokerSubscriptionIds[i]) {
+            continue;
+        }
+        if (id == 0) {
+            brokerSubscriptionIds[i] = 0;  // Removed through the pending unsubscribes
+            continue;
+        }
+        
+        int result = mqttClient.subscribe(filter);
+        Serial.print("Subscribed to ");
+        Serial.print(filter);
+        Serial.println(result ? " [OK]" : " [FAILED]");
+        if (result) {
+            brokerSubscriptionIds[i] = id;
+        } else {
+            complete = false;
+        }
     }
     
-    if (!found) {
-        Serial.print("WARNING: No telemetry entry found for topic: ");
-        Serial.println(telemetryTopic);
+    if (complete) {
+        syncedSubscriptionGeneration = generation;
+    }
+}
+
+void ESPRazorBlade::resetBrokerSubscriptions() {
+    // A new clean session starts without subscriptions
+    for (int i = 0; i < MAX_SUBSCRIPTIONS; i++) {
+        brokerSubscriptionIds[i] = 0;
     }
+    syncedSubscriptionGeneration = 0;
 }
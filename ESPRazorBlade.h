@@ -3,6 +3,7 @@
 
 #include <WiFi.h>
 #include <ArduinoMqttClient.h>
+#include <WiFiUdp.h>
 #include <Arduino.h>
 // Use quotes so the compiler searches the sketch directory first.
 // This ensures each sketch uses its own Configuration.h.
@@ -10,6 +11,43 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/semphr.h"
+#include "freertos/timers.h"
+
+// Streaming capture defaults (only used when STREAM_CHANNELS is defined in Configuration.h)
+#ifdef STREAM_CHANNELS
+#ifndef STREAM_BLOCK_SIZE
+#define STREAM_BLOCK_SIZE 1024  // Sample bytes per published chunk
+#endif
+#ifndef STREAM_BLOCK_COUNT
+#define STREAM_BLOCK_COUNT 4    // Blocks per channel (ring; 2 = double buffering)
+#endif
+#endif
+
+// Metrics endpoint default (only used when METRICS_HTTP_PORT is defined in Configuration.h)
+#ifdef METRICS_HTTP_PORT
+#ifndef METRICS_HTTP_MAX_CLIENTS
+#define METRICS_HTTP_MAX_CLIENTS 4  // Scrape connections served at once (also the listen backlog)
+#endif
+#endif
+
+// Outbound queue sizes (override in Configuration.h)
+#ifndef OUTBOUND_QUEUE_SIZE
+#define OUTBOUND_QUEUE_SIZE 8        // Messages queued per priority class
+#endif
+#ifndef OUTBOUND_QUEUE_BYTES
+#define OUTBOUND_QUEUE_BYTES 1024    // Topic and payload bytes per priority class (max 65535)
+#endif
+
+// Application subscription limits (override in Configuration.h)
+#ifndef MAX_SUBSCRIPTIONS
+#define MAX_SUBSCRIPTIONS 8          // Topic filters registered with subscribe()
+#endif
+#ifndef SUBSCRIPTION_TRIE_NODES
+#define SUBSCRIPTION_TRIE_NODES (MAX_SUBSCRIPTIONS * 6 + 1)  // Topic levels across all filters, plus the root
+#endif
+#ifndef SUBSCRIPTION_QUEUE_SIZE
+#define SUBSCRIPTION_QUEUE_SIZE 4    // Messages waiting for processMessages() (HANDLER_CONTEXT_LOOP)
+#endif
 
 // Forward declarations
 class ESPRazorBlade;
@@ -18,6 +56,31 @@ class ESPRazorBlade;
 // Returns a String that will be published to the topic
 typedef String (*TelemetryCallback)();
 
+// Buffer-based telemetry callback function type
+// Writes a null-terminated value into buffer (size bytes available) without allocating
+typedef void (*TelemetryBufferCallback)(char* buffer, size_t size);
+
+// Subscription message handler type
+// payload is null-terminated (truncated to 127 characters), length is the number of bytes in it
+typedef void (*MessageHandler)(const char* topic, const char* payload, size_t length, void* context);
+
+// Where subscription handlers run
+// MQTT task: right when the message arrives (keep the handler short and non-blocking)
+// Loop: queued and run from processMessages(), typically called in loop()
+enum HandlerContext {
+    HANDLER_CONTEXT_MQTT_TASK = 0,
+    HANDLER_CONTEXT_LOOP = 1
+};
+
+// Publish priority classes
+// Critical messages are sent first (including right after a reconnect),
+// bulk traffic is deferred and shed first when the link is backed up
+enum PublishPriority {
+    PRIORITY_CRITICAL = 0,
+    PRIORITY_NORMAL = 1,
+    PRIORITY_BULK = 2
+};
+
 /**
  * @brief ESPRazorBlade Library - Lightweight MQTT telemetry for ESP32 devices
  * 
@@ -28,16 +91,34 @@ typedef String (*TelemetryCallback)();
  * - MQTT broker connection with automatic reconnection
  * - MQTT publish functionality with thread-safe operations
  * - Built-in system telemetry (WiFi RSSI, uptime, free heap)
+ * - Optional memory and stack health telemetry
  * - Custom telemetry callback system for sensor data
+ * - Priority classes (critical, normal, bulk) for publishes and telemetry
  * - Runtime configuration updates via MQTT
+ * - On-demand metric reads via MQTT command topic
+ * - Application topic subscriptions with + and # wildcards
  * - RTOS-based non-blocking operation
+ * - Optional payload compression for large or selected topics
+ * - Optional local HTTP endpoint serving metrics in Prometheus text format
+ * - Optional UDP (MQTT-SN style) transport for registered telemetry
+ * - Optional high-rate streaming capture channels with chunked uploads
+ * - Optional static allocation mode (define ESPRAZORBLADE_STATIC_ALLOCATION)
  */
 class ESPRazorBlade {
 public:
     /**
      * @brief Constructor
+     * 
+     * Each instance needs its own device id (topic prefix) and MQTT client id so several
+     * instances can share a broker; the broker drops the older session when two clients
+     * connect with the same id.
+     * 
+     * @param deviceId Topic prefix for this instance (default: DEVICE_ID from Configuration.h,
+     *                 max DEVICE_ID_MAX_LEN characters)
+     * @param clientId MQTT client id (default: MQTT_CLIENT_ID from Configuration.h, or deviceId
+     *                 when only deviceId is given; max CLIENT_ID_MAX_LEN characters)
      */
-    ESPRazorBlade();
+    ESPRazorBlade(const char* deviceId = nullptr, const char* clientId = nullptr);
     
     /**
      * @brief Destructor
@@ -67,6 +148,21 @@ public:
      */
     bool isMQTTConnected();
     
+    /**
+     * @brief Get the last measured broker round-trip time
+     * 
+     * Measured by the loopback probe (enabled with MQTT_PROBE_INTERVAL_MS in Configuration.h).
+     * 
+     * @return Round-trip time in milliseconds, or -1 if no probe has been answered yet
+     */
+    long getBrokerRTT();
+    
+    /**
+     * @brief Get the device id used as the topic prefix
+     * @return Device id of this instance
+     */
+    const char* getDeviceId();
+    
     /**
      * @brief Get current WiFi IP address
      * @return IP address as String, or empty string if not connected
@@ -75,39 +171,68 @@ public:
     
     /**
      * @brief Publish a message to an MQTT topic
+     * 
+     * Critical messages never wait behind other traffic: if the MQTT connection is busy
+     * or down they are queued and sent first by the MQTT task (before telemetry, and
+     * before anything else after a reconnect). Normal messages wait up to 1 second for
+     * the connection and are queued if it stays busy. Bulk messages are queued whenever
+     * other traffic is pending and the oldest queued bulk message is dropped when the
+     * bulk queue is full. Topic and payload together must fit in OUTBOUND_QUEUE_BYTES - 2
+     * bytes to be queued.
+     * 
      * @param topic MQTT topic path
      * @param payload Message payload (string)
      * @param retained Whether to retain the message on the broker (default: false)
-     * @return true if publish successful, false otherwise
+     * @param priority Priority class of the message (default: PRIORITY_NORMAL)
+     * @return true if published or queued for sending, false otherwise
      */
-    bool publish(const char* topic, const char* payload, bool retained = false);
+    bool publish(const char* topic, const char* payload, bool retained = false, PublishPriority priority = PRIORITY_NORMAL);
     
     /**
      * @brief Publish a float value to an MQTT topic
      * @param topic MQTT topic path
      * @param value Float value to publish
      * @param retained Whether to retain the message on the broker (default: false)
-     * @return true if publish successful, false otherwise
+     * @param priority Priority class of the message (default: PRIORITY_NORMAL)
+     * @return true if published or queued for sending, false otherwise
      */
-    bool publish(const char* topic, float value, bool retained = false);
+    bool publish(const char* topic, float value, bool retained = false, PublishPriority priority = PRIORITY_NORMAL);
     
     /**
      * @brief Publish an integer value to an MQTT topic
      * @param topic MQTT topic path
      * @param value Integer value to publish
      * @param retained Whether to retain the message on the broker (default: false)
-     * @return true if publish successful, false otherwise
+     * @param priority Priority class of the message (default: PRIORITY_NORMAL)
+     * @return true if published or queued for sending, false otherwise
      */
-    bool publish(const char* topic, int value, bool retained = false);
+    bool publish(const char* topic, int value, bool retained = false, PublishPriority priority = PRIORITY_NORMAL);
     
     /**
      * @brief Publish a long integer value to an MQTT topic
      * @param topic MQTT topic path
      * @param value Long integer value to publish
      * @param retained Whether to retain the message on the broker (default: false)
-     * @return true if publish successful, false otherwise
+     * @param priority Priority class of the message (default: PRIORITY_NORMAL)
+     * @return true if published or queued for sending, false otherwise
+     */
+    bool publish(const char* topic, long value, bool retained = false, PublishPriority priority = PRIORITY_NORMAL);
+    
+    /**
+     * @brief Publish a non-retained message with a priority class
+     * 
+     * Without these overloads, publish(topic, payload, PRIORITY_BULK) would convert the
+     * priority to the retained flag.
+     * 
+     * @param topic MQTT topic path
+     * @param payload Message payload (string, float, int or long)
+     * @param priority Priority class of the message
+     * @return true if published or queued for sending, false otherwise
      */
-    bool publish(const char* topic, long value, bool retained = false);
+    bool publish(const char* topic, const char* payload, PublishPriority priority);
+    bool publish(const char* topic, float value, PublishPriority priority);
+    bool publish(const char* topic, int value, PublishPriority priority);
+    bool publish(const char* topic, long value, PublishPriority priority);
     
     /**
      * @brief Register a custom telemetry callback function
@@ -116,26 +241,274 @@ public:
      * will be published to the given MQTT topic. This is for custom metrics only;
      * built-in system metrics (WiFi RSSI, uptime, heap) are registered automatically.
      * 
+     * Due callbacks run in priority order each cycle. Bulk callbacks are skipped
+     * (retried next cycle) while critical or normal messages are waiting to be sent.
+     * Safe to call from any task at any time.
+     * 
      * @param topic MQTT topic to publish to
      * @param callback Function that returns a String to publish
      * @param intervalMs Interval in milliseconds between executions
+     * @param priority Priority class of the metric (default: PRIORITY_NORMAL)
      * @return true if registration successful, false if max callbacks reached (limit: 10 total)
+     *         or the topic is already registered
      */
-    bool registerTelemetry(const char* topic, TelemetryCallback callback, unsigned long intervalMs);
+    bool registerTelemetry(const char* topic, TelemetryCallback callback, unsigned long intervalMs,
+                           PublishPriority priority = PRIORITY_NORMAL);
+    
+    /**
+     * @brief Register a buffer-based telemetry callback function
+     * 
+     * Same as the String version, but the callback writes its value into a library-owned
+     * buffer (max 127 characters), so publishing the metric does not touch the heap.
+     * 
+     * @param topic MQTT topic to publish to
+     * @param callback Function that writes the value to publish into a buffer
+     * @param intervalMs Interval in milliseconds between executions
+     * @param priority Priority class of the metric (default: PRIORITY_NORMAL)
+     * @return true if registration successful, false if max callbacks reached (limit: 10 total)
+     *         or the topic is already registered
+     */
+    bool registerTelemetry(const char* topic, TelemetryBufferCallback callback, unsigned long intervalMs,
+                           PublishPriority priority = PRIORITY_NORMAL);
+    
+    /**
+     * @brief Remove a registered telemetry metric
+     * 
+     * Safe to call from any task at any time. When called outside the MQTT task, the
+     * callback is guaranteed not to be running or called again once this returns, so
+     * state it uses can be released. Built-in metrics can be removed too.
+     * 
+     * @param topic MQTT topic the metric was registered with
+     * @return true if the metric was removed, false if no metric uses the topic
+     */
+    bool unregisterTelemetry(const char* topic);
+    
+    /**
+     * @brief Change the interval of a registered telemetry metric
+     * 
+     * Safe to call from any task at any time. The metric is published on the next
+     * cycle and then at the new interval.
+     * 
+     * @param topic MQTT topic the metric was registered with
+     * @param intervalMs New interval in milliseconds (must be > 0)
+     * @return true if updated, false if no metric uses the topic or the interval is 0
+     */
+    bool setTelemetryInterval(const char* topic, unsigned long intervalMs);
+    
+    /**
+     * @brief Compress payloads published to topics starting with a prefix
+     * 
+     * Compression is opt-in per topic: other topics are never compressed or escaped. On
+     * these topics, payloads of at least COMPRESSION_THRESHOLD_BYTES (Configuration.h,
+     * default: any size) are compressed when that makes them smaller. Compressed payloads
+     * start with the "RZ" content marker (format in README); a raw payload that starts with
+     * "RZ" is escaped, so receivers must run the README decoder on every payload there.
+     * Compression uses a fixed 512-byte table and streams straight into the MQTT client,
+     * so it needs no payload-sized buffer.
+     * 
+     * @param topicPrefix Topic prefix, e.g. "my-esp32/batch/" (max 63 characters)
+     * @return true if added, false if invalid or the limit (4 prefixes) is reached
+     */
+    bool enableCompression(const char* topicPrefix);
+    
+    /**
+     * @brief Subscribe to an MQTT topic filter
+     * 
+     * The filter may use the + (single level) and # (remaining levels) wildcards. Messages
+     * are matched against all filters with a topic-filter trie, so dispatch cost depends on
+     * the topic depth, not the number of subscriptions. Subscriptions are kept by the library
+     * and restored automatically after every reconnect. Safe to call from any task, including
+     * from a handler; call begin() first.
+     * 
+     * @param filter MQTT topic filter (max 63 characters)
+     * @param handler Function called for each matching message
+     * @param context Pointer passed to the handler unchanged (default: nullptr)
+     * @param handlerContext Where the handler runs (default: HANDLER_CONTEXT_MQTT_TASK)
+     * @return true if subscribed, false if the filter is invalid or already subscribed,
+     *         or MAX_SUBSCRIPTIONS / SUBSCRIPTION_TRIE_NODES is exhausted
+     */
+    bool subscribe(const char* filter, MessageHandler handler, void* context = nullptr,
+                   HandlerContext handlerContext = HANDLER_CONTEXT_MQTT_TASK);
+    
+    /**
+     * @brief Remove a subscription made with subscribe()
+     * 
+     * When called outside the MQTT task, the handler is not running and will not be called
+     * again once this returns; queued messages for it are discarded.
+     * 
+     * @param filter The exact filter passed to subscribe()
+     * @return true if removed, false if no subscription uses the filter
+     */
+    bool unsubscribe(const char* filter);
+    
+    /**
+     * @brief Run handlers of messages queued for HANDLER_CONTEXT_LOOP subscriptions
+     * 
+     * Call regularly from loop(). Messages arriving while the queue (SUBSCRIPTION_QUEUE_SIZE)
+     * is full are dropped.
+     * 
+     * @return Number of messages handled
+     */
+    int processMessages();
+    
+#ifdef STREAM_CHANNELS
+    /**
+     * @brief Open a streaming capture channel
+     * 
+     * Samples written to the channel are collected in a ring of STREAM_BLOCK_COUNT blocks
+     * of STREAM_BLOCK_SIZE bytes. Each filled block is published to the topic as one binary
+     * chunk, straight from the block: an 8-byte header (sequence number and cumulative
+     * overrun count, both 32-bit big-endian) followed by the raw sample bytes.
+     * 
+     * @param topic MQTT topic for the chunks (max 63 characters)
+     * @return Channel number, or -1 if all STREAM_CHANNELS channels are open (or closed
+     *         with blocks still uploading)
+     */
+    int openStream(const char* topic);
+    
+    /**
+     * @brief Write samples to a streaming channel (task context)
+     * 
+     * Copies the samples into the current block. When no free block is available (the
+     * upload is behind), the samples are dropped and counted as overrun; every dropped
+     * block's worth of data still consumes a sequence number, so the consumer sees a gap.
+     * Each block is filled under its own short critical section, so a write spanning
+     * blocks can interleave with another producer's write at a block boundary.
+     * 
+     * @param channel Channel number from openStream()
+     * @param data Sample bytes
+     * @param len Number of bytes
+     * @return Number of bytes accepted (the rest was dropped)
+     */
+    size_t streamWrite(int channel, const void* data, size_t len);
+    
+    /**
+     * @brief Write samples to a streaming channel from an interrupt handler
+     * 
+     * Same as streamWrite(), safe to call from an ISR.
+     */
+    size_t streamWriteFromISR(int channel, const void* data, size_t len);
+    
+    /**
+     * @brief Publish the partially filled block of a channel (task context)
+     * @param channel Channel number from openStream()
+     * @return true if a block was handed to the uploader, false if empty or invalid
+     */
+    bool streamFlush(int channel);
+    
+    /**
+     * @brief Close a streaming channel (task context)
+     * 
+     * Hands the partially filled block to the uploader and stops accepting samples.
+     * Blocks already completed are still published; the channel is reused by
+     * openStream() once they are.
+     * 
+     * @param channel Channel number from openStream()
+     * @return true if the channel was open
+     */
+    bool closeStream(int channel);
+    
+    /**
+     * @brief Get the number of blocks dropped on a channel because the upload was behind
+     * @param channel Channel number from openStream()
+     * @return Cumulative overrun block count
+     */
+    unsigned long getStreamOverruns(int channel);
+#endif
+    
+    /**
+     * @brief Get the total memory owned by the library instance
+     * 
+     * Includes the object itself (registry, queues and buffers) and both task stacks.
+     * With ESPRAZORBLADE_STATIC_ALLOCATION defined, task stacks, task control blocks and
+     * mutexes live inside the object and nothing is allocated by begin().
+     * 
+     * @return Footprint in bytes
+     */
+    size_t getMemoryFootprint() const;
 
 private:
     // WiFi client
     WiFiClient wifiClient;
     
+    // MQTT client that carries a pointer to its owning library instance,
+    // so the static message callback can dispatch without a global instance
+    class OwnedMqttClient : public MqttClient {
+    public:
+        OwnedMqttClient(Client* client, ESPRazorBlade* owner) : MqttClient(client), owner(owner) {}
+        ESPRazorBlade* const owner;
+    };
+    
     // MQTT client
-    MqttClient mqttClient;
+    OwnedMqttClient mqttClient;
+    
+#ifdef METRICS_HTTP_PORT
+    // Local Prometheus scrape endpoint. Each slot holds one scrape connection while its
+    // request head arrives; the HTTP task reads all slots without blocking
+    WiFiServer metricsServer;
+    struct MetricsClient {
+        WiFiClient client;
+        bool active;                 // Slot holds a connection
+        unsigned long acceptedAt;    // Accept time (the request head must arrive in HTTP_REQUEST_TIMEOUT_MS)
+        char requestLine[64];        // Request line received so far
+        size_t requestLen;
+        bool requestLineDone;        // Request line complete, reading headers
+        bool lineEmpty;              // No characters since the last line break
+    };
+    MetricsClient metricsClients[METRICS_HTTP_MAX_CLIENTS];
+#endif
+    
+#ifdef TELEMETRY_TRANSPORT_UDP
+    // MQTT-SN style telemetry transport
+    WiFiUDP udpClient;
+    IPAddress udpGatewayAddress;
+    bool udpGatewayResolved;
+    unsigned long lastUdpRegister;  // Last time every topic id was registered with the gateway (0 = never)
+    uint16_t udpRegisterMessageId;  // Message id of the last REGISTER datagram
+#endif
+    
+    // Identity (fixed at construction)
+    static const int DEVICE_ID_MAX_LEN = 32;   // Leaves room for the built-in topics within 63 characters
+    static const int CLIENT_ID_MAX_LEN = 64;
+    char deviceId[DEVICE_ID_MAX_LEN + 1];
+    char clientId[CLIENT_ID_MAX_LEN + 1];
+    bool idTruncated;             // An id passed to the constructor was too long (reported by begin())
+    
+    // Task stack sizes (ESP32 FreeRTOS stack depth is in bytes)
+    static const int WIFI_TASK_STACK_SIZE = 4096;
+    static const int MQTT_TASK_STACK_SIZE = 4096;
+    static const int HTTP_TASK_STACK_SIZE = 4096;
     
     // RTOS task handles
     TaskHandle_t wifiTaskHandle;
     TaskHandle_t mqttTaskHandle;
+    TaskHandle_t httpTaskHandle;  // Only created when METRICS_HTTP_PORT is defined
+    
+    // Loopback UDP socket in the MQTT task's select() set, so other tasks can end its idle wait
+    int wakeSocket;              // Opened by begin(); -1 before that or if it could not be opened
+    volatile bool wakeSignalled; // A wake datagram is in flight since the MQTT task last armed the socket
     
     // Synchronization primitives
     SemaphoreHandle_t mqttMutex;
+    SemaphoreHandle_t queueMutex;  // Protects the outbound priority queues
+    SemaphoreHandle_t sampleMutex;  // Protects the cached last samples in the telemetry registry
+    SemaphoreHandle_t subscriptionMutex;  // Serializes subscribe()/unsubscribe() (never taken by dispatch)
+    
+#ifdef ESPRAZORBLADE_STATIC_ALLOCATION
+    // Library-owned task and mutex storage (no heap use in begin())
+    StackType_t wifiTaskStack[WIFI_TASK_STACK_SIZE];
+    StackType_t mqttTaskStack[MQTT_TASK_STACK_SIZE];
+    StaticTask_t wifiTaskBuffer;
+    StaticTask_t mqttTaskBuffer;
+    StaticSemaphore_t mqttMutexBuffer;
+    StaticSemaphore_t queueMutexBuffer;
+    StaticSemaphore_t sampleMutexBuffer;
+    StaticSemaphore_t subscriptionMutexBuffer;
+#ifdef METRICS_HTTP_PORT
+    StackType_t httpTaskStack[HTTP_TASK_STACK_SIZE];
+    StaticTask_t httpTaskBuffer;
+#endif
+#endif
     
     // Connection state
     bool wifiConnected;
@@ -146,38 +519,236 @@ private:
     bool resetReasonPublished;  // Flag for one-time reset reason publish on boot
     bool configTimeoutsPublished;  // Flag for one-time config timeout publish on MQTT connect
     bool configTopicsSubscribed;  // Flag to track if config topics have been subscribed
+    unsigned long lastHealthPublish;  // Last health telemetry publish time (0 = publish on next cycle)
     
-    // Telemetry callback structure
-    struct TelemetryEntry {
+    // Broker loopback probe
+    uint32_t probeSequence;       // Sequence number of the last probe sent
+    bool probeOutstanding;        // Whether the last probe is waiting for its echo
+    unsigned long probeSentAt;    // Send time of the outstanding probe
+    unsigned long lastProbe;      // Last probe send time (0 = probe on next cycle)
+    int probeFailures;            // Consecutive unanswered or slow probes
+    bool mqttRestartRequested;    // Too many failed probes: drop the connection once poll() has returned
+    long brokerRttMs;             // Last measured round-trip time (-1 = none yet)
+    
+    // Registered metric definition, written by register/unregister/update under registryLock.
+    // Readers take a lock-free snapshot with readTelemetryConfig() (per-entry seqlock).
+    struct TelemetryConfig {
         char topic[64];              // MQTT topic (max 63 chars + null terminator)
-        TelemetryCallback callback;   // Callback function
+        TelemetryCallback callback;   // Callback function (String version)
+        TelemetryBufferCallback bufferCallback;  // Callback function (buffer version)
         unsigned long intervalMs;     // Interval between executions
-        unsigned long lastExecution;   // Last execution time
+        PublishPriority priority;     // Priority class of this metric
         bool active;                  // Whether this entry is active
+        uint32_t generation;          // Changes on every register/unregister/update (0 = never used)
+    };
+    
+    // Telemetry callback structure
+    struct TelemetryEntry {
+        TelemetryConfig config;       // Definition (seqlock protected)
+        volatile uint32_t sequence;   // Seqlock counter, odd while config is being written
+        // Scheduler state, only touched by the MQTT task; reset when config.generation changes
+        unsigned long lastExecution;   // Last execution time
+        uint32_t scheduledGeneration; // Generation lastExecution belongs to
+#ifdef TELEMETRY_TRANSPORT_UDP
+        uint32_t udpRegisteredGeneration; // Generation whose topic id was registered with the gateway
+#endif
+        // Sample cache, protected by sampleMutex
+        char lastValue[128];          // Last sampled value (served by the metrics endpoint)
+        bool hasSample;               // Whether lastValue holds a sample
+        uint32_t sampleGeneration;    // Generation lastValue was sampled for
     };
     
     static const int MAX_TELEMETRY_CALLBACKS = 10;
+    static const int TELEMETRY_VALUE_MAX_LEN = sizeof(TelemetryEntry::lastValue);  // Telemetry value buffer (incl. null terminator)
+    static const int MQTT_RX_PAYLOAD_MAX_LEN = 128;  // Inbound payload buffer (incl. null terminator)
+    static const int MQTT_RX_TOPIC_MAX_LEN = 128;    // Inbound topic buffer (incl. null terminator); longer topics are ignored
     TelemetryEntry telemetryCallbacks[MAX_TELEMETRY_CALLBACKS];
     int telemetryCallbackCount;
+    portMUX_TYPE registryLock;        // Serializes registry writers (readers never take it)
+    uint32_t registryGeneration;      // Last generation handed out
+    volatile uint32_t schedulerEpoch; // Odd while the MQTT task may be running telemetry callbacks
+    
+    // Outbound message queue entry (messages waiting for the MQTT task to send them)
+    // Topic and payload are stored back to back, null-terminated, in the class's byte ring
+    struct OutboundMessage {
+        uint16_t offset;             // Start of the topic in outboundData
+        uint16_t size;               // Topic and payload bytes, including both terminators
+        bool retained;               // Retain flag
+    };
+    
+    // One ring of entries and one ring of bytes per priority class. Messages leave in order,
+    // so the bytes in use are always one contiguous (possibly wrapped) range
+    static const int PRIORITY_CLASS_COUNT = 3;
+    OutboundMessage outboundQueue[PRIORITY_CLASS_COUNT][OUTBOUND_QUEUE_SIZE];
+    char outboundData[PRIORITY_CLASS_COUNT][OUTBOUND_QUEUE_BYTES];
+    int outboundHead[PRIORITY_CLASS_COUNT];   // Index of the oldest queued message
+    int outboundCount[PRIORITY_CLASS_COUNT];  // Number of queued messages (atomic; written under queueMutex)
+    uint16_t outboundDataTail[PRIORITY_CLASS_COUNT];  // First free byte after the newest message
+    bool outboundSending[PRIORITY_CLASS_COUNT];  // Oldest message is being sent by the MQTT task
+    unsigned long outboundDropped[PRIORITY_CLASS_COUNT];  // Messages dropped because the queue was full
+    
+#ifdef STREAM_CHANNELS
+    // Streaming capture channel
+    // Blocks form a ring: the uploader owns [head, head + readyCount), the producer
+    // fills block fillIndex outside that range. Indices change only under lock.
+    static const int STREAM_HEADER_LEN = 8;  // Sequence (u32) + cumulative overruns (u32), big-endian
+    struct StreamChannel {
+        char topic[64];              // MQTT topic (max 63 chars + null terminator)
+        bool open;                   // Whether the channel is in use
+        uint8_t blocks[STREAM_BLOCK_COUNT][STREAM_HEADER_LEN + STREAM_BLOCK_SIZE];  // Header + samples
+        size_t blockLength[STREAM_BLOCK_COUNT];  // Sample bytes in each completed block
+        int head;                    // Oldest completed block
+        int readyCount;              // Completed blocks waiting for (or in) upload
+        int fillIndex;               // Block being filled by the producer (-1 = none)
+        size_t fillLength;           // Sample bytes in the block being filled
+        size_t droppedBytes;         // Dropped bytes not yet counted as a whole block
+        uint32_t sequence;           // Sequence number of the next block
+        uint32_t overruns;           // Blocks dropped because no free block was available
+        portMUX_TYPE lock;           // Spinlock (usable from ISRs)
+    };
+    StreamChannel streamChannels[STREAM_CHANNELS];
+#endif
+    
+    // Application subscription
+    struct Subscription {
+        char filter[64];              // Topic filter (max 63 chars + null terminator)
+        MessageHandler handler;       // Handler function
+        void* context;                // Passed to the handler
+        HandlerContext handlerContext; // Where the handler runs
+        uint32_t id;                  // Unique per subscribe() call (0 = free slot)
+        int16_t next;                 // Next subscription in the same trie node list (-1 = end)
+    };
+    
+    // Topic-filter trie node. Literal children of a node are contiguous and sorted
+    // (by length, then bytes) so a level is found by binary search
+    struct TopicTrieNode {
+        int16_t sub;                  // Subscription whose filter holds this node's level text
+        uint8_t offset;               // Level text offset in that filter
+        uint8_t length;               // Level text length
+        int16_t firstChild;           // First literal child
+        int16_t childCount;           // Number of literal children
+        int16_t plusChild;            // Child for a + level (-1 = none)
+        int16_t exactSubs;            // Subscriptions whose filter ends at this node
+        int16_t hashSubs;             // Subscriptions whose filter is this node's path followed by #
+    };
+    
+    // Subscriptions and their prebuilt trie. Two sets: writers rebuild the inactive one and
+    // swap, the MQTT task dispatches from the active one without locking
+    struct SubscriptionSet {
+        Subscription entries[MAX_SUBSCRIPTIONS];
+        TopicTrieNode nodes[SUBSCRIPTION_TRIE_NODES];
+        int nodeCount;
+    };
+    SubscriptionSet subscriptionSets[2];
+    volatile int activeSubscriptionSet;     // Index of the set used for dispatch
+    uint32_t subscriptionIdCounter;         // Last subscription id handed out
+    volatile uint32_t subscriptionGeneration;  // Changes on every subscribe()/unsubscribe()
+    volatile uint32_t subscriptionReadEpoch;   // Odd while the MQTT task reads a subscription set
+    uint32_t syncedSubscriptionGeneration;  // Generation last mirrored to the broker (MQTT task)
+    uint32_t brokerSubscriptionIds[MAX_SUBSCRIPTIONS];  // Subscription id active on the broker per slot (MQTT task)
+    static const int PENDING_UNSUBSCRIBE_SIZE = 4;
+    char pendingUnsubscribes[PENDING_UNSUBSCRIBE_SIZE][64];  // Filters to unsubscribe on the broker
+    int pendingUnsubscribeCount;
+    int16_t trieBuildOrder[MAX_SUBSCRIPTIONS];   // Trie build scratch (under subscriptionMutex)
+    uint8_t trieBuildLevel[MAX_SUBSCRIPTIONS];   // Offset of each filter's next level during the build
+    int16_t trieBuildRange[SUBSCRIPTION_TRIE_NODES][2];  // Subscriptions below each node during the build
+    
+    // Messages queued for HANDLER_CONTEXT_LOOP handlers (under queueMutex)
+    struct DeferredMessage {
+        char topic[MQTT_RX_TOPIC_MAX_LEN];
+        char payload[MQTT_RX_PAYLOAD_MAX_LEN];
+        size_t length;
+        MessageHandler handler;
+        void* context;
+        uint32_t subscriptionId;
+    };
+    DeferredMessage deferredMessages[SUBSCRIPTION_QUEUE_SIZE];
+    int deferredHead;
+    int deferredCount;
+    unsigned long deferredDropped;   // Messages dropped because the queue was full
     
-    // Static instance pointer for callback access
-    static ESPRazorBlade* instance;
+    // Payload compression
+    static const int MAX_COMPRESSED_TOPICS = 4;
+    static const int COMPRESSION_HASH_SIZE = 256;  // Must be a power of two
+    char compressedTopics[MAX_COMPRESSED_TOPICS][64];  // Topic prefixes that are always compressed
+    int compressedTopicCount;
+    uint16_t compressionHash[COMPRESSION_HASH_SIZE];  // Last position per 3-byte hash (used under mqttMutex)
     
     // Static task functions (RTOS entry points)
     static void wifiTask(void* parameter);
     static void mqttTask(void* parameter);
+    static void httpTask(void* parameter);
     
-    // Static MQTT callback (MQTT message handler)
-    static void onMQTTMessage(int messageSize);
+    // Static MQTT callback (MQTT message handler, resolves the instance from the client)
+    static void onMQTTMessage(MqttClient* client, int messageSize);
     
     // Internal helper functions
     void connectWiFi();
     void connectMQTT();
+    unsigned long nextWakeDelayMs();  // Time until the MQTT task has scheduled work
+    void waitForMQTTActivity(unsigned long timeoutMs);  // Block on socket readiness or a wake-up up to timeoutMs
+    void openWakeSocket();   // begin(), once the network stack is started
+    void wakeMQTTTask();     // Ends the MQTT task's idle wait (not from an ISR)
+    bool sendMessage(const char* topic, const char* payload, bool retained, TickType_t waitTicks);
+    bool isCompressionTopic(const char* topic);  // Starts with an enableCompression() prefix (payloads framed, see README)
+    bool shouldCompress(size_t payloadLen);      // Size eligible on a compression topic
+    size_t compressPayload(const uint8_t* data, size_t len, Print* out);  // Returns compressed size; out may be null
+    static uint16_t compressionHashOf(const uint8_t* p);
+    bool enqueueMessage(const char* topic, const char* payload, bool retained, PublishPriority priority);
+    int reserveOutboundBytes(int p, size_t size);  // Offset for a new message, or -1 (under queueMutex)
+    void removeOldestMessage(int p);               // Under queueMutex
+    bool peekMessage(PublishPriority priority, const char*& topic, const char*& payload, bool& retained);
+    void finishMessage(PublishPriority priority, bool sent);  // Remove the peeked message, or keep it at the front
+    int queuedMessageCount(PublishPriority priority);
+    void drainOutboundQueue(PublishPriority priority, int maxMessages);
+    bool addTelemetryEntry(const char* topic, TelemetryCallback callback, TelemetryBufferCallback bufferCallback,
+                           unsigned long intervalMs, PublishPriority priority);
     void processTelemetry();  // Process registered telemetry callbacks
+    bool readTelemetryConfig(int slot, TelemetryConfig& config);  // Lock-free snapshot; returns config.active
+    int findTelemetrySlot(const char* topic, TelemetryConfig& config);  // Active entry by topic (-1 if none)
+    uint32_t nextRegistryGeneration();  // Under registryLock
+    void beginRegistryWrite(TelemetryEntry& entry);  // Seqlock write section (under registryLock)
+    void endRegistryWrite(TelemetryEntry& entry);
+    bool telemetryDue(int slot, const TelemetryConfig& config, unsigned long now);  // Scheduler check (MQTT task only)
+    void readTelemetryValue(const TelemetryConfig& config, char* buffer, size_t size);  // Run an entry's callback into a buffer
+    void sampleTelemetry();  // Sample due metrics into the cache without publishing (no-broker mode)
+    void refreshSampleCache();  // sampleTelemetry() inside the scheduler epoch (no broker connection)
+    void storeSample(int slot, uint32_t generation, const char* value);  // Update an entry's cached last sample
+#ifdef STREAM_CHANNELS
+    size_t streamWriteInternal(int channel, const uint8_t* data, size_t len, bool fromISR);
+    void completeStreamBlock(StreamChannel& stream);  // Hand the fill block to the uploader (under lock)
+    void drainStreams();  // Publish completed stream blocks
+    bool streamBlocksReady();  // Whether any channel has a completed block
+    static void wakeMQTTTaskPended(void* instance, uint32_t unused);  // wakeMQTTTask() from the timer service task
+#endif
+#ifdef TELEMETRY_TRANSPORT_UDP
+    bool sendUdpTelemetry(int slot, const char* value);  // Send one metric as an MQTT-SN PUBLISH datagram
+    bool resolveUdpGateway();  // Look up UDP_GATEWAY_HOST once per WiFi connection
+    void registerUdpTopicIds(unsigned long now);  // Send MQTT-SN REGISTER datagrams mapping topic ids to topics
+#endif
+#ifdef METRICS_HTTP_PORT
+    bool acceptMetricsClients();  // Move pending scrape connections into free slots
+    bool readMetricsRequest(MetricsClient& slot, unsigned long now);  // Read without blocking; true when the slot is done
+#endif
+    void serveMetrics(WiFiClient& client, const char* requestLine);  // Answer one HTTP scrape from the sample cache
     void publishBootTelemetry();  // One-time status and reset reason on MQTT connect
     void publishConfigurationTimeouts();  // One-time config timeout publish on MQTT connect
-    void handleConfigUpdate(const char* topic, String payload);  // Handle config topic updates
-    void subscribeToConfigTopics();  // Subscribe to configuration topics
+    void publishHealthTelemetry(unsigned long now);  // Periodic memory and stack health publish
+    bool checkBrokerProbe(unsigned long now);  // Send the next probe or detect a lost one; false if reconnecting
+    void handleProbeEcho(const char* payload);  // Measure RTT from a probe that came back
+    bool recordProbeFailure();  // Count a failed probe; true if a reconnect was requested
+    bool restartMQTTConnection();  // Drop a stale broker connection so mqttTask reconnects (mqttTask only, not from callbacks)
+    void resetSessionState();  // Broker session ended: subscribe and probe from scratch after reconnect
+    void handleConfigUpdate(const char* topic, const char* payload);  // Handle config topic updates
+    void handleReadCommand(const char* metric, char* correlationId);  // Handle on-demand metric read (trims correlationId in place)
+    void subscribeToConfigTopics();  // Subscribe to configuration and command topics
+    bool isLibrarySubscription(const char* filter);  // Filter subscribeToConfigTopics() holds on the broker
+    void waitForEpoch(volatile uint32_t& epoch);  // Wait until the MQTT task leaves the section an odd epoch marks
+    bool buildTopicTrie(SubscriptionSet& set);  // Rebuild the trie of a set from its entries
+    void activateSubscriptionSet(int index);  // Swap in a rebuilt set (under subscriptionMutex)
+    int dispatchMessage(const char* topic, const char* payload, size_t length);  // Run or queue matching handlers
+    void syncSubscriptions();  // Mirror subscribe()/unsubscribe() to the broker (MQTT task)
+    void resetBrokerSubscriptions();  // Broker session lost: resubscribe everything on reconnect
 };
 
 #endif // ESPRAZORBLADE_H
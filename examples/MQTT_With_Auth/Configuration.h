@@ -20,5 +20,14 @@
 #define WIFI_SIGNAL_INTERVAL_MS 30000            // Publish WiFi RSSI every 30 seconds
 #define TIME_ALIVE_INTERVAL_MS 60000             // Publish time alive every 60 seconds
 #define FREE_HEAP_INTERVAL_MS 90000              // Publish free heap memory every 90 seconds
+// #define HEALTH_INTERVAL_MS 300000             // Optional: publish memory/stack health every 5 minutes
+// #define MQTT_PROBE_INTERVAL_MS 30000          // Optional: measure broker RTT and drop stale connections
+// #define COMPRESSION_THRESHOLD_BYTES 512       // Optional: smallest payload compressed on enableCompression() topics
+// #define METRICS_HTTP_PORT 9100                // Optional: serve Prometheus metrics at http://<ip>:9100/metrics
+// #define TELEMETRY_TRANSPORT_UDP               // Optional: send telemetry as UDP datagrams (MQTT-SN style)
+// #define UDP_GATEWAY_HOST "192.168.1.100"      // UDP gateway address (required with TELEMETRY_TRANSPORT_UDP)
+// #define STREAM_CHANNELS 1                     // Optional: streaming capture channels (see README)
+// #define MAX_SUBSCRIPTIONS 8                   // Optional: topic filters available to subscribe()
+// #define ESPRAZORBLADE_STATIC_ALLOCATION       // Optional: tasks and mutexes in the library object, no heap at begin()
 
 #endif // CONFIGURATION_H
@@ -0,0 +1,84 @@
+#!/usr/bin/env python3
+"""
+ESPRazorBlade blackhole proxy
+
+TCP proxy placed between the device and a local MQTT broker. Pressing Enter
+toggles blackhole mode: while active, traffic in both directions is silently
+discarded but the connections stay open, which reproduces a half-open TCP
+connection (the device still sees connected() == true).
+
+Used to test the broker loopback probe (MQTT_PROBE_INTERVAL_MS): point the
+device's MQTT_BROKER at this machine and MQTT_PORT at --listen-port, enable
+blackhole mode, and watch the device log unanswered probes and force a
+reconnect after MQTT_PROBE_MAX_FAILURES * MQTT_PROBE_TIMEOUT_MS.
+
+Usage:
+    python3 blackhole_proxy.py --broker localhost --broker-port 1883 --listen-port 1884
+"""
+
+import argparse
+import socket
+import threading
+import time
+
+blackhole = threading.Event()
+
+
+def pipe(source, destination, label):
+    """Copy bytes from source to destination, dropping them while blackholed."""
+    try:
+        while True:
+            data = source.recv(4096)
+            if not data:
+                break
+            if blackhole.is_set():
+                continue
+            destination.sendall(data)
+    except OSError:
+        pass
+    finally:
+        print(f"{time.strftime('%H:%M:%S')} {label} closed")
+        for s in (source, destination):
+            try:
+                s.shutdown(socket.SHUT_RDWR)
+            except OSError:
+                pass
+
+
+def main():
+    parser = argparse.ArgumentParser(description="ESPRazorBlade blackhole proxy")
+    parser.add_argument("--broker", default="localhost", help="MQTT broker host")
+    parser.add_argument("--broker-port", type=int, default=1883, help="MQTT broker port")
+    parser.add_argument("--listen", default="0.0.0.0", help="Proxy listen address")
+    parser.add_argument("--listen-port", type=int, default=1884, help="Proxy listen port (device MQTT_PORT)")
+    args = parser.parse_args()
+
+    server = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    server.bind((args.listen, args.listen_port))
+    server.listen(4)
+    print(f"Proxying tcp://{args.listen}:{args.listen_port} -> {args.broker}:{args.broker_port}")
+    print("Press Enter to toggle blackhole mode")
+
+    def accept_loop():
+        while True:
+            client, address = server.accept()
+            upstream = socket.create_connection((args.broker, args.broker_port))
+            print(f"{time.strftime('%H:%M:%S')} connection from {address[0]}:{address[1]}")
+            threading.Thread(target=pipe, args=(client, upstream, "device->broker"), daemon=True).start()
+            threading.Thread(target=pipe, args=(upstream, client, "broker->device"), daemon=True).start()
+
+    threading.Thread(target=accept_loop, daemon=True).start()
+
+    while True:
+        input()
+        if blackhole.is_set():
+            blackhole.clear()
+        else:
+            blackhole.set()
+        state = "ON (dropping traffic)" if blackhole.is_set() else "OFF (forwarding)"
+        print(f"{time.strftime('%H:%M:%S')} blackhole {state}")
+
+
+if __name__ == "__main__":
+    main()
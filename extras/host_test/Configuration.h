@@ -0,0 +1,33 @@
+#ifndef CONFIGURATION_H
+#define CONFIGURATION_H
+
+// Host test configuration. Options under test are added per test with -D in the Makefile
+#include "host_config.h"
+
+#define WIFI_SSID "host-test"
+#define WIFI_PASSWORD "host-test"
+
+// Broker address is set at run time (hostSetBroker), usually to an in-process HostBroker
+#ifndef HOST_NO_BROKER
+#define MQTT_BROKER hostBrokerHost()
+#define MQTT_PORT hostBrokerPort()
+#endif
+#define MQTT_CLIENT_ID "host-test-client"
+
+// UDP gateway port is set at run time (hostSetUdpGateway) by tests that build with TELEMETRY_TRANSPORT_UDP
+#ifdef TELEMETRY_TRANSPORT_UDP
+#define UDP_GATEWAY_HOST "127.0.0.1"
+#define UDP_GATEWAY_PORT hostUdpGatewayPort()
+#endif
+
+// Metrics endpoint port is set at run time (hostSetMetricsPort) by tests built with HOST_METRICS_HTTP
+#ifdef HOST_METRICS_HTTP
+#define METRICS_HTTP_PORT hostMetricsPort()
+#endif
+
+#define DEVICE_ID "host-device"
+#define WIFI_SIGNAL_INTERVAL_MS 30000
+#define TIME_ALIVE_INTERVAL_MS 60000
+#define FREE_HEAP_INTERVAL_MS 30000
+
+#endif // CONFIGURATION_H
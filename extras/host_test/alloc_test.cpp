@@ -0,0 +1,167 @@
+// Allocation test: counts heap allocations made by begin() and on the MQTT task while it
+// receives config updates, read commands and subscription messages, publishes responses and
+// telemetry, and while processMessages() runs. begin() must not allocate at all: no library
+// allocation and no heap block for a task or mutex (static allocation mode). On the MQTT
+// task the only allocation allowed is the documented exception, the String copy returned by
+// ArduinoMqttClient::messageTopic(), at most one per received message.
+//
+// Built with ESPRAZORBLADE_STATIC_ALLOCATION.
+//
+// Usage: alloc_test [rounds]
+#include "host_test.h"
+#include "host_alloc.h"
+#include <new>
+
+#ifndef ESPRAZORBLADE_STATIC_ALLOCATION
+#error "alloc_test checks the static allocation mode, build it with ESPRAZORBLADE_STATIC_ALLOCATION"
+#endif
+
+static thread_local bool counting = false;
+static thread_local long allocations = 0;       // Made by the library
+static thread_local long topicAllocations = 0;  // Made for messageTopic()
+
+void* operator new(size_t size) {
+    if (counting) {
+        HostAllocationKind kind = hostAllocationKind();
+        if (kind == HOST_ALLOC_LIBRARY) {
+            allocations++;
+        } else if (kind == HOST_ALLOC_TOPIC_STRING) {
+            topicAllocations++;
+        }
+    }
+    void* p = malloc(size ? size : 1);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+void operator delete(void* p) noexcept {
+    free(p);
+}
+void operator delete[](void* p) noexcept {
+    free(p);
+}
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+void operator delete[](void* p, size_t) noexcept {
+    free(p);
+}
+
+static void readTemperature(char* buffer, size_t size) {
+    snprintf(buffer, size, "21.5");
+}
+
+static long appMessages = 0;
+static void onAppMessage(const char* topic, const char* payload, size_t length, void* context) {
+    appMessages++;
+}
+
+int main(int argc, char** argv) {
+    int rounds = argc > 1 ? atoi(argv[1]) : 200;
+    static HostBroker broker;
+    hostSetBroker("127.0.0.1", broker.start());
+    std::atomic<long> responses{0};
+    std::atomic<long> badResponses{0};
+    std::atomic<long> telemetry{0};
+    broker.onPublish([&](const std::string& clientId, const std::string& topic, const std::string& payload) {
+        if (topic == "host-device/telemetry/temperature") {
+            telemetry++;
+        }
+        if (topic.compare(0, 25, "host-device/cmd/response/") == 0) {
+            // The correlation id arrives with spaces and a newline, and must be trimmed
+            if (topic.compare(0, 41, "host-device/cmd/response/temperature/req-") == 0 &&
+                topic.find_first_of(" \n") == std::string::npos) {
+                responses++;
+            } else {
+                badResponses++;
+            }
+        }
+    });
+
+    // begin(): tasks and mutexes live in the object, nothing comes from the heap
+    static ESPRazorBlade booted("alloc-boot");
+    long kernelBefore = hostKernelHeapAllocations();
+    allocations = 0;
+    counting = true;
+    CHECK(booted.begin());
+    counting = false;
+    long bootAllocations = allocations;
+    long bootKernelAllocations = hostKernelHeapAllocations() - kernelBefore;
+    printf("alloc_test: begin() made %ld allocations, %ld task/mutex heap blocks\n", bootAllocations,
+           bootKernelAllocations);
+    CHECK(bootAllocations == 0);
+    CHECK(bootKernelAllocations == 0);
+
+    static ESPRazorBlade rb;
+    CHECK(rb.registerTelemetry("host-device/telemetry/temperature", readTemperature, 1));
+    // begin() is not called, so the built-in metric the config updates target is registered here
+    CHECK(rb.registerTelemetry("host-device/telemetry/wifi_rssi", readTemperature, 60000));
+    CHECK(hostAttachMqttTask(rb));
+    rb.resetReasonPublished = true;
+    rb.configTimeoutsPublished = true;
+    rb.subscribeToConfigTopics();
+    CHECK(rb.subscribe("app/+/value", onAppMessage));
+    CHECK(rb.subscribe("app/deferred/#", onAppMessage, nullptr, HANDLER_CONTEXT_LOOP));
+    rb.syncSubscriptions();
+
+    // Each round: a config update, a read command, an application message for each handler
+    // context, and a telemetry cycle
+    const int MESSAGES_PER_ROUND = 4;
+    long received = 0;
+    long pollAllocations = 0;
+    long topicStrings = 0;
+    long otherAllocations = 0;
+    for (int round = -5; round < rounds; round++) {  // The first rounds size the client's buffers
+        long expectedApp = appMessages + 2;
+        long expectedResponses = responses + 1;
+        broker.publish("host-device/config/telemetry/timeouts/wifi_rssi", round % 2 ? "30000" : "31000");
+        broker.publish("host-device/cmd/read/temperature", "  req-" + std::to_string(round + 5) + " \n");
+        broker.publish("app/sensor/value", "42");
+        broker.publish("app/deferred/long/topic/name/for/the/queue", "43");
+
+        bool done = false;
+        for (int spin = 0; spin < 2000 && !done; spin++) {
+            allocations = 0;
+            topicAllocations = 0;
+            counting = true;
+            rb.mqttClient.poll();
+            rb.processMessages();
+            counting = false;
+            if (round >= 0) {
+                pollAllocations += allocations;
+                topicStrings += topicAllocations;
+            }
+            done = appMessages == expectedApp && responses == expectedResponses;
+            if (!done) {
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+        }
+        CHECK(done);
+
+        // Telemetry (due every cycle) and queue draining
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        allocations = 0;
+        counting = true;
+        rb.processTelemetry();
+        counting = false;
+        if (round >= 0) {
+            otherAllocations += allocations;
+            received += MESSAGES_PER_ROUND;
+        }
+    }
+
+    printf("alloc_test: %ld messages received, %ld allocations while receiving and handling, %ld messageTopic() "
+           "Strings (limit %ld), %ld allocations while publishing telemetry\n", received, pollAllocations,
+           topicStrings, received, otherAllocations);
+    CHECK(badResponses == 0);
+    CHECK(pollAllocations == 0);
+    CHECK(topicStrings <= received);
+    CHECK(otherAllocations == 0);
+    CHECK(hostWaitFor([&] { return telemetry >= rounds; }, 2000));
+    printf("alloc_test: PASS\n");
+    hostExit(0);
+}
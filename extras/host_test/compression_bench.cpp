@@ -0,0 +1,321 @@
+// Payload compression benchmark: compressed size, compression time and peak memory (heap
+// and stack) for typical payloads (JSON batches, CSV rows, log lines, random text) at
+// several sizes, measured the way sendMessage() compresses (a counting pass, then the pass
+// into the client). Then payloads go through the publish path and are decoded with the
+// README decoder rules. Fails if a payload does not decode back to what was published,
+// including raw payloads that start with the "RZ" marker, if a compressed payload is not
+// smaller than the original, if a topic without enableCompression() gets a compressed or
+// escaped payload, or if compression allocates.
+//
+// Built with COMPRESSION_THRESHOLD_BYTES=64.
+//
+// Usage: compression_bench [iterations per payload]
+#include "host_test.h"
+#include <new>
+#include <pthread.h>
+#include <random>
+
+static thread_local bool counting = false;
+static thread_local long allocations = 0;
+static thread_local size_t allocatedBytes = 0;
+
+void* operator new(size_t size) {
+    if (counting) {
+        allocations++;
+        allocatedBytes += size;
+    }
+    void* p = malloc(size ? size : 1);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+// Not inlined, so the compiler does not pair its free() with the operator new above
+__attribute__((noinline)) void operator delete(void* p) noexcept {
+    free(p);
+}
+__attribute__((noinline)) void operator delete[](void* p) noexcept {
+    free(p);
+}
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+__attribute__((noinline)) void operator delete[](void* p, size_t) noexcept {
+    free(p);
+}
+
+// Deepest stack use of a call: runs it on a thread whose stack is painted with a pattern and
+// finds the lowest overwritten byte. Thread start-up is measured with an empty call and
+// subtracted
+static const size_t PAINTED_STACK = 256 * 1024;
+static const uint8_t PAINT = 0xA5;
+
+static size_t stackUsed(const std::function<void()>& call) {
+    static uint8_t* stack = (uint8_t*)aligned_alloc(4096, PAINTED_STACK);
+    memset(stack, PAINT, PAINTED_STACK);
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_attr_setstack(&attributes, stack, PAINTED_STACK);
+    pthread_t thread;
+    auto run = [](void* argument) -> void* {
+        (*(const std::function<void()>*)argument)();
+        return nullptr;
+    };
+    CHECK(pthread_create(&thread, &attributes, run, (void*)&call) == 0);
+    pthread_join(thread, nullptr);
+    pthread_attr_destroy(&attributes);
+    size_t untouched = 0;
+    while (untouched < PAINTED_STACK && stack[untouched] == PAINT) {
+        untouched++;
+    }
+    return PAINTED_STACK - untouched;
+}
+
+static const size_t HEADER_LEN = 5;  // "RZ", format byte, 16-bit original length
+
+// C++ port of the README reference decoder
+static bool rzDecompress(const std::string& data, std::string& out) {
+    if (data.compare(0, 3, std::string("RZ\x00", 3)) == 0) {
+        out = data.substr(3);  // Escaped raw payload
+        return true;
+    }
+    if (data.compare(0, 3, "RZ\x01") != 0) {
+        out = data;  // Raw payload
+        return true;
+    }
+    if (data.size() < 5) {
+        return false;
+    }
+    size_t size = ((uint8_t)data[3] << 8) | (uint8_t)data[4];
+    out.clear();
+    size_t i = 5;
+    while (out.size() < size) {
+        if (i >= data.size()) {
+            return false;
+        }
+        uint8_t flags = data[i++];
+        for (int bit = 0; bit < 8 && out.size() < size; bit++) {
+            if (flags & (1 << bit)) {
+                if (i + 1 >= data.size()) {
+                    return false;
+                }
+                size_t offset = ((uint8_t)data[i] | (((uint8_t)data[i + 1] >> 4) << 8)) + 1;
+                size_t length = ((uint8_t)data[i + 1] & 0x0F) + 3;
+                i += 2;
+                if (offset > out.size()) {
+                    return false;
+                }
+                for (size_t k = 0; k < length; k++) {
+                    out.push_back(out[out.size() - offset]);
+                }
+            } else {
+                if (i >= data.size()) {
+                    return false;
+                }
+                out.push_back(data[i++]);
+            }
+        }
+    }
+    return i == data.size();
+}
+
+// Counts what the second compression pass writes, as the MQTT client would receive it
+class CountingPrint : public Print {
+public:
+    size_t write(uint8_t c) override {
+        bytes++;
+        return 1;
+    }
+    size_t write(const uint8_t* buffer, size_t size) override {
+        bytes += size;
+        return size;
+    }
+    size_t bytes = 0;
+};
+
+static std::string jsonBatch(size_t size, std::mt19937& random) {
+    std::string out = "[";
+    for (long t = 1700000000; out.size() < size; t += 10) {
+        char reading[96];
+        snprintf(reading, sizeof(reading), "{\"ts\":%ld,\"temp\":%.2f,\"hum\":%.1f,\"rssi\":%d},", t,
+                 21.0 + (random() % 300) / 100.0, 40.0 + (random() % 200) / 10.0, -50 - (int)(random() % 30));
+        out += reading;
+    }
+    out.resize(size - 1);
+    return out + "]";
+}
+
+static std::string csvRows(size_t size, std::mt19937& random) {
+    std::string out = "ts,ax,ay,az\n";
+    for (long t = 0; out.size() < size; t += 4) {
+        char row[64];
+        snprintf(row, sizeof(row), "%ld,%d,%d,%d\n", t, (int)(random() % 200) - 100, (int)(random() % 200) - 100,
+                 980 + (int)(random() % 20));
+        out += row;
+    }
+    out.resize(size);
+    return out;
+}
+
+static std::string logLines(size_t size, std::mt19937& random) {
+    static const char* MESSAGES[] = {"WiFi connected", "MQTT connected", "Sensor read OK", "Heap low watermark",
+                                     "Retrying sensor read"};
+    std::string out;
+    for (long t = 1000; out.size() < size; t += 137) {
+        char line[96];
+        snprintf(line, sizeof(line), "[%8ld] %s: %s\n", t, random() % 5 == 0 ? "WARNING" : "INFO",
+                 MESSAGES[random() % 5]);
+        out += line;
+    }
+    out.resize(size);
+    return out;
+}
+
+static std::string randomText(size_t size, std::mt19937& random) {
+    std::string out;
+    while (out.size() < size) {
+        out.push_back((char)(33 + random() % 94));
+    }
+    return out;
+}
+
+int main(int argc, char** argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 200;
+    std::mt19937 random(7);
+
+    // Size, compression time and memory, on an instance of its own (compressPayload() uses
+    // its hash table)
+    static ESPRazorBlade codec;
+    struct Kind {
+        const char* name;
+        std::string (*make)(size_t, std::mt19937&);
+    };
+    const Kind KINDS[] = {{"JSON batch", jsonBatch}, {"CSV rows", csvRows}, {"log lines", logLines},
+                          {"random text", randomText}};
+    const size_t threadStartStack = stackUsed([] {});
+    size_t peakStack = 0;
+    for (const Kind& kind : KINDS) {
+        for (size_t size : {256, 1024, 4096}) {
+            std::string payload = kind.make(size, random);
+            const uint8_t* data = (const uint8_t*)payload.data();
+            size_t compressed = HEADER_LEN + codec.compressPayload(data, payload.size(), nullptr);
+
+            std::vector<double> times;
+            for (int i = 0; i < iterations; i++) {
+                CountingPrint sink;
+                double start = hostSeconds();
+                codec.compressPayload(data, payload.size(), nullptr);
+                codec.compressPayload(data, payload.size(), &sink);
+                times.push_back((hostSeconds() - start) * 1e6);
+                CHECK(HEADER_LEN + sink.bytes == compressed);
+            }
+            double p50 = hostPercentile(times, 50);
+
+            // Both passes again, counting heap allocations and the stack they reach
+            long heapAllocations = 0;
+            size_t heapBytes = 0;
+            size_t stack = stackUsed([&] {
+                CountingPrint sink;
+                allocations = 0;
+                allocatedBytes = 0;
+                counting = true;
+                codec.compressPayload(data, payload.size(), nullptr);
+                codec.compressPayload(data, payload.size(), &sink);
+                counting = false;
+                heapAllocations = allocations;
+                heapBytes = allocatedBytes;
+            }) - threadStartStack;
+            peakStack = std::max(peakStack, stack);
+
+            printf("compression_bench: %-11s %4zu bytes -> %4zu bytes (%3.0f%%, sent %s), %6.1f us per payload "
+                   "(%5.1f MB/s, host CPU), heap %zu B in %ld allocations, stack %zu B\n",
+                   kind.name, payload.size(), compressed, 100.0 * compressed / payload.size(),
+                   compressed < payload.size() ? "compressed" : "raw", p50, payload.size() / p50, heapBytes,
+                   heapAllocations, stack);
+            CHECK(heapAllocations == 0);
+        }
+    }
+    printf("compression_bench: peak memory: no heap, %zu B of stack (host build, includes the benchmark's "
+           "lambda and sink), %zu B hash table inside the object\n", peakStack, sizeof(codec.compressionHash));
+
+    // Round trip through the publish path. Topics under host-device/bench/ are compression
+    // topics; host-device/plain/ topics must go out unchanged whatever their payload
+    static HostBroker broker;
+    hostSetBroker("127.0.0.1", broker.start());
+    std::mutex lock;
+    std::map<std::string, std::string> received;  // Topic -> payload as published
+    broker.onPublish([&](const std::string& clientId, const std::string& topic, const std::string& payload) {
+        if (topic.compare(0, 18, "host-device/bench/") == 0 || topic.compare(0, 18, "host-device/plain/") == 0) {
+            std::lock_guard<std::mutex> guard(lock);
+            received[topic] = payload;
+        }
+    });
+    static ESPRazorBlade rb;
+    CHECK(hostAttachMqttTask(rb));
+    CHECK(rb.enableCompression("host-device/bench/"));
+
+    struct Case {
+        bool compressionTopic;
+        std::string payload;
+    };
+    const Case CASES[] = {
+        {true, "21.5"},                                       // Raw, below the minimum size
+        {true, "RZ"},                                         // Escaped, is the marker
+        {true, "RZ\x01\x7f looks like a compressed header"},   // Escaped, below the threshold
+        {true, "a payload below the 64-byte threshold"},      // Raw, below the threshold
+        {true, "RZ" + randomText(300, random)},               // Escaped, incompressible
+        {true, "RZ" + jsonBatch(1024, random)},               // Compressed, starts with the marker
+        {true, jsonBatch(2048, random)},                      // Compressed
+        {true, randomText(300, random)},                      // Raw, incompressible
+        {false, "RZ\x01\x7f looks like a compressed header"},  // Unchanged: not a compression topic
+        {false, "RZ" + jsonBatch(1024, random)},              // Unchanged: not a compression topic
+    };
+    const int CASE_COUNT = sizeof(CASES) / sizeof(CASES[0]);
+    auto topicOf = [&](int i) {
+        return std::string(CASES[i].compressionTopic ? "host-device/bench/" : "host-device/plain/") + std::to_string(i);
+    };
+    for (int i = 0; i < CASE_COUNT; i++) {
+        CHECK(rb.sendMessage(topicOf(i).c_str(), CASES[i].payload.c_str(), false, portMAX_DELAY));
+    }
+    CHECK(hostWaitFor([&] {
+        std::lock_guard<std::mutex> guard(lock);
+        return (int)received.size() == CASE_COUNT;
+    }, 5000));
+
+    std::lock_guard<std::mutex> guard(lock);
+    int escaped = 0;
+    int compressed = 0;
+    int unchanged = 0;
+    for (int i = 0; i < CASE_COUNT; i++) {
+        const std::string& wire = received[topicOf(i)];
+        const std::string& payload = CASES[i].payload;
+        if (!CASES[i].compressionTopic) {
+            CHECK(wire == payload);  // Consumers that never opted in see the payload as published
+            unchanged++;
+            continue;
+        }
+        std::string decoded;
+        CHECK(rzDecompress(wire, decoded));
+        CHECK(decoded == payload);
+        if (wire.compare(0, 3, "RZ\x01") == 0) {
+            CHECK(wire.size() < payload.size());
+            compressed++;
+        } else if (wire.compare(0, 3, std::string("RZ\x00", 3)) == 0) {
+            CHECK(wire.size() == payload.size() + 3);
+            escaped++;
+        } else {
+            CHECK(wire == payload);
+        }
+    }
+    printf("compression_bench: %d payloads through the publish path decoded intact (%d compressed, %d escaped, "
+           "%d raw on compression topics, %d unchanged on other topics)\n", CASE_COUNT, compressed, escaped,
+           CASE_COUNT - compressed - escaped - unchanged, unchanged);
+    CHECK(compressed == 2);
+    CHECK(escaped == 3);
+    CHECK(unchanged == 2);
+    printf("compression_bench: PASS\n");
+    hostExit(0);
+}
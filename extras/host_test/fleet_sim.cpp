@@ -0,0 +1,276 @@
+// Fleet simulator: N library instances with their own device and client ids and synthetic
+// telemetry, booted at staggered times over a boot window against one broker. After a
+// steady phase the broker is stopped and restarted on a script, and the reconnect storm is
+// measured. Reports aggregate messages/sec, reconnect counts and time to reconnect, and the
+// memory footprint of each device.
+//
+// Fails if any session is taken over (two instances using one client id), if an instance
+// drops its connection outside an outage, reconnects more than once per outage or takes
+// longer than one retry delay (plus margin) to reconnect, if the telemetry rate falls short
+// of the registered intervals, or if a device's messages or command responses carry
+// another device's id.
+//
+// Usage: fleet_sim [devices] [seconds] [host:port]
+//   Without host:port the in-process broker is used, which also checks the traffic itself
+//   and runs the scripted outages. With host:port (e.g. a local mosquitto) only the boot,
+//   connection and rate checks apply.
+#include "host_test.h"
+#include <cmath>
+#include <numeric>
+#include <random>
+#include <set>
+
+static const int BOOT_WINDOW_MS = 2000;
+static const double RETRY_DELAY_S = 2.0;  // MQTT_RETRY_DELAY_MS in ESPRazorBlade.cpp
+
+// Scripted broker outages, run one after the other once the steady phase is over
+struct Outage {
+    int downMs;
+};
+static const Outage OUTAGES[] = {
+    {500},   // Shorter than one retry delay
+    {2500},  // Spans a failed retry
+};
+static const int OUTAGE_COUNT = sizeof(OUTAGES) / sizeof(OUTAGES[0]);
+
+// Synthetic telemetry: every device registers the same three metrics
+static std::atomic<long> samples{0};
+static void readTemperature(char* buffer, size_t size) {
+    thread_local std::mt19937 random(std::hash<std::thread::id>()(std::this_thread::get_id()));
+    snprintf(buffer, size, "%.2f", 21.0 + 3.0 * sin(hostSeconds() / 60.0) + (random() % 100) / 100.0);
+    samples++;
+}
+static void readHumidity(char* buffer, size_t size) {
+    thread_local std::mt19937 random(std::hash<std::thread::id>()(std::this_thread::get_id()) + 1);
+    snprintf(buffer, size, "%.1f", 45.0 + (random() % 200) / 10.0);
+    samples++;
+}
+static void readUptimeCounter(char* buffer, size_t size) {
+    snprintf(buffer, size, "%ld", (long)(hostSeconds() * 1000) % 100000000L);
+    samples++;
+}
+struct Metric {
+    const char* name;
+    TelemetryBufferCallback callback;
+    unsigned long intervalMs;
+};
+static const Metric METRICS[] = {
+    {"temperature", readTemperature, 250},
+    {"humidity", readHumidity, 500},
+    {"counter", readUptimeCounter, 1000},
+};
+
+// Connection state of every device, sampled every 10 ms
+struct Monitor {
+    std::mutex lock;
+    std::vector<bool> connected;
+    std::vector<int> disconnects;
+    std::vector<int> reconnects;
+    std::vector<double> connectedAt;  // Last false -> true transition
+    std::atomic<bool> running{true};
+};
+
+int main(int argc, char** argv) {
+    int devices = argc > 1 ? atoi(argv[1]) : 20;
+    int seconds = argc > 2 ? atoi(argv[2]) : 3;
+    bool external = argc > 3;
+
+    static HostBroker broker;
+    uint16_t brokerPort = 0;
+    std::mutex lock;
+    std::map<std::string, std::set<std::string>> topicsByClient;
+    if (external) {
+        std::string address = argv[3];
+        size_t colon = address.rfind(':');
+        hostSetBroker(address.substr(0, colon).c_str(), colon == std::string::npos ? 1883 : atoi(address.c_str() + colon + 1));
+    } else {
+        brokerPort = broker.start();
+        hostSetBroker("127.0.0.1", brokerPort);
+        broker.onPublish([&](const std::string& clientId, const std::string& topic, const std::string& payload) {
+            std::lock_guard<std::mutex> guard(lock);
+            topicsByClient[clientId].insert(topic);
+        });
+    }
+
+    // Staggered boots: begin() calls at random offsets over the boot window
+    std::mt19937 random(28);
+    std::vector<int> bootOffsets;
+    for (int d = 0; d < devices; d++) {
+        bootOffsets.push_back((int)(random() % BOOT_WINDOW_MS));
+    }
+    std::sort(bootOffsets.begin(), bootOffsets.end());
+    std::vector<ESPRazorBlade*> fleet;
+    double bootStart = hostSeconds();
+    for (int d = 0; d < devices; d++) {
+        char id[24];
+        snprintf(id, sizeof(id), "fleet-%03d", d);
+        fleet.push_back(new ESPRazorBlade(id));
+        for (const Metric& metric : METRICS) {
+            CHECK(fleet.back()->registerTelemetry((std::string(id) + "/telemetry/" + metric.name).c_str(),
+                                                  metric.callback, metric.intervalMs));
+        }
+        std::this_thread::sleep_until(std::chrono::steady_clock::now() +
+                                      std::chrono::duration<double>(bootStart + bootOffsets[d] / 1e3 - hostSeconds()));
+        CHECK(fleet.back()->begin());
+    }
+    CHECK(hostWaitFor([&] {
+        for (auto* rb : fleet) {
+            if (!rb->isMQTTConnected() || !rb->configTopicsSubscribed || !rb->configTimeoutsPublished) {
+                return false;
+            }
+        }
+        return true;
+    }, 20000));
+    printf("fleet_sim: %d devices booted over %d ms, all connected %.1f s after the first begin()\n", devices,
+           BOOT_WINDOW_MS, hostSeconds() - bootStart);
+
+    static Monitor monitor;
+    monitor.connected.assign(devices, true);
+    monitor.disconnects.assign(devices, 0);
+    monitor.reconnects.assign(devices, 0);
+    monitor.connectedAt.assign(devices, 0);
+    std::thread sampler([&] {
+        while (monitor.running) {
+            double now = hostSeconds();
+            {
+                std::lock_guard<std::mutex> guard(monitor.lock);
+                for (int d = 0; d < devices; d++) {
+                    bool connected = fleet[d]->isMQTTConnected();
+                    if (connected != monitor.connected[d]) {
+                        (connected ? monitor.reconnects : monitor.disconnects)[d]++;
+                        if (connected) {
+                            monitor.connectedAt[d] = now;
+                        }
+                        monitor.connected[d] = connected;
+                    }
+                }
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    });
+
+    // Each device answers reads on its own command topic only
+    if (!external) {
+        for (auto* rb : fleet) {
+            broker.publish(std::string(rb->getDeviceId()) + "/cmd/read/wifi_rssi", "fleet");
+        }
+    }
+
+    // Steady phase: aggregate message rate, and no instance may drop its connection
+    long samplesBefore = samples;
+    long publishesBefore = broker.publishesReceived();
+    double steadyStart = hostSeconds();
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    double steadyElapsed = hostSeconds() - steadyStart;
+    double sampleRate = (samples - samplesBefore) / steadyElapsed;
+    double expectedRate = 0;
+    for (const Metric& metric : METRICS) {
+        expectedRate += devices * 1000.0 / metric.intervalMs;
+    }
+    long drops;
+    {
+        std::lock_guard<std::mutex> guard(monitor.lock);
+        drops = std::accumulate(monitor.disconnects.begin(), monitor.disconnects.end(), 0L);
+    }
+    if (external) {
+        printf("fleet_sim: steady %d s: %.0f telemetry samples/s (registered intervals give %.0f/s), "
+               "%ld disconnects\n", seconds, sampleRate, expectedRate, drops);
+    } else {
+        printf("fleet_sim: steady %d s: %.0f messages/s at the broker, %.0f telemetry samples/s (registered "
+               "intervals give %.0f/s), %ld disconnects\n", seconds,
+               (broker.publishesReceived() - publishesBefore) / steadyElapsed, sampleRate, expectedRate, drops);
+    }
+    CHECK(drops == 0);
+    CHECK(sampleRate > 0.8 * expectedRate);
+
+    // Scripted outages: stop the broker, restart it on the same port, time the reconnect storm
+    for (int o = 0; o < OUTAGE_COUNT && !external; o++) {
+        long connectsBefore = broker.connectsReceived();
+        broker.stop();
+        CHECK(hostWaitFor([&] {
+            std::lock_guard<std::mutex> guard(monitor.lock);
+            return std::count(monitor.connected.begin(), monitor.connected.end(), true) == 0;
+        }, 5000));
+        std::this_thread::sleep_for(std::chrono::milliseconds(OUTAGES[o].downMs));
+        CHECK(broker.start(brokerPort) == brokerPort);
+        double restartedAt = hostSeconds();
+        CHECK(hostWaitFor([&] {
+            std::lock_guard<std::mutex> guard(monitor.lock);
+            return std::count(monitor.connected.begin(), monitor.connected.end(), false) == 0;
+        }, 10000));
+
+        std::vector<double> reconnectTimes;
+        std::map<long, int> perWindow;  // 100 ms window after the restart -> reconnects
+        {
+            std::lock_guard<std::mutex> guard(monitor.lock);
+            for (int d = 0; d < devices; d++) {
+                double delay = monitor.connectedAt[d] - restartedAt;
+                reconnectTimes.push_back(delay * 1e3);
+                perWindow[(long)(delay * 10)]++;
+            }
+        }
+        int peak = 0;
+        for (auto& window : perWindow) {
+            peak = std::max(peak, window.second);
+        }
+        long connects = broker.connectsReceived() - connectsBefore;
+        printf("fleet_sim: outage %d (%d ms): %ld CONNECTs for %d devices, time to reconnect p50 %.0f ms, "
+               "max %.0f ms, peak %d reconnects per 100 ms\n", o + 1, OUTAGES[o].downMs, connects, devices,
+               hostPercentile(reconnectTimes, 50), hostPercentile(reconnectTimes, 100), peak);
+        CHECK(connects == devices);
+        CHECK(hostPercentile(reconnectTimes, 100) < (RETRY_DELAY_S + 1.0) * 1e3);
+        CHECK(hostWaitFor([&] {
+            for (auto* rb : fleet) {
+                if (!rb->configTopicsSubscribed) {
+                    return false;
+                }
+            }
+            return true;
+        }, 5000));
+    }
+    monitor.running = false;
+    sampler.join();
+    if (!external) {
+        std::lock_guard<std::mutex> guard(monitor.lock);
+        for (int d = 0; d < devices; d++) {
+            CHECK(monitor.disconnects[d] == OUTAGE_COUNT);  // One drop and one reconnect per outage
+            CHECK(monitor.reconnects[d] == OUTAGE_COUNT);
+        }
+    }
+
+    // Memory per device
+    size_t totalFootprint = 0;
+    for (int d = 0; d < devices; d++) {
+        if (d % 5 == 0) {
+            printf("fleet_sim: memory");
+        }
+        size_t footprint = fleet[d]->getMemoryFootprint();
+        totalFootprint += footprint;
+        printf(" %s %zu B%s", fleet[d]->getDeviceId(), footprint, d % 5 == 4 || d == devices - 1 ? "\n" : ",");
+    }
+    printf("fleet_sim: memory total %zu B for %d devices\n", totalFootprint, devices);
+
+    if (!external) {
+        std::lock_guard<std::mutex> guard(lock);
+        long foreign = 0;
+        for (auto* rb : fleet) {
+            std::string id = rb->getDeviceId();
+            auto& topics = topicsByClient[id];
+            for (auto& topic : topics) {
+                foreign += topic.compare(0, id.size() + 1, id + "/") == 0 ? 0 : 1;
+            }
+            CHECK(topics.count(id + "/status") == 1);
+            CHECK(topics.count(id + "/telemetry/wifi_rssi") == 1);
+            CHECK(topics.count(id + "/telemetry/temperature") == 1);
+            CHECK(topics.count(id + "/cmd/response/wifi_rssi/fleet") == 1);
+        }
+        printf("fleet_sim: %d clients connected, %ld takeovers, %ld publishes, %ld topics outside the sender's prefix\n",
+               broker.connectedClients(), broker.takeovers(), broker.publishesReceived(), foreign);
+        CHECK(broker.connectedClients() == devices);
+        CHECK(broker.takeovers() == 0);
+        CHECK(foreign == 0);
+        CHECK((int)topicsByClient.size() == devices);
+    }
+    printf("fleet_sim: PASS\n");
+    hostExit(0);
+}
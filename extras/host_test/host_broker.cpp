@@ -0,0 +1,344 @@
+#include "host_broker.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+bool readFully(int fd, uint8_t* buffer, size_t size) {
+    size_t got = 0;
+    while (got < size) {
+        ssize_t n = recv(fd, buffer + got, size - got, 0);
+        if (n <= 0) {
+            return false;
+        }
+        got += (size_t)n;
+    }
+    return true;
+}
+
+std::string readString(const std::string& body, size_t& pos) {
+    if (pos + 2 > body.size()) {
+        pos = body.size() + 1;
+        return std::string();
+    }
+    size_t length = ((uint8_t)body[pos] << 8) | (uint8_t)body[pos + 1];
+    std::string s = body.substr(pos + 2, length);
+    pos += 2 + length;
+    return s;
+}
+
+void appendString(std::string& out, const std::string& s) {
+    out += (char)(s.size() >> 8);
+    out += (char)(s.size() & 0xFF);
+    out += s;
+}
+
+std::string publishBody(const std::string& topic, const std::string& payload) {
+    std::string body;
+    appendString(body, topic);
+    body += payload;
+    return body;
+}
+
+}  // namespace
+
+HostBroker::~HostBroker() {
+    stop();
+}
+
+uint16_t HostBroker::start(uint16_t port) {
+    listenFd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int one = 1;
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(listenFd, (const sockaddr*)&address, sizeof(address)) != 0 || listen(listenFd, 64) != 0) {
+        close(listenFd);
+        listenFd = -1;
+        return 0;
+    }
+    socklen_t length = sizeof(address);
+    getsockname(listenFd, (sockaddr*)&address, &length);
+    listenPort = ntohs(address.sin_port);
+    running = true;
+    acceptThread = std::thread(&HostBroker::acceptLoop, this);
+    return listenPort;
+}
+
+void HostBroker::stop() {
+    if (!running.exchange(false)) {
+        return;
+    }
+    shutdown(listenFd, SHUT_RDWR);
+    close(listenFd);
+    acceptThread.join();
+    std::lock_guard<std::mutex> guard(lock);
+    for (auto& session : sessions) {
+        session->open = false;
+        shutdown(session->fd, SHUT_RDWR);
+    }
+    sessions.clear();
+}
+
+void HostBroker::onPublish(PublishHook publishHook) {
+    std::lock_guard<std::mutex> guard(lock);
+    hook = publishHook;
+}
+
+void HostBroker::setDropFilter(const std::string& filter) {
+    std::lock_guard<std::mutex> guard(lock);
+    dropFilter = filter;
+}
+
+void HostBroker::acceptLoop() {
+    while (running) {
+        int fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            continue;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        auto session = std::make_shared<Session>();
+        session->fd = fd;
+        std::thread(&HostBroker::serve, this, session).detach();
+    }
+}
+
+bool HostBroker::sendFrame(Session& session, uint8_t type, const std::string& body) {
+    std::string frame(1, (char)type);
+    size_t length = body.size();
+    do {
+        uint8_t digit = length % 128;
+        length /= 128;
+        frame += (char)(length > 0 ? digit | 0x80 : digit);
+    } while (length > 0);
+    frame += body;
+    std::lock_guard<std::mutex> guard(session.writeLock);
+    return session.open && send(session.fd, frame.data(), frame.size(), MSG_NOSIGNAL) == (ssize_t)frame.size();
+}
+
+void HostBroker::serve(std::shared_ptr<Session> session) {
+    while (session->open && running) {
+        uint8_t type;
+        if (!readFully(session->fd, &type, 1)) {
+            break;
+        }
+        size_t length = 0;
+        size_t multiplier = 1;
+        uint8_t digit;
+        do {
+            if (!readFully(session->fd, &digit, 1)) {
+                session->open = false;
+                break;
+            }
+            length += (digit & 0x7F) * multiplier;
+            multiplier *= 128;
+        } while (digit & 0x80);
+        std::string body(length, '\0');
+        if (!session->open || !readFully(session->fd, (uint8_t*)&body[0], length)) {
+            break;
+        }
+        receivedBytes += (long)(2 + length);
+        if (blackhole) {
+            continue;
+        }
+
+        size_t pos = 0;
+        switch (type & 0xF0) {
+            case 0x10: {  // CONNECT
+                pos = 10;  // Protocol name, level, flags, keepalive
+                session->clientId = readString(body, pos);
+                connectCount++;
+                std::vector<std::shared_ptr<Session>> replaced;
+                {
+                    std::lock_guard<std::mutex> guard(lock);
+                    for (auto& other : sessions) {
+                        if (other->clientId == session->clientId) {
+                            replaced.push_back(other);
+                        }
+                    }
+                    sessions.erase(std::remove_if(sessions.begin(), sessions.end(),
+                                                  [&](const std::shared_ptr<Session>& s) { return s->clientId == session->clientId; }),
+                                   sessions.end());
+                    sessions.push_back(session);
+                }
+                for (auto& other : replaced) {
+                    sessionTakeovers++;
+                    other->open = false;
+                    shutdown(other->fd, SHUT_RDWR);
+                }
+                sendFrame(*session, 0x20, std::string("\0\0", 2));
+                break;
+            }
+            case 0x30: {  // PUBLISH (QoS 0)
+                std::string topic = readString(body, pos);
+                if (((type >> 1) & 0x03) > 0) {
+                    pos += 2;
+                }
+                std::string payload = pos <= body.size() ? body.substr(pos) : std::string();
+                publishCount++;
+                PublishHook publishHook;
+                bool dropped;
+                {
+                    std::lock_guard<std::mutex> guard(lock);
+                    publishHook = hook;
+                    dropped = !dropFilter.empty() && topicMatches(dropFilter, topic);
+                }
+                if (publishHook) {
+                    publishHook(session->clientId, topic, payload);
+                }
+                if (!dropped) {
+                    route(topic, payload, (type & 0x01) != 0);
+                }
+                break;
+            }
+            case 0x80: {  // SUBSCRIBE
+                std::string ack = body.substr(0, 2);
+                pos = 2;
+                std::vector<std::string> added;
+                while (pos < body.size()) {
+                    std::string filter = readString(body, pos);
+                    pos++;  // Requested QoS
+                    added.push_back(filter);
+                    ack += '\0';
+                }
+                std::vector<std::pair<std::string, std::string>> matches;
+                {
+                    std::lock_guard<std::mutex> guard(lock);
+                    for (auto& filter : added) {
+                        if (std::find(session->filters.begin(), session->filters.end(), filter) == session->filters.end()) {
+                            session->filters.push_back(filter);
+                        }
+                        for (auto& message : retained) {
+                            if (topicMatches(filter, message.first)) {
+                                matches.push_back(message);
+                            }
+                        }
+                    }
+                }
+                sendFrame(*session, 0x90, ack);
+                for (auto& message : matches) {
+                    sendFrame(*session, 0x31, publishBody(message.first, message.second));
+                }
+                break;
+            }
+            case 0xA0: {  // UNSUBSCRIBE
+                pos = 2;
+                std::lock_guard<std::mutex> guard(lock);
+                while (pos < body.size()) {
+                    std::string filter = readString(body, pos);
+                    session->filters.erase(std::remove(session->filters.begin(), session->filters.end(), filter),
+                                           session->filters.end());
+                }
+                sendFrame(*session, 0xB0, body.substr(0, 2));
+                break;
+            }
+            case 0xC0:  // PINGREQ
+                sendFrame(*session, 0xD0, std::string());
+                break;
+            case 0xE0:  // DISCONNECT
+                session->open = false;
+                break;
+            default:
+                break;
+        }
+    }
+
+    session->open = false;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        sessions.erase(std::remove(sessions.begin(), sessions.end(), session), sessions.end());
+    }
+    std::lock_guard<std::mutex> guard(session->writeLock);
+    close(session->fd);
+}
+
+void HostBroker::route(const std::string& topic, const std::string& payload, bool retain) {
+    std::vector<std::shared_ptr<Session>> targets;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (retain) {
+            if (payload.empty()) {
+                retained.erase(topic);
+            } else {
+                retained[topic] = payload;
+            }
+        }
+        for (auto& session : sessions) {
+            for (auto& filter : session->filters) {
+                if (topicMatches(filter, topic)) {
+                    targets.push_back(session);
+                    break;
+                }
+            }
+        }
+    }
+    std::string body = publishBody(topic, payload);
+    for (auto& session : targets) {
+        sendFrame(*session, 0x30, body);
+    }
+}
+
+void HostBroker::publish(const std::string& topic, const std::string& payload, bool retain) {
+    route(topic, payload, retain);
+}
+
+int HostBroker::connectedClients() {
+    std::lock_guard<std::mutex> guard(lock);
+    return (int)sessions.size();
+}
+
+std::vector<std::string> HostBroker::clientIds() {
+    std::lock_guard<std::mutex> guard(lock);
+    std::vector<std::string> ids;
+    for (auto& session : sessions) {
+        ids.push_back(session->clientId);
+    }
+    return ids;
+}
+
+bool HostBroker::isRetained(const std::string& topic) {
+    std::lock_guard<std::mutex> guard(lock);
+    return retained.count(topic) > 0;
+}
+
+bool HostBroker::topicMatches(const std::string& filter, const std::string& topic) {
+    if (!topic.empty() && topic[0] == '$' && !filter.empty() && (filter[0] == '+' || filter[0] == '#')) {
+        return false;
+    }
+    size_t f = 0;
+    size_t t = 0;
+    while (true) {
+        size_t fEnd = filter.find('/', f);
+        if (fEnd == std::string::npos) {
+            fEnd = filter.size();
+        }
+        std::string level = filter.substr(f, fEnd - f);
+        if (level == "#") {
+            return true;
+        }
+        if (t > topic.size()) {
+            return false;
+        }
+        size_t tEnd = topic.find('/', t);
+        if (tEnd == std::string::npos) {
+            tEnd = topic.size();
+        }
+        if (level != "+" && level != topic.substr(t, tEnd - t)) {
+            return false;
+        }
+        bool filterDone = fEnd == filter.size();
+        bool topicDone = tEnd == topic.size();
+        if (filterDone || topicDone) {
+            return (filterDone && topicDone) || (topicDone && filter.compare(fEnd, std::string::npos, "/#") == 0);
+        }
+        f = fEnd + 1;
+        t = tEnd + 1;
+    }
+}
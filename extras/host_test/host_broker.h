@@ -0,0 +1,72 @@
+// Minimal in-process MQTT 3.1.1 broker for the host tests: QoS 0, clean sessions,
+// retained messages, + and # wildcards. A client connecting with an id already in use
+// takes the session over and the old connection is closed, as on real brokers
+#ifndef HOST_BROKER_H
+#define HOST_BROKER_H
+
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class HostBroker {
+public:
+    // Called for every PUBLISH the broker receives (clientId is the sender)
+    typedef std::function<void(const std::string& clientId, const std::string& topic, const std::string& payload)> PublishHook;
+
+    ~HostBroker();
+    uint16_t start(uint16_t port = 0);  // Returns the listening port (0 = pick a free one)
+    void stop();
+    uint16_t port() const { return listenPort; }
+
+    void onPublish(PublishHook hook);
+    void publish(const std::string& topic, const std::string& payload, bool retain = false);  // As if from a client
+    void setBlackhole(bool enabled) { blackhole = enabled; }  // Keep connections open, drop all traffic
+    void setDropFilter(const std::string& filter);  // Receive but do not route matching publishes ("" = none)
+
+    int connectedClients();
+    std::vector<std::string> clientIds();
+    long takeovers() const { return sessionTakeovers; }
+    long connectsReceived() const { return connectCount; }
+    long publishesReceived() const { return publishCount; }
+    long bytesReceived() const { return receivedBytes; }
+    bool isRetained(const std::string& topic);
+
+    static bool topicMatches(const std::string& filter, const std::string& topic);
+
+private:
+    struct Session {
+        int fd = -1;
+        std::string clientId;
+        std::vector<std::string> filters;
+        std::mutex writeLock;
+        std::atomic<bool> open{true};
+    };
+
+    void acceptLoop();
+    void serve(std::shared_ptr<Session> session);
+    void route(const std::string& topic, const std::string& payload, bool retain);
+    static bool sendFrame(Session& session, uint8_t type, const std::string& body);
+
+    int listenFd = -1;
+    uint16_t listenPort = 0;
+    std::atomic<bool> running{false};
+    std::atomic<bool> blackhole{false};
+    std::thread acceptThread;
+    std::mutex lock;
+    std::vector<std::shared_ptr<Session>> sessions;
+    std::map<std::string, std::string> retained;
+    std::string dropFilter;
+    PublishHook hook;
+    std::atomic<long> sessionTakeovers{0};
+    std::atomic<long> connectCount{0};
+    std::atomic<long> publishCount{0};
+    std::atomic<long> receivedBytes{0};
+};
+
+#endif // HOST_BROKER_H
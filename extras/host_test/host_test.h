@@ -0,0 +1,93 @@
+// Shared helpers for the host tests (see README.md)
+#ifndef HOST_TEST_H
+#define HOST_TEST_H
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <WiFiUdp.h>
+#include <ArduinoMqttClient.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_system.h"
+#include "lwip/sockets.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "host_broker.h"
+
+// White-box tests reach into the library's private state
+#define private public
+#include "ESPRazorBlade.h"
+#undef private
+
+// Flushes output and leaves without running destructors (library tasks are detached threads)
+inline void hostExit(int code) {
+    fflush(stdout);
+    fflush(stderr);
+    _exit(code);
+}
+
+#define CHECK(condition)                                                                   \
+    do {                                                                                   \
+        if (!(condition)) {                                                                \
+            fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #condition);  \
+            hostExit(1);                                                                   \
+        }                                                                                  \
+    } while (0)
+
+inline double hostSeconds() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Percentile of a sample set (sorts it)
+inline double hostPercentile(std::vector<double>& samples, double percentile) {
+    if (samples.empty()) {
+        return 0;
+    }
+    std::sort(samples.begin(), samples.end());
+    size_t index = (size_t)(percentile / 100.0 * (samples.size() - 1) + 0.5);
+    return samples[index];
+}
+
+// Makes the calling thread the instance's MQTT task without begin(): creates the mutexes
+// and connects the instance's client to the configured broker. White-box tests then drive
+// the scheduler functions directly from this thread
+inline bool hostAttachMqttTask(ESPRazorBlade& rb) {
+    rb.mqttMutex = xSemaphoreCreateMutex();
+    rb.queueMutex = xSemaphoreCreateMutex();
+    rb.sampleMutex = xSemaphoreCreateMutex();
+    rb.subscriptionMutex = xSemaphoreCreateMutex();
+    rb.mqttTaskHandle = xTaskGetCurrentTaskHandle();
+    rb.openWakeSocket();
+    rb.wifiConnected = true;
+#ifdef MQTT_BROKER
+    rb.mqttClient.setId(rb.clientId);
+    if (!rb.mqttClient.connect(MQTT_BROKER, MQTT_PORT)) {
+        return false;
+    }
+    rb.mqttConnected = true;
+#endif
+    return true;
+}
+
+// Polls a condition until it holds or the timeout expires
+inline bool hostWaitFor(const std::function<bool()>& condition, unsigned long timeoutMs) {
+    unsigned long start = millis();
+    while (!condition()) {
+        if (millis() - start >= timeoutMs) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+#endif // HOST_TEST_H
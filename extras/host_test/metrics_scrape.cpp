@@ -0,0 +1,161 @@
+// Metrics endpoint test: scrape latency while the MQTT task publishes telemetry flat out and
+// idle connections hold some of the client slots, then scrapes while the broker is down.
+// Fails if a scrape fails or waits for an idle client's timeout, if an idle client keeps its
+// slot past HTTP_REQUEST_TIMEOUT_MS, or if the sample cache stops updating without a broker.
+//
+// Built with HOST_METRICS_HTTP (METRICS_HTTP_PORT set at run time) and the default
+// METRICS_HTTP_MAX_CLIENTS of 4.
+//
+// Usage: metrics_scrape [seconds]
+#include "host_test.h"
+
+static std::atomic<long> counter{0};
+static void readCounter(char* buffer, size_t size) {
+    snprintf(buffer, size, "%ld", ++counter);
+}
+static void readLoad(char* buffer, size_t size) {
+    snprintf(buffer, size, "%ld", counter.load());
+}
+
+static int connectTo(uint16_t port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    if (connect(fd, (sockaddr*)&address, sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+    timeval timeout = {5, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    return fd;
+}
+
+// One GET /metrics; returns the response, empty on failure
+static std::string scrape(uint16_t port) {
+    int fd = connectTo(port);
+    if (fd < 0) {
+        return std::string();
+    }
+    const char request[] = "GET /metrics HTTP/1.1\r\nHost: device\r\n\r\n";
+    std::string response;
+    if (send(fd, request, sizeof(request) - 1, 0) == (ssize_t)(sizeof(request) - 1)) {
+        char buffer[1024];
+        ssize_t n;
+        while ((n = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+            response.append(buffer, n);
+        }
+    }
+    close(fd);
+    return response.compare(0, 15, "HTTP/1.1 200 OK") == 0 ? response : std::string();
+}
+
+static long counterValue(const std::string& response) {
+    size_t pos = response.find("esprazorblade_telemetry_counter{device=\"host-device\"} ");
+    return pos == std::string::npos ? -1 : atol(response.c_str() + response.find("} ", pos) + 2);
+}
+
+static uint16_t freePort() {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    bind(fd, (sockaddr*)&address, sizeof(address));
+    getsockname(fd, (sockaddr*)&address, &length);
+    close(fd);
+    return ntohs(address.sin_port);
+}
+
+int main(int argc, char** argv) {
+    int seconds = argc > 1 ? atoi(argv[1]) : 3;
+    static HostBroker broker;
+    hostSetBroker("127.0.0.1", broker.start());
+    uint16_t port = freePort();
+    hostSetMetricsPort(port);
+
+    static ESPRazorBlade rb;
+    CHECK(rb.registerTelemetry("host-device/telemetry/counter", readCounter, 20));
+    for (int i = 0; i < 5; i++) {
+        CHECK(rb.registerTelemetry(("host-device/telemetry/load" + std::to_string(i)).c_str(), readLoad, 1));
+    }
+    rb.begin();
+    CHECK(hostWaitFor([&] { return rb.isMQTTConnected() && !scrape(port).empty(); }, 10000));
+
+    // Two connections that never send a request hold two of the four slots
+    int idle[2] = {connectTo(port), connectTo(port)};
+    CHECK(idle[0] >= 0 && idle[1] >= 0);
+    double idleSince = hostSeconds();
+
+    // Scrapers and a publisher run against the telemetry load
+    std::atomic<bool> running{true};
+    std::mutex lock;
+    std::vector<double> latencies;
+    std::atomic<long> failures{0};
+    auto scraper = [&] {
+        while (running) {
+            double start = hostSeconds();
+            bool ok = counterValue(scrape(port)) > 0;
+            double latency = (hostSeconds() - start) * 1e3;
+            failures += ok ? 0 : 1;
+            std::lock_guard<std::mutex> guard(lock);
+            latencies.push_back(latency);
+        }
+    };
+    std::thread scraperA(scraper);
+    std::thread scraperB(scraper);
+    std::thread publisher([&] {
+        for (long n = 0; running; n++) {
+            rb.publish("host-device/app/load", n);
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+    });
+
+    // The device drops the idle connections after HTTP_REQUEST_TIMEOUT_MS
+    double idleClosed[2] = {0, 0};
+    for (int i = 0; i < 2; i++) {
+        char byte;
+        ssize_t n = recv(idle[i], &byte, 1, 0);
+        idleClosed[i] = n == 0 ? hostSeconds() - idleSince : -1;
+        close(idle[i]);
+    }
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    running = false;
+    scraperA.join();
+    scraperB.join();
+    publisher.join();
+
+    double p50;
+    double p99;
+    double worst;
+    size_t scrapes;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        scrapes = latencies.size();
+        p50 = hostPercentile(latencies, 50);
+        p99 = hostPercentile(latencies, 99);
+        worst = hostPercentile(latencies, 100);
+    }
+    printf("metrics_scrape: %zu scrapes under load with 2 idle connections: p50 %.1f ms, p99 %.1f ms, max %.1f ms, "
+           "%ld failed\n", scrapes, p50, p99, worst, failures.load());
+    printf("metrics_scrape: idle connections closed after %.0f ms and %.0f ms\n", idleClosed[0] * 1e3, idleClosed[1] * 1e3);
+    CHECK(failures == 0);
+    CHECK(scrapes > 20);
+    CHECK(worst < 400);  // Never queued behind an idle client's request timeout
+    for (int i = 0; i < 2; i++) {
+        CHECK(idleClosed[i] > 0.3 && idleClosed[i] < 1.5);
+    }
+
+    // Broker down: the MQTT task keeps sampling into the cache
+    broker.stop();
+    CHECK(hostWaitFor([&] { return !rb.isMQTTConnected(); }, 5000));
+    long before = counterValue(scrape(port));
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    long after = counterValue(scrape(port));
+    printf("metrics_scrape: broker down, counter metric %ld -> %ld over 500 ms\n", before, after);
+    CHECK(before > 0);
+    CHECK(after > before);
+    printf("metrics_scrape: PASS\n");
+    hostExit(0);
+}
@@ -0,0 +1,92 @@
+// Broker probe reconnect test. First the broker delays probe echoes past MQTT_PROBE_MAX_RTT_MS,
+// so the failures are detected in the message callback. Then it silently drops the probe
+// echoes, and later all traffic while keeping the connection open (a blackholed path), so
+// no echo ever arrives and the failures come from MQTT_PROBE_TIMEOUT_MS. Fails if the MQTT
+// client is stopped from inside the callback, if an unanswered probe does not force a
+// reconnect within MQTT_PROBE_MAX_FAILURES probe cycles (interval plus timeout each, far
+// below the keepalive), if the instance does not reconnect, or if a new session does not
+// get its subscriptions and probes back.
+//
+// Built with MQTT_PROBE_INTERVAL_MS=100, MQTT_PROBE_MAX_RTT_MS=20, MQTT_PROBE_TIMEOUT_MS=300
+// and MQTT_PROBE_MAX_FAILURES=2.
+//
+// Usage: probe_reconnect
+#include "host_test.h"
+
+static const unsigned long KEEPALIVE_MS = 60000;  // MQTT_KEEPALIVE_MS in ESPRazorBlade.cpp
+
+// Longest a silently dead connection may stay up: every failed probe waits out at most one
+// interval before it is sent and the timeout after, plus scheduling margin
+static const unsigned long DETECT_BOUND_MS =
+    MQTT_PROBE_MAX_FAILURES * (MQTT_PROBE_INTERVAL_MS + MQTT_PROBE_TIMEOUT_MS) + 500;
+
+static void readTemperature(char* buffer, size_t size) {
+    snprintf(buffer, size, "21.5");
+}
+
+int main(int argc, char** argv) {
+    static HostBroker broker;
+    hostSetBroker("127.0.0.1", broker.start());
+    std::atomic<bool> slowEchoes{false};
+    std::atomic<long> responses{0};
+    broker.onPublish([&](const std::string& clientId, const std::string& topic, const std::string& payload) {
+        if (topic == "host-device/probe" && slowEchoes) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(60));  // Routed (echoed) after the hook
+        }
+        if (topic == "host-device/cmd/response/temperature/probe-test") {
+            responses++;
+        }
+    });
+
+    static ESPRazorBlade rb;
+    CHECK(rb.registerTelemetry("host-device/telemetry/temperature", readTemperature, 600000));
+    rb.begin();
+    CHECK(hostWaitFor([&] { return rb.isMQTTConnected() && rb.configTopicsSubscribed && rb.getBrokerRTT() >= 0; }, 10000));
+
+    // Slow echoes: the instance gives up on the connection and reconnects
+    slowEchoes = true;
+    CHECK(hostWaitFor([&] { return !rb.isMQTTConnected(); }, 5000));
+    slowEchoes = false;
+    CHECK(hostWaitFor([&] { return rb.isMQTTConnected() && rb.configTopicsSubscribed; }, 10000));
+    printf("probe_reconnect: reconnected after slow probes, %ld stop() calls from inside the message callback\n",
+           rb.mqttClient.stopsInCallback());
+    CHECK(rb.mqttClient.stopsInCallback() == 0);
+
+    // The new session answers commands and probes again
+    broker.publish("host-device/cmd/read/temperature", "probe-test");
+    CHECK(hostWaitFor([&] { return responses == 1; }, 5000));
+    long rttBefore = rb.getBrokerRTT();
+    CHECK(hostWaitFor([&] { return rb.probeFailures == 0 && rb.getBrokerRTT() < 20; }, 5000));
+    printf("probe_reconnect: new session answered a read, broker RTT %ld ms (was %ld ms)\n", rb.getBrokerRTT(), rttBefore);
+
+    // Silent loss: no echo ever arrives, so only the probe timeout can notice. Returns how
+    // long the connection stayed up after the loss started
+    auto timeToDrop = [&](const char* what, const std::function<void(bool)>& lose) {
+        long connectsBefore = broker.connectsReceived();
+        double start = hostSeconds();
+        lose(true);
+        CHECK(hostWaitFor([&] { return !rb.isMQTTConnected(); }, KEEPALIVE_MS / 2));
+        double elapsedMs = (hostSeconds() - start) * 1e3;
+        lose(false);
+        CHECK(hostWaitFor([&] { return rb.isMQTTConnected() && rb.configTopicsSubscribed; }, 20000));
+        CHECK(hostWaitFor([&] { return rb.probeFailures == 0 && rb.getBrokerRTT() >= 0 && rb.getBrokerRTT() < 20; }, 5000));
+        printf("probe_reconnect: %s: reconnect forced after %.0f ms (bound %lu ms, keepalive %lu ms), "
+               "%ld CONNECTs until the new session\n", what, elapsedMs, DETECT_BOUND_MS, KEEPALIVE_MS,
+               broker.connectsReceived() - connectsBefore);
+        return elapsedMs;
+    };
+    double echoesDropped = timeToDrop("probe echoes dropped", [&](bool lost) {
+        broker.setDropFilter(lost ? "host-device/probe" : "");
+    });
+    CHECK(echoesDropped >= MQTT_PROBE_TIMEOUT_MS);  // Detected by the timeout, not by a slow echo
+    CHECK(echoesDropped < DETECT_BOUND_MS);
+    CHECK(broker.connectedClients() == 1);
+
+    double blackholed = timeToDrop("all traffic blackholed", [&](bool lost) { broker.setBlackhole(lost); });
+    CHECK(blackholed >= MQTT_PROBE_TIMEOUT_MS);
+    CHECK(blackholed < DETECT_BOUND_MS);
+    CHECK(DETECT_BOUND_MS < KEEPALIVE_MS / 10);  // Well before keepalive expiry would notice
+    CHECK(rb.mqttClient.stopsInCallback() == 0);
+    printf("probe_reconnect: PASS\n");
+    hostExit(0);
+}
@@ -0,0 +1,169 @@
+// Outbound queue test: FIFO integrity of the per-class byte rings (including payloads
+// longer than the old fixed 127-character slots), bulk shedding, then end-to-end latency
+// of critical messages while other tasks flood the connection with normal and bulk traffic.
+// Also checks that publish(topic, payload, priority) does not turn the priority into the
+// retained flag.
+//
+// Usage: queue_latency [seconds]
+#include "host_test.h"
+#include <deque>
+#include <random>
+
+static std::string messagePayload(unsigned n, size_t length) {
+    std::string payload = std::to_string(n) + ":";
+    while (payload.size() < length) {
+        payload += (char)('a' + (n + payload.size()) % 26);
+    }
+    return payload;
+}
+
+// Random enqueue/send sequence on one class, checked against a FIFO model
+static void checkRing(ESPRazorBlade& rb, PublishPriority priority) {
+    std::mt19937 random(7);
+    std::deque<std::pair<std::string, std::string>> model;
+    unsigned n = 0;
+    long accepted = 0;
+    long rejected = 0;
+    for (int step = 0; step < 200000; step++) {
+        if (random() % 2) {
+            std::string topic = "queue/" + std::to_string(n);
+            std::string payload = messagePayload(n, random() % 3 == 0 ? random() % 600 : random() % 40);
+            n++;
+            if (rb.enqueueMessage(topic.c_str(), payload.c_str(), false, priority)) {
+                model.emplace_back(topic, payload);
+                accepted++;
+            } else {
+                CHECK(priority != PRIORITY_BULK);  // Bulk sheds instead
+                rejected++;
+            }
+            while (priority == PRIORITY_BULK && (int)model.size() > rb.queuedMessageCount(priority)) {
+                model.pop_front();  // Shed oldest
+            }
+        } else {
+            const char* topic;
+            const char* payload;
+            bool retained;
+            bool found = rb.peekMessage(priority, topic, payload, retained);
+            CHECK(found == !model.empty());
+            if (found) {
+                CHECK(model.front().first == topic && model.front().second == payload);
+                bool sent = random() % 4 != 0;  // Failed sends keep the message at the front
+                rb.finishMessage(priority, sent);
+                if (sent) {
+                    model.pop_front();
+                }
+            }
+        }
+        CHECK(rb.queuedMessageCount(priority) == (int)model.size());
+    }
+    printf("queue_latency: class %d ring: %ld accepted, %ld rejected while full, %lu dropped\n",
+           (int)priority, accepted, rejected, rb.outboundDropped[(int)priority]);
+    CHECK(accepted > 0 && (priority == PRIORITY_BULK || rejected > 0));
+}
+
+int main(int argc, char** argv) {
+    int seconds = argc > 1 ? atoi(argv[1]) : 3;
+
+    // Ring checks on an instance without an MQTT task
+    {
+        static ESPRazorBlade rb;
+        rb.queueMutex = xSemaphoreCreateMutex();
+        checkRing(rb, PRIORITY_NORMAL);
+        checkRing(rb, PRIORITY_BULK);
+
+        // The documented limit: topic + payload + 2 bytes <= OUTBOUND_QUEUE_BYTES
+        std::string payload(OUTBOUND_QUEUE_BYTES - 3, 'x');
+        CHECK(rb.enqueueMessage("t", payload.c_str(), false, PRIORITY_CRITICAL));
+        CHECK(rb.enqueueMessage("t2", "", false, PRIORITY_CRITICAL) == false);  // Ring full
+        payload += 'x';
+        CHECK(rb.enqueueMessage("t", payload.c_str(), false, PRIORITY_NORMAL) == false);  // Too large
+    }
+
+    static HostBroker broker;
+    hostSetBroker("127.0.0.1", broker.start());
+    std::mutex lock;
+    std::map<unsigned, double> sentAt;
+    std::vector<double> latencies;
+    std::atomic<long> bulkReceived{0};
+    std::atomic<long> normalReceived{0};
+    std::atomic<long> overloadReceived{0};
+    broker.onPublish([&](const std::string& clientId, const std::string& topic, const std::string& payload) {
+        double now = hostSeconds();
+        if (topic == "host-device/alarm") {
+            std::lock_guard<std::mutex> guard(lock);
+            auto sent = sentAt.find((unsigned)atol(payload.c_str()));
+            if (sent != sentAt.end()) {
+                latencies.push_back((now - sent->second) * 1e6);
+                sentAt.erase(sent);
+            }
+        } else if (topic == "host-device/bulk") {
+            CHECK(payload.size() == 400);
+            bulkReceived++;
+        } else if (topic == "host-device/normal") {
+            normalReceived++;
+        } else if (topic == "host-device/overload") {
+            overloadReceived++;
+        }
+    });
+
+    static ESPRazorBlade rb;
+    rb.begin();
+    CHECK(hostWaitFor([&] { return rb.isMQTTConnected(); }, 10000));
+
+    // Load: one task publishes a normal message every 50 us, another queues 400-byte bulk messages
+    std::atomic<bool> stop{false};
+    std::thread normalLoad([&] {
+        unsigned n = 0;
+        while (!stop) {
+            rb.publish("host-device/normal", messagePayload(n++, 100).c_str());
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+    });
+    std::thread bulkLoad([&] {
+        unsigned n = 0;
+        while (!stop) {
+            std::string payload = messagePayload(n++, 400);
+            rb.publish("host-device/bulk", payload.c_str(), false, PRIORITY_BULK);
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+    });
+
+    long critical = 0;
+    long failed = 0;
+    double end = hostSeconds() + seconds;
+    for (unsigned n = 0; hostSeconds() < end; n++) {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            sentAt[n] = hostSeconds();
+        }
+        if (!rb.publish("host-device/alarm", String(n).c_str(), false, PRIORITY_CRITICAL)) {
+            failed++;
+        }
+        critical++;
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+    stop = true;
+    normalLoad.join();
+    bulkLoad.join();
+
+    // A priority passed in place of the retained flag selects the priority overload
+    CHECK(rb.publish("host-device/overload", "1", PRIORITY_BULK));
+    CHECK(rb.publish("host-device/overload", 2, PRIORITY_BULK));
+    CHECK(hostWaitFor([&] { return overloadReceived.load() == 2; }, 2000));
+    CHECK(!broker.isRetained("host-device/overload"));
+    hostWaitFor([&] {
+        std::lock_guard<std::mutex> guard(lock);
+        return sentAt.empty();
+    }, 2000);
+
+    std::lock_guard<std::mutex> guard(lock);
+    printf("queue_latency: %ld critical (%ld not accepted, %zu lost), %ld normal and %ld bulk delivered\n",
+           critical, failed, sentAt.size(), normalReceived.load(), bulkReceived.load());
+    printf("queue_latency: critical publish-to-broker latency p50 %.0f us, p99 %.0f us, max %.0f us\n",
+           hostPercentile(latencies, 50), hostPercentile(latencies, 99), hostPercentile(latencies, 100));
+    CHECK(failed == 0);
+    CHECK(sentAt.empty());
+    CHECK(normalReceived > 0 && bulkReceived > 0);
+    printf("queue_latency: PASS\n");
+    hostExit(0);
+}
@@ -0,0 +1,110 @@
+// On-demand read test: round-trip time from a read request published on the broker to the
+// device's response, and rejection of correlation ids that are not a single topic level.
+// Then application filters on the library's own topics are subscribed and unsubscribed;
+// fails if reads or config updates stop working afterwards.
+//
+// Usage: read_latency [requests]
+#include "host_test.h"
+
+static std::atomic<long> reads{0};
+static void readTemperature(char* buffer, size_t size) {
+    reads++;
+    snprintf(buffer, size, "21.5");
+}
+
+static std::atomic<long> overlaps{0};  // Read commands seen by the application filter
+static void onOverlap(const char* topic, const char* payload, size_t length, void* context) {
+    if (strcmp(topic, "host-device/cmd/read/temperature") == 0) {
+        overlaps++;
+    }
+}
+
+static unsigned long wifiInterval(ESPRazorBlade& rb) {
+    ESPRazorBlade::TelemetryConfig config;
+    int slot = rb.findTelemetrySlot("host-device/telemetry/wifi_rssi", config);
+    return slot >= 0 ? config.intervalMs : 0;
+}
+
+int main(int argc, char** argv) {
+    int requests = argc > 1 ? atoi(argv[1]) : 500;
+    static HostBroker broker;
+    hostSetBroker("127.0.0.1", broker.start());
+
+    std::mutex lock;
+    std::condition_variable answered;
+    std::vector<std::string> responses;
+    broker.onPublish([&](const std::string& clientId, const std::string& topic, const std::string& payload) {
+        if (topic.compare(0, 26, "host-device/cmd/response/t") == 0) {
+            std::lock_guard<std::mutex> guard(lock);
+            responses.push_back(topic);
+            answered.notify_all();
+        }
+    });
+
+    static ESPRazorBlade rb;
+    CHECK(rb.registerTelemetry("sensors/temperature", readTemperature, 600000));
+    rb.begin();
+    CHECK(hostWaitFor([&] { return rb.isMQTTConnected() && rb.configTopicsSubscribed; }, 10000));
+
+    // Round trip: one request at a time, timed until its response reaches the broker
+    std::vector<double> latencies;
+    for (int n = 0; n < requests; n++) {
+        std::string id = "req-" + std::to_string(n);
+        std::unique_lock<std::mutex> guard(lock);
+        responses.clear();
+        double start = hostSeconds();
+        broker.publish("host-device/cmd/read/temperature", id);
+        bool ok = answered.wait_for(guard, std::chrono::seconds(2), [&] { return !responses.empty(); });
+        CHECK(ok);
+        latencies.push_back((hostSeconds() - start) * 1e6);
+        CHECK(responses[0] == "host-device/cmd/response/temperature/" + id);
+    }
+
+    // Ids that would add topic levels or wildcards get no response
+    long before = reads;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        responses.clear();
+    }
+    for (const char* id : {"a/b", "a+", "#"}) {
+        broker.publish("host-device/cmd/read/temperature", id);
+    }
+    broker.publish("host-device/cmd/read/temperature", "last");
+    CHECK(hostWaitFor([&] {
+        std::lock_guard<std::mutex> guard(lock);
+        return !responses.empty();
+    }, 2000));
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        printf("read_latency: %d requests, round trip p50 %.0f us, p99 %.0f us, max %.0f us\n", requests,
+               hostPercentile(latencies, 50), hostPercentile(latencies, 99), hostPercentile(latencies, 100));
+        printf("read_latency: %zu responses to invalid ids plus one valid\n", responses.size());
+        CHECK(responses.size() == 1 && responses[0] == "host-device/cmd/response/temperature/last");
+        CHECK(reads - before == 1);  // Invalid ids are rejected before the callback runs
+    }
+
+    // Application filters on the library's own topics, one identical to a library filter and
+    // one covering several; unsubscribing them must leave reads and config updates working
+    const char* OVERLAPPING[] = {"host-device/cmd/read/+", "host-device/config/#"};
+    for (const char* filter : OVERLAPPING) {
+        CHECK(rb.subscribe(filter, onOverlap));
+    }
+    CHECK(hostWaitFor([&] { return rb.syncedSubscriptionGeneration == rb.subscriptionGeneration; }, 5000));
+    broker.publish("host-device/cmd/read/temperature", "overlap");
+    CHECK(hostWaitFor([&] { return overlaps == 1 && reads - before == 2; }, 2000));
+    for (const char* filter : OVERLAPPING) {
+        CHECK(rb.unsubscribe(filter));
+    }
+    CHECK(hostWaitFor([&] { return rb.syncedSubscriptionGeneration == rb.subscriptionGeneration; }, 5000));
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));  // UNSUBSCRIBE, if any, reaches the broker
+    broker.publish("host-device/cmd/read/temperature", "after-unsubscribe");
+    broker.publish("host-device/config/telemetry/timeouts/wifi_rssi", "45000");
+    CHECK(hostWaitFor([&] { return reads - before == 3 && wifiInterval(rb) == 45000; }, 2000));
+    printf("read_latency: read and config update still handled after unsubscribing %zu overlapping filters\n",
+           sizeof(OVERLAPPING) / sizeof(OVERLAPPING[0]));
+    CHECK(overlaps == 1);
+    printf("read_latency: PASS\n");
+    hostExit(0);
+}
@@ -0,0 +1,134 @@
+// Telemetry registry stress test: threads register, update and unregister metrics while
+// the scheduler runs processTelemetry() back to back and a reader takes snapshots.
+// Fails on torn snapshots, on a callback running after unregisterTelemetry() returned,
+// and on a registry count that does not match the active entries at the end.
+//
+// Usage: registry_stress [seconds]
+#include "host_test.h"
+
+static const int CHURN_THREADS = 6;  // One metric each
+static std::atomic<bool> live[CHURN_THREADS];  // True between register and unregister returning
+static std::atomic<long> callbacks{0};
+static std::atomic<long> lateCallbacks{0};
+
+template <int I>
+static void churnCallback(char* buffer, size_t size) {
+    if (!live[I]) {
+        lateCallbacks++;
+    }
+    callbacks++;
+    std::this_thread::sleep_for(std::chrono::microseconds(20));  // Widen the race window
+    if (!live[I]) {
+        lateCallbacks++;
+    }
+    snprintf(buffer, size, "%d", I);
+}
+
+static const TelemetryBufferCallback churnCallbacks[CHURN_THREADS] = {
+    churnCallback<0>, churnCallback<1>, churnCallback<2>, churnCallback<3>, churnCallback<4>, churnCallback<5>
+};
+
+static void staticCallback(char* buffer, size_t size) {
+    snprintf(buffer, size, "1");
+}
+
+int main(int argc, char** argv) {
+    int seconds = argc > 1 ? atoi(argv[1]) : 3;
+    static HostBroker broker;
+    hostSetBroker("127.0.0.1", broker.start());
+
+    static ESPRazorBlade rb;
+    rb.registerTelemetry("static/a", staticCallback, 1);
+
+    std::atomic<bool> attached{false};
+    std::atomic<bool> stop{false};
+    std::atomic<long> cycles{0};
+    std::thread scheduler([&] {
+        CHECK(hostAttachMqttTask(rb));
+        rb.resetReasonPublished = true;
+        rb.configTimeoutsPublished = true;
+        attached = true;
+        while (!stop) {
+            __atomic_add_fetch(&rb.schedulerEpoch, 1, __ATOMIC_SEQ_CST);
+            rb.processTelemetry();
+            __atomic_add_fetch(&rb.schedulerEpoch, 1, __ATOMIC_SEQ_CST);
+            rb.nextWakeDelayMs();
+            cycles++;
+        }
+    });
+    CHECK(hostWaitFor([&] { return attached.load(); }, 5000));
+
+    // Every snapshot of a churned entry must be internally consistent: the callback and
+    // interval written together by one register/update call
+    std::atomic<long> snapshots{0};
+    std::atomic<long> tornSnapshots{0};
+    std::thread reader([&] {
+        ESPRazorBlade::TelemetryConfig config;
+        while (!stop) {
+            for (int i = 0; i < ESPRazorBlade::MAX_TELEMETRY_CALLBACKS; i++) {
+                if (!rb.readTelemetryConfig(i, config)) {
+                    continue;
+                }
+                snapshots++;
+                int n = -1;
+                if (sscanf(config.topic, "churn/%d", &n) == 1 &&
+                    (n < 0 || n >= CHURN_THREADS || config.bufferCallback != churnCallbacks[n] ||
+                     (int)(config.intervalMs % 16) != n)) {
+                    tornSnapshots++;
+                }
+            }
+        }
+    });
+
+    std::atomic<long> operations{0};
+    std::atomic<long> failedOperations{0};
+    std::vector<std::thread> churn;
+    for (int t = 0; t < CHURN_THREADS; t++) {
+        churn.emplace_back([&, t] {
+            std::string topic = "churn/" + std::to_string(t);
+            unsigned k = 0;
+            while (!stop) {
+                live[t] = true;
+                if (!rb.registerTelemetry(topic.c_str(), churnCallbacks[t], 16 * (++k % 4 + 1) + t)) {
+                    failedOperations++;
+                }
+                std::this_thread::sleep_for(std::chrono::microseconds(50 * (k % 5)));
+                for (int u = 0; u < 3; u++) {
+                    if (!rb.setTelemetryInterval(topic.c_str(), 16 * (++k % 4 + 1) + t)) {
+                        failedOperations++;
+                    }
+                }
+                if (!rb.unregisterTelemetry(topic.c_str())) {
+                    failedOperations++;
+                }
+                live[t] = false;
+                operations += 5;
+            }
+        });
+    }
+
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    stop = true;
+    for (auto& thread : churn) {
+        thread.join();
+    }
+    reader.join();
+    scheduler.join();
+
+    int active = 0;
+    for (int i = 0; i < ESPRazorBlade::MAX_TELEMETRY_CALLBACKS; i++) {
+        active += rb.telemetryCallbacks[i].config.active ? 1 : 0;
+    }
+    printf("registry_stress: %ld scheduler cycles, %ld callbacks, %ld registry operations, %ld snapshots\n",
+           cycles.load(), callbacks.load(), operations.load(), snapshots.load());
+    printf("registry_stress: late_callbacks=%ld torn_snapshots=%ld failed_operations=%ld count=%d active=%d\n",
+           lateCallbacks.load(), tornSnapshots.load(), failedOperations.load(), rb.telemetryCallbackCount, active);
+
+    CHECK(callbacks > 0);
+    CHECK(lateCallbacks == 0);
+    CHECK(tornSnapshots == 0);
+    CHECK(failedOperations == 0);
+    CHECK(rb.telemetryCallbackCount == active && active == 1);
+    printf("registry_stress: PASS\n");
+    hostExit(0);
+}
@@ -0,0 +1,159 @@
+// Streaming capture benchmark: how long a completed block waits before the broker has it
+// (task and ISR write paths, with the MQTT task otherwise idle), upload throughput with a
+// producer writing flat out at several write sizes, and the time a producer spends in one
+// write call. Ends with closeStream(): the last partial block is delivered and the channel
+// can be opened again.
+//
+// Built with STREAM_CHANNELS=1 and the default block size and count.
+//
+// Usage: stream_bench [seconds per write size]
+#include "host_test.h"
+
+static const char* STREAM_TOPIC = "host-device/stream/bench";
+
+struct Delivered {
+    std::mutex lock;
+    std::map<uint32_t, double> receivedAt;  // Sequence -> broker receive time
+    long blocks = 0;
+    long sampleBytes = 0;
+};
+
+static Delivered delivered;
+
+static void waitForUpload(ESPRazorBlade& rb) {
+    CHECK(hostWaitFor([&] { return rb.streamChannels[0].readyCount == 0; }, 10000));
+}
+
+// Paced producer: one block every 5 ms, so each block finds the MQTT task in its idle wait
+static void pacedLatency(ESPRazorBlade& rb, bool fromISR) {
+    const uint32_t BLOCKS = 200;
+    int channel = rb.openStream(STREAM_TOPIC);
+    CHECK(channel == 0);
+    {
+        std::lock_guard<std::mutex> guard(delivered.lock);
+        delivered.receivedAt.clear();
+    }
+    static uint8_t block[STREAM_BLOCK_SIZE];
+    std::vector<double> completedAt;
+    for (uint32_t n = 0; n < BLOCKS; n++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        memset(block, (int)n, sizeof(block));
+        completedAt.push_back(hostSeconds());
+        size_t accepted = fromISR ? rb.streamWriteFromISR(channel, block, sizeof(block))
+                                  : rb.streamWrite(channel, block, sizeof(block));
+        CHECK(accepted == sizeof(block));
+    }
+    CHECK(hostWaitFor([&] {
+        std::lock_guard<std::mutex> guard(delivered.lock);
+        return delivered.receivedAt.size() == BLOCKS;
+    }, 10000));
+
+    std::vector<double> latencies;
+    {
+        std::lock_guard<std::mutex> guard(delivered.lock);
+        for (auto& received : delivered.receivedAt) {
+            latencies.push_back((received.second - completedAt[received.first]) * 1e6);
+        }
+    }
+    printf("stream_bench: %s block-to-broker latency over %u blocks: p50 %.0f us, p99 %.0f us, max %.0f us\n",
+           fromISR ? "streamWriteFromISR()" : "streamWrite()       ", BLOCKS, hostPercentile(latencies, 50),
+           hostPercentile(latencies, 99), hostPercentile(latencies, 100));
+    CHECK(hostPercentile(latencies, 99) < 50000);  // Woken by the block, not by a poll interval
+    CHECK(rb.closeStream(channel));
+    waitForUpload(rb);
+}
+
+// Flat-out producer: throughput the uploader sustains, overruns, and per-call write time
+static void throughput(ESPRazorBlade& rb, size_t writeSize, int seconds) {
+    int channel = rb.openStream(STREAM_TOPIC);
+    CHECK(channel == 0);
+    long blocksBefore;
+    long bytesBefore;
+    {
+        std::lock_guard<std::mutex> guard(delivered.lock);
+        blocksBefore = delivered.blocks;
+        bytesBefore = delivered.sampleBytes;
+    }
+
+    std::vector<uint8_t> samples(writeSize, 0x5A);
+    std::vector<double> callTimes;
+    long written = 0;
+    long accepted = 0;
+    double start = hostSeconds();
+    double end = start + seconds;
+    for (long call = 0; hostSeconds() < end; call++) {
+        if (call % 61 == 0) {  // Prime, so the samples do not line up with block boundaries
+            double before = hostSeconds();
+            accepted += rb.streamWrite(channel, samples.data(), writeSize);
+            callTimes.push_back((hostSeconds() - before) * 1e6);
+        } else {
+            accepted += rb.streamWrite(channel, samples.data(), writeSize);
+        }
+        written += writeSize;
+        if (call % 16 == 0) {
+            std::this_thread::yield();  // Host mutexes are unfair; give the uploader a turn
+        }
+    }
+    double elapsed = hostSeconds() - start;
+    CHECK(rb.closeStream(channel));
+    waitForUpload(rb);
+
+    long blocks;
+    long bytes;
+    {
+        std::lock_guard<std::mutex> guard(delivered.lock);
+        blocks = delivered.blocks - blocksBefore;
+        bytes = delivered.sampleBytes - bytesBefore;
+    }
+    printf("stream_bench: %5zu-byte writes: %7.1f MB/s uploaded (%ld blocks), %5.1f%% of samples dropped, "
+           "write call p50 %.2f us, p99 %.2f us\n",
+           writeSize, bytes / elapsed / 1e6, blocks, 100.0 * (written - accepted) / written,
+           hostPercentile(callTimes, 50), hostPercentile(callTimes, 99));
+    CHECK(bytes == accepted);  // Every accepted sample reached the broker
+}
+
+int main(int argc, char** argv) {
+    int seconds = argc > 1 ? atoi(argv[1]) : 2;
+    static HostBroker broker;
+    hostSetBroker("127.0.0.1", broker.start());
+    broker.onPublish([&](const std::string& clientId, const std::string& topic, const std::string& payload) {
+        if (topic != STREAM_TOPIC || payload.size() < 8) {
+            return;
+        }
+        double now = hostSeconds();
+        const uint8_t* header = (const uint8_t*)payload.data();
+        uint32_t sequence = ((uint32_t)header[0] << 24) | ((uint32_t)header[1] << 16) |
+                            ((uint32_t)header[2] << 8) | header[3];
+        std::lock_guard<std::mutex> guard(delivered.lock);
+        delivered.receivedAt[sequence] = now;
+        delivered.blocks++;
+        delivered.sampleBytes += payload.size() - 8;
+    });
+
+    static ESPRazorBlade rb;
+    rb.begin();
+    CHECK(hostWaitFor([&] { return rb.isMQTTConnected() && rb.configTimeoutsPublished; }, 10000));
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));  // Let the connect burst settle
+
+    pacedLatency(rb, false);
+    pacedLatency(rb, true);
+    for (size_t writeSize : {16, 256, 4096}) {
+        throughput(rb, writeSize, seconds);
+    }
+
+    // A partial block is delivered on close, and the channel is free again afterwards
+    long before = delivered.sampleBytes;
+    int channel = rb.openStream(STREAM_TOPIC);
+    CHECK(channel == 0);
+    CHECK(rb.streamWrite(channel, "tail", 4) == 4);
+    CHECK(rb.closeStream(channel));
+    CHECK(!rb.closeStream(channel));
+    CHECK(rb.streamWrite(channel, "late", 4) == 0);
+    CHECK(hostWaitFor([&] {
+        std::lock_guard<std::mutex> guard(delivered.lock);
+        return delivered.sampleBytes == before + 4;
+    }, 5000));
+    CHECK(rb.openStream(STREAM_TOPIC) == 0);
+    printf("stream_bench: PASS\n");
+    hostExit(0);
+}
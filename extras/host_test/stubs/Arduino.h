@@ -0,0 +1,121 @@
+// Host build of the Arduino core subset used by ESPRazorBlade (see ../README.md)
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <math.h>
+#include <string>
+
+#define IRAM_ATTR
+
+class String {
+public:
+    String(const char* s = "") : value(s != nullptr ? s : "") {}
+    explicit String(int v) : value(std::to_string(v)) {}
+    explicit String(unsigned int v) : value(std::to_string(v)) {}
+    explicit String(long v) : value(std::to_string(v)) {}
+    explicit String(unsigned long v) : value(std::to_string(v)) {}
+    explicit String(float v, int decimals = 2) : String((double)v, decimals) {}
+    explicit String(double v, int decimals = 2);
+
+    const char* c_str() const { return value.c_str(); }
+    unsigned int length() const { return (unsigned int)value.size(); }
+    bool reserve(unsigned int size) { value.reserve(size); return true; }
+    long toInt() const { return atol(value.c_str()); }
+    float toFloat() const { return (float)atof(value.c_str()); }
+    bool startsWith(const String& prefix) const { return value.compare(0, prefix.value.size(), prefix.value) == 0; }
+    bool endsWith(const String& suffix) const {
+        return value.size() >= suffix.value.size() &&
+               value.compare(value.size() - suffix.value.size(), suffix.value.size(), suffix.value) == 0;
+    }
+    int indexOf(char c) const { size_t i = value.find(c); return i == std::string::npos ? -1 : (int)i; }
+    String substring(unsigned int from, unsigned int to) const { return String(value.substr(from, to - from).c_str()); }
+    String substring(unsigned int from) const { return String(value.substr(from).c_str()); }
+    void trim();
+    char operator[](unsigned int i) const { return i < value.size() ? value[i] : '\0'; }
+    String& operator+=(const String& other) { value += other.value; return *this; }
+    String& operator+=(const char* other) { value += other; return *this; }
+    String& operator+=(char c) { value += c; return *this; }
+    bool operator==(const String& other) const { return value == other.value; }
+    bool operator==(const char* other) const { return value == other; }
+    bool operator!=(const String& other) const { return value != other.value; }
+
+private:
+    std::string value;
+};
+
+inline String operator+(const String& a, const String& b) { String s(a); s += b; return s; }
+inline String operator+(const String& a, const char* b) { String s(a); s += b; return s; }
+
+class Print;
+
+class Printable {
+public:
+    virtual ~Printable() {}
+    virtual size_t printTo(Print& p) const = 0;
+};
+
+class Print {
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t* buffer, size_t size);
+    size_t write(const char* s) { return write((const uint8_t*)s, strlen(s)); }
+
+    size_t print(const char* s) { return write(s); }
+    size_t print(const String& s) { return write(s.c_str()); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(int v) { return printFormatted("%d", v); }
+    size_t print(unsigned int v) { return printFormatted("%u", v); }
+    size_t print(long v) { return printFormatted("%ld", v); }
+    size_t print(unsigned long v) { return printFormatted("%lu", v); }
+    size_t print(double v, int decimals = 2) { return printFormatted("%.*f", decimals, v); }
+    size_t print(const Printable& p) { return p.printTo(*this); }
+
+    template <typename T>
+    size_t println(const T& v) { size_t n = print(v); return n + println(); }
+    size_t println() { return write("\r\n"); }
+    size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+private:
+    size_t printFormatted(const char* format, ...) __attribute__((format(printf, 2, 3)));
+};
+
+class Stream : public Print {
+public:
+    virtual int available() { return 0; }
+    virtual int read() { return -1; }
+    virtual int peek() { return -1; }
+    virtual void flush() {}
+};
+
+// Serial output is discarded unless HOST_SERIAL is set in the environment
+class HardwareSerial : public Stream {
+public:
+    void begin(unsigned long baud) {}
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t* buffer, size_t size) override;
+    using Print::write;
+};
+extern HardwareSerial Serial;
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+long random(long low, long high);
+
+class EspClass {
+public:
+    uint32_t getFreeHeap();
+    uint32_t getMinFreeHeap();
+    uint32_t getMaxAllocHeap();
+    uint32_t getHeapSize();
+};
+extern EspClass ESP;
+
+#endif // HOST_ARDUINO_H
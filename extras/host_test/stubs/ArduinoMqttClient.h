@@ -0,0 +1,91 @@
+// Host build of the ArduinoMqttClient API subset used by ESPRazorBlade: MQTT 3.1.1, QoS 0,
+// clean session. Like the real client, subscribe() and unsubscribe() poll for inbound
+// messages while waiting for the broker's acknowledgement, and messageTopic() returns a copy
+#ifndef HOST_ARDUINO_MQTT_CLIENT_H
+#define HOST_ARDUINO_MQTT_CLIENT_H
+
+#include "WiFi.h"
+#include "host_alloc.h"
+
+class MqttClient : public Client {
+public:
+    typedef void (*MessageCallback)(MqttClient* client, int messageSize);
+
+    MqttClient(Client* client);
+    MqttClient(Client& client) : MqttClient(&client) {}
+
+    void onMessage(MessageCallback callback) { messageCallback = callback; }
+    void setId(const char* id) { clientId = id; }
+    void setUsernamePassword(const char* username, const char* password) { user = username; pass = password; }
+    void setKeepAliveInterval(unsigned long intervalMs) { keepAliveMs = intervalMs; }
+    void setConnectionTimeout(unsigned long timeoutMs) { connectionTimeoutMs = timeoutMs; }
+    int connectError() const { return lastConnectError; }
+
+    // Returns 1 on success, 0 on failure (as the real client)
+    int connect(const char* host, uint16_t port = 1883) override;
+    int connect(IPAddress ip, uint16_t port = 1883) override;
+    uint8_t connected() override;
+    void stop() override;
+    operator bool() override { return true; }
+
+    void poll();
+    // Host only: stop() calls made from inside the message callback. The real client keeps
+    // using its buffers after the callback returns, so this has to stay 0
+    long stopsInCallback() const { return stopsFromCallback; }
+    int subscribe(const char* topic, uint8_t qos = 0);
+    int unsubscribe(const char* topic);
+
+    // Outbound message: payload written between beginMessage() and endMessage()
+    int beginMessage(const char* topic, unsigned long size, bool retain = false, uint8_t qos = 0, bool dup = false);
+    int beginMessage(const char* topic, bool retain = false, uint8_t qos = 0, bool dup = false);
+    int endMessage();
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t* buffer, size_t size) override;
+    using Print::write;
+
+    // Inbound message being delivered to the callback
+    String messageTopic() const {
+        HostAllocationScope scope(HOST_ALLOC_TOPIC_STRING);
+        return String(rxTopic.c_str());
+    }
+    int messageSize() const { return (int)rxPayloadLength; }
+    int available() override { return (int)(rxPayloadLength - rxPayloadPos); }
+    int read() override;
+    int read(uint8_t* buffer, size_t size) override;
+    int peek() override;
+
+private:
+    bool sendPacket(uint8_t type, const std::string& body);
+    bool readPacket(unsigned long timeoutMs, uint8_t& type, std::string& body);  // Waits up to timeoutMs
+    void handlePacket(uint8_t type, const std::string& body);
+    bool waitForAck(uint8_t type, uint16_t packetId);
+
+    Client* client;
+    MessageCallback messageCallback = nullptr;
+    bool inCallback = false;
+    long stopsFromCallback = 0;
+    std::string clientId;
+    std::string user;
+    std::string pass;
+    unsigned long keepAliveMs = 60000;
+    unsigned long connectionTimeoutMs = 5000;
+    int lastConnectError = 0;
+    bool sessionOpen = false;
+    unsigned long lastTx = 0;
+    uint16_t nextPacketId = 1;
+    uint16_t ackedPacketId = 0;
+    uint8_t ackedType = 0;
+
+    std::string rxBuffer;   // Bytes received but not yet parsed
+    std::string rxTopic;
+    const uint8_t* rxPayload = nullptr;
+    size_t rxPayloadLength = 0;
+    size_t rxPayloadPos = 0;
+
+    bool txOpen = false;
+    std::string txTopic;
+    bool txRetain = false;
+    std::string txPayload;
+};
+
+#endif // HOST_ARDUINO_MQTT_CLIENT_H
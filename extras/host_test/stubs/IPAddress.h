@@ -0,0 +1,22 @@
+// Host build of the Arduino IPAddress class (IPv4 only)
+#ifndef HOST_IPADDRESS_H
+#define HOST_IPADDRESS_H
+
+#include "Arduino.h"
+
+class IPAddress : public Printable {
+public:
+    IPAddress() { octets[0] = octets[1] = octets[2] = octets[3] = 0; }
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) { octets[0] = a; octets[1] = b; octets[2] = c; octets[3] = d; }
+
+    uint8_t operator[](int i) const { return octets[i]; }
+    bool operator==(const IPAddress& other) const { return memcmp(octets, other.octets, 4) == 0; }
+    bool fromString(const char* address);
+    String toString() const;
+    size_t printTo(Print& p) const override { return p.print(toString()); }
+
+private:
+    uint8_t octets[4];
+};
+
+#endif // HOST_IPADDRESS_H
@@ -0,0 +1,117 @@
+// Host build of the ESP32 WiFi classes: clients, servers and UDP are plain POSIX sockets
+// on the host network stack, and the station is always connected (see hostSetWiFiStatus)
+#ifndef HOST_WIFI_H
+#define HOST_WIFI_H
+
+#include "Arduino.h"
+#include "IPAddress.h"
+#include <memory>
+#include <vector>
+
+#define WL_IDLE_STATUS 0
+#define WL_DISCONNECTED 6
+#define WL_CONNECTED 3
+#define WIFI_STA 1
+
+class Client : public Stream {
+public:
+    virtual int connect(const char* host, uint16_t port) = 0;
+    virtual int connect(IPAddress ip, uint16_t port) = 0;
+    virtual uint8_t connected() = 0;
+    virtual void stop() = 0;
+    virtual int read(uint8_t* buffer, size_t size) = 0;
+    virtual operator bool() = 0;
+    using Stream::read;
+};
+
+// Socket shared between copies of a client, like the ESP32 core's WiFiClient
+class HostSocket {
+public:
+    explicit HostSocket(int fd) : fd(fd) {}
+    ~HostSocket();
+    const int fd;
+};
+
+class WiFiClient : public Client {
+public:
+    WiFiClient() {}
+    explicit WiFiClient(int fd) : socket(std::make_shared<HostSocket>(fd)) {}
+
+    int connect(const char* host, uint16_t port) override;
+    int connect(IPAddress ip, uint16_t port) override;
+    uint8_t connected() override;
+    void stop() override { socket.reset(); }
+    operator bool() override { return socket != nullptr; }
+    int available() override;
+    int read() override;
+    int read(uint8_t* buffer, size_t size) override;
+    int peek() override;
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t* buffer, size_t size) override;
+    using Print::write;
+    int fd() const { return socket != nullptr ? socket->fd : -1; }
+    int setTimeout(uint32_t seconds) { return 0; }
+    void setNoDelay(bool noDelay) {}
+
+private:
+    std::shared_ptr<HostSocket> socket;
+};
+
+class WiFiServer {
+public:
+    WiFiServer(uint16_t port = 80, uint8_t maxClients = 4) : port(port), maxClients(maxClients) {}
+    ~WiFiServer();
+    void begin();
+    void end();
+    WiFiClient available();
+    WiFiClient accept() { return available(); }
+    bool hasClient();
+    void setNoDelay(bool noDelay) {}
+
+private:
+    uint16_t port;
+    uint8_t maxClients;
+    int listenFd = -1;
+};
+
+class WiFiUDP : public Stream {
+public:
+    ~WiFiUDP() { stop(); }
+    uint8_t begin(uint16_t port);
+    void stop();
+    int beginPacket(IPAddress ip, uint16_t port);
+    int beginPacket(const char* host, uint16_t port);
+    int endPacket();
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t* buffer, size_t size) override;
+    using Print::write;
+    int parsePacket();
+    int available() override { return (int)(rxPacket.size() - rxPos); }
+    int read() override { return rxPos < rxPacket.size() ? rxPacket[rxPos++] : -1; }
+    int read(uint8_t* buffer, size_t size);
+
+private:
+    int fd = -1;
+    IPAddress txAddress;
+    uint16_t txPort = 0;
+    std::vector<uint8_t> txPacket;
+    std::vector<uint8_t> rxPacket;
+    size_t rxPos = 0;
+};
+
+class WiFiClass {
+public:
+    int status();
+    void mode(int mode) {}
+    void begin(const char* ssid, const char* password) {}
+    void disconnect() {}
+    int RSSI() { return -55; }
+    IPAddress localIP() { return IPAddress(127, 0, 0, 1); }
+    bool hostByName(const char* host, IPAddress& result);
+};
+extern WiFiClass WiFi;
+
+// Test control: what WiFi.status() reports (WL_CONNECTED by default)
+void hostSetWiFiStatus(int status);
+
+#endif // HOST_WIFI_H
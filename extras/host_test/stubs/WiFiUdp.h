@@ -0,0 +1,6 @@
+#ifndef HOST_WIFIUDP_H
+#define HOST_WIFIUDP_H
+
+#include "WiFi.h"
+
+#endif // HOST_WIFIUDP_H
@@ -0,0 +1,39 @@
+// Host build of the ESP-IDF FreeRTOS subset used by ESPRazorBlade. Tasks are threads,
+// a tick is one millisecond, and critical sections are recursive spinlocks
+#ifndef HOST_FREERTOS_H
+#define HOST_FREERTOS_H
+
+#include <stdint.h>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint8_t StackType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define pdFAIL 0
+#define portMAX_DELAY ((TickType_t)0xFFFFFFFFu)
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define configSUPPORT_STATIC_ALLOCATION 1
+#define tskNO_AFFINITY 0x7FFFFFFF
+
+typedef struct {
+    volatile int owner;   // Host thread id holding the lock (0 = free)
+    int count;            // Recursion depth
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED { 0, 0 }
+
+void portMUX_INITIALIZE(portMUX_TYPE* mux);
+void portENTER_CRITICAL(portMUX_TYPE* mux);
+void portEXIT_CRITICAL(portMUX_TYPE* mux);
+void portENTER_CRITICAL_ISR(portMUX_TYPE* mux);
+void portEXIT_CRITICAL_ISR(portMUX_TYPE* mux);
+#define portYIELD_FROM_ISR(...) ((void)0)
+
+TickType_t xTaskGetTickCount();
+
+#endif // HOST_FREERTOS_H
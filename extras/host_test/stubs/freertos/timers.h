@@ -0,0 +1,12 @@
+#ifndef HOST_FREERTOS_TIMERS_H
+#define HOST_FREERTOS_TIMERS_H
+
+#include "FreeRTOS.h"
+
+typedef void (*PendedFunction_t)(void* parameter1, uint32_t parameter2);
+
+// The host has no interrupts: the pended function runs in the calling thread
+BaseType_t xTimerPendFunctionCallFromISR(PendedFunction_t function, void* parameter1, uint32_t parameter2,
+                                         BaseType_t* higherPriorityTaskWoken);
+
+#endif // HOST_FREERTOS_TIMERS_H
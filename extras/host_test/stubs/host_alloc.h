@@ -0,0 +1,30 @@
+// Allocation tagging for alloc_test. The stubs mark the host-only allocations behind a
+// stubbed call (threads and mutexes behind the FreeRTOS API) and the String copy returned by
+// MqttClient::messageTopic(), and count the heap blocks that dynamic task and mutex creation
+// would take on the device
+#ifndef HOST_ALLOC_H
+#define HOST_ALLOC_H
+
+enum HostAllocationKind {
+    HOST_ALLOC_LIBRARY,       // Made by the library itself
+    HOST_ALLOC_STUB,          // Host-only bookkeeping behind a stubbed call
+    HOST_ALLOC_TOPIC_STRING,  // The String returned by MqttClient::messageTopic()
+};
+
+// Kind of an allocation made now on the calling thread
+HostAllocationKind hostAllocationKind();
+
+class HostAllocationScope {
+public:
+    explicit HostAllocationScope(HostAllocationKind kind);
+    ~HostAllocationScope();
+
+private:
+    HostAllocationKind previous;
+};
+
+// Heap blocks taken by xTaskCreatePinnedToCore() and xSemaphoreCreateMutex() (none by the
+// static variants), as on the device
+long hostKernelHeapAllocations();
+
+#endif // HOST_ALLOC_H
@@ -0,0 +1,119 @@
+#include "Arduino.h"
+#include "IPAddress.h"
+#include "esp_system.h"
+#include <chrono>
+#include <stdarg.h>
+#include <thread>
+#include <unistd.h>
+
+HardwareSerial Serial;
+EspClass ESP;
+
+static const auto hostStart = std::chrono::steady_clock::now();
+
+static bool serialEnabled() {
+    static const bool enabled = getenv("HOST_SERIAL") != nullptr;
+    return enabled;
+}
+
+String::String(double v, int decimals) {
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "%.*f", decimals, v);
+    value = buffer;
+}
+
+void String::trim() {
+    size_t begin = 0;
+    size_t end = value.size();
+    while (begin < end && isspace((unsigned char)value[begin])) {
+        begin++;
+    }
+    while (end > begin && isspace((unsigned char)value[end - 1])) {
+        end--;
+    }
+    value = value.substr(begin, end - begin);
+}
+
+size_t Print::write(const uint8_t* buffer, size_t size) {
+    size_t n = 0;
+    while (size-- > 0) {
+        n += write(*buffer++);
+    }
+    return n;
+}
+
+size_t Print::printf(const char* format, ...) {
+    char buffer[256];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    return write((const uint8_t*)buffer, len < (int)sizeof(buffer) ? len : sizeof(buffer) - 1);
+}
+
+size_t Print::printFormatted(const char* format, ...) {
+    char buffer[64];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    return write((const uint8_t*)buffer, len < (int)sizeof(buffer) ? len : sizeof(buffer) - 1);
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+    return write(&c, 1);
+}
+
+size_t HardwareSerial::write(const uint8_t* buffer, size_t size) {
+    if (serialEnabled()) {
+        ::write(STDERR_FILENO, buffer, size);
+    }
+    return size;
+}
+
+unsigned long millis() {
+    // Starts at 1: the library uses 0 as "never"
+    return 1 + (unsigned long)std::chrono::duration_cast<std::chrono::milliseconds>(
+                   std::chrono::steady_clock::now() - hostStart).count();
+}
+
+unsigned long micros() {
+    return (unsigned long)std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now() - hostStart).count();
+}
+
+void delay(unsigned long ms) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+long random(long low, long high) {
+    return high > low ? low + rand() % (high - low) : low;
+}
+
+uint32_t EspClass::getFreeHeap() { return 200000; }
+uint32_t EspClass::getMinFreeHeap() { return 180000; }
+uint32_t EspClass::getMaxAllocHeap() { return 110000; }
+uint32_t EspClass::getHeapSize() { return 320000; }
+
+esp_reset_reason_t esp_reset_reason() {
+    return ESP_RST_POWERON;
+}
+
+bool IPAddress::fromString(const char* address) {
+    unsigned int a, b, c, d;
+    char tail;
+    if (sscanf(address, "%u.%u.%u.%u%c", &a, &b, &c, &d, &tail) != 4 || a > 255 || b > 255 || c > 255 || d > 255) {
+        return false;
+    }
+    octets[0] = (uint8_t)a;
+    octets[1] = (uint8_t)b;
+    octets[2] = (uint8_t)c;
+    octets[3] = (uint8_t)d;
+    return true;
+}
+
+String IPAddress::toString() const {
+    char buffer[16];
+    snprintf(buffer, sizeof(buffer), "%u.%u.%u.%u", octets[0], octets[1], octets[2], octets[3]);
+    return String(buffer);
+}
@@ -0,0 +1,36 @@
+#include "host_config.h"
+#include <string>
+
+static std::string brokerHost = "127.0.0.1";
+static uint16_t brokerPort = 1883;
+static uint16_t udpGatewayPort = 1885;
+static uint16_t metricsPort = 9100;
+
+const char* hostBrokerHost() {
+    return brokerHost.c_str();
+}
+
+uint16_t hostBrokerPort() {
+    return brokerPort;
+}
+
+void hostSetBroker(const char* host, uint16_t port) {
+    brokerHost = host;
+    brokerPort = port;
+}
+
+uint16_t hostUdpGatewayPort() {
+    return udpGatewayPort;
+}
+
+void hostSetUdpGateway(uint16_t port) {
+    udpGatewayPort = port;
+}
+
+uint16_t hostMetricsPort() {
+    return metricsPort;
+}
+
+void hostSetMetricsPort(uint16_t port) {
+    metricsPort = port;
+}
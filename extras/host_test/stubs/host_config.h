@@ -0,0 +1,15 @@
+// Run-time settings used by the host Configuration.h in place of compile-time constants
+#ifndef HOST_CONFIG_H
+#define HOST_CONFIG_H
+
+#include <stdint.h>
+
+const char* hostBrokerHost();
+uint16_t hostBrokerPort();
+void hostSetBroker(const char* host, uint16_t port);
+uint16_t hostUdpGatewayPort();
+void hostSetUdpGateway(uint16_t port);
+uint16_t hostMetricsPort();
+void hostSetMetricsPort(uint16_t port);  // Before the ESPRazorBlade instance is constructed
+
+#endif // HOST_CONFIG_H
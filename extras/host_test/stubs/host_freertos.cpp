@@ -0,0 +1,224 @@
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/timers.h"
+#include "Arduino.h"
+#include "host_alloc.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <new>
+#include <thread>
+
+struct HostTask {
+    std::mutex lock;
+    std::condition_variable notified;
+    uint32_t notifyCount = 0;
+};
+
+struct HostSemaphore {
+    std::timed_mutex mutex;
+    bool isStatic = false;
+};
+
+namespace {
+
+struct TaskExit {};  // Thrown by vTaskDelete(nullptr) to unwind the task thread
+
+thread_local HostTask* currentTask = nullptr;
+thread_local HostAllocationKind allocationKind = HOST_ALLOC_LIBRARY;
+std::atomic<long> kernelHeapAllocations{0};
+std::atomic<int> nextThreadId{1};
+thread_local int threadId = 0;
+
+int hostThreadId() {
+    if (threadId == 0) {
+        threadId = nextThreadId++;
+    }
+    return threadId;
+}
+
+void runTask(HostTask* task, TaskFunction_t function, void* parameter, unsigned long startDelayMs) {
+    std::thread([task, function, parameter, startDelayMs] {
+        currentTask = task;
+        if (startDelayMs > 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(startDelayMs));
+        }
+        try {
+            function(parameter);
+        } catch (const TaskExit&) {
+        }
+    }).detach();
+}
+
+std::chrono::milliseconds ticksToDuration(TickType_t ticks) {
+    // portMAX_DELAY waits forever; a day is forever for a test
+    return std::chrono::milliseconds(ticks == portMAX_DELAY ? 86400000UL : ticks);
+}
+
+}  // namespace
+
+HostAllocationKind hostAllocationKind() {
+    return allocationKind;
+}
+
+HostAllocationScope::HostAllocationScope(HostAllocationKind kind) : previous(allocationKind) {
+    allocationKind = kind;
+}
+
+HostAllocationScope::~HostAllocationScope() {
+    allocationKind = previous;
+}
+
+long hostKernelHeapAllocations() {
+    return kernelHeapAllocations;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char* name, uint32_t stackDepth, void* parameter,
+                                   UBaseType_t priority, TaskHandle_t* handle, BaseType_t core) {
+    // The handle is stored before the task runs, as the task may compare against it right away
+    HostAllocationScope scope(HOST_ALLOC_STUB);
+    kernelHeapAllocations += 2;  // Task control block and stack
+    HostTask* task = new HostTask;
+    if (handle != nullptr) {
+        *handle = task;
+    }
+    runTask(task, function, parameter, 0);
+    return pdPASS;
+}
+
+TaskHandle_t xTaskCreateStaticPinnedToCore(TaskFunction_t function, const char* name, uint32_t stackDepth,
+                                           void* parameter, UBaseType_t priority, StackType_t* stack,
+                                           StaticTask_t* taskBuffer, BaseType_t core) {
+    // The caller stores the returned handle, so give it a moment before the task starts
+    HostAllocationScope scope(HOST_ALLOC_STUB);
+    HostTask* task = new HostTask;
+    runTask(task, function, parameter, 10);
+    return task;
+}
+
+void vTaskDelete(TaskHandle_t task) {
+    if (task == nullptr || task == currentTask) {
+        throw TaskExit();
+    }
+}
+
+void vTaskDelay(TickType_t ticks) {
+    std::this_thread::sleep_for(ticksToDuration(ticks));
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle() {
+    if (currentTask == nullptr) {
+        HostAllocationScope scope(HOST_ALLOC_STUB);
+        currentTask = new HostTask;  // Threads started by tests behave as tasks too
+    }
+    return currentTask;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticks) {
+    HostTask* task = xTaskGetCurrentTaskHandle();
+    std::unique_lock<std::mutex> guard(task->lock);
+    task->notified.wait_for(guard, ticksToDuration(ticks), [task] { return task->notifyCount > 0; });
+    uint32_t count = task->notifyCount;
+    if (count > 0) {
+        task->notifyCount = clearOnExit ? 0 : count - 1;
+    }
+    return count;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+    {
+        std::lock_guard<std::mutex> guard(task->lock);
+        task->notifyCount++;
+    }
+    task->notified.notify_one();
+    return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t* higherPriorityTaskWoken) {
+    xTaskNotifyGive(task);
+    if (higherPriorityTaskWoken != nullptr) {
+        *higherPriorityTaskWoken = pdTRUE;
+    }
+}
+
+BaseType_t xTimerPendFunctionCallFromISR(PendedFunction_t function, void* parameter1, uint32_t parameter2,
+                                         BaseType_t* higherPriorityTaskWoken) {
+    function(parameter1, parameter2);
+    return pdPASS;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) {
+    return 2048;
+}
+
+TickType_t xTaskGetTickCount() {
+    return (TickType_t)millis();
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex() {
+    HostAllocationScope scope(HOST_ALLOC_STUB);
+    kernelHeapAllocations++;
+    return new HostSemaphore;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t* buffer) {
+    static_assert(sizeof(HostSemaphore) <= sizeof(StaticSemaphore_t), "StaticSemaphore_t too small");
+    HostSemaphore* semaphore = new (buffer) HostSemaphore;
+    semaphore->isStatic = true;
+    return semaphore;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks) {
+    if (ticks == 0) {
+        return semaphore->mutex.try_lock() ? pdTRUE : pdFALSE;
+    }
+    return semaphore->mutex.try_lock_for(ticksToDuration(ticks)) ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+    semaphore->mutex.unlock();
+    return pdTRUE;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t semaphore) {
+    if (semaphore->isStatic) {
+        semaphore->~HostSemaphore();
+    } else {
+        delete semaphore;
+    }
+}
+
+void portMUX_INITIALIZE(portMUX_TYPE* mux) {
+    mux->owner = 0;
+    mux->count = 0;
+}
+
+void portENTER_CRITICAL(portMUX_TYPE* mux) {
+    int self = hostThreadId();
+    if (__atomic_load_n(&mux->owner, __ATOMIC_ACQUIRE) == self) {
+        mux->count++;
+        return;
+    }
+    int expected = 0;
+    while (!__atomic_compare_exchange_n(&mux->owner, &expected, self, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        expected = 0;
+        std::this_thread::yield();
+    }
+    mux->count = 1;
+}
+
+void portEXIT_CRITICAL(portMUX_TYPE* mux) {
+    if (--mux->count == 0) {
+        __atomic_store_n(&mux->owner, 0, __ATOMIC_RELEASE);
+    }
+}
+
+void portENTER_CRITICAL_ISR(portMUX_TYPE* mux) {
+    portENTER_CRITICAL(mux);
+}
+
+void portEXIT_CRITICAL_ISR(portMUX_TYPE* mux) {
+    portEXIT_CRITICAL(mux);
+}
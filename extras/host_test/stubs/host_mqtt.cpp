@@ -0,0 +1,315 @@
+#include "ArduinoMqttClient.h"
+#include <chrono>
+#include <thread>
+
+namespace {
+
+const uint8_t MQTT_CONNECT = 0x10;
+const uint8_t MQTT_CONNACK = 0x20;
+const uint8_t MQTT_PUBLISH = 0x30;
+const uint8_t MQTT_SUBSCRIBE = 0x82;
+const uint8_t MQTT_SUBACK = 0x90;
+const uint8_t MQTT_UNSUBSCRIBE = 0xA2;
+const uint8_t MQTT_UNSUBACK = 0xB0;
+const uint8_t MQTT_PINGREQ = 0xC0;
+const uint8_t MQTT_DISCONNECT = 0xE0;
+
+// Buffers are sized once so steady-state traffic never allocates in the client
+const size_t MQTT_BUFFER_RESERVE = 70000;
+
+void appendString(std::string& out, const std::string& s) {
+    out += (char)(s.size() >> 8);
+    out += (char)(s.size() & 0xFF);
+    out += s;
+}
+
+void appendRemainingLength(std::string& out, size_t length) {
+    do {
+        uint8_t digit = length % 128;
+        length /= 128;
+        out += (char)(length > 0 ? digit | 0x80 : digit);
+    } while (length > 0);
+}
+
+}  // namespace
+
+MqttClient::MqttClient(Client* client) : client(client) {
+    rxBuffer.reserve(MQTT_BUFFER_RESERVE);
+    rxTopic.reserve(256);
+    txTopic.reserve(256);
+    txPayload.reserve(MQTT_BUFFER_RESERVE);
+}
+
+int MqttClient::connect(IPAddress ip, uint16_t port) {
+    return connect(ip.toString().c_str(), port);
+}
+
+int MqttClient::connect(const char* host, uint16_t port) {
+    stop();
+    if (!client->connect(host, port)) {
+        lastConnectError = -2;
+        return 0;
+    }
+
+    std::string body;
+    appendString(body, "MQTT");
+    body += (char)4;  // Protocol level 3.1.1
+    uint8_t flags = 0x02;  // Clean session
+    if (!user.empty()) {
+        flags |= 0x80 | 0x40;
+    }
+    body += (char)flags;
+    unsigned long keepAliveSeconds = keepAliveMs / 1000;
+    body += (char)(keepAliveSeconds >> 8);
+    body += (char)(keepAliveSeconds & 0xFF);
+    appendString(body, clientId);
+    if (!user.empty()) {
+        appendString(body, user);
+        appendString(body, pass);
+    }
+    rxBuffer.clear();
+    if (!sendPacket(MQTT_CONNECT, body)) {
+        client->stop();
+        lastConnectError = -2;
+        return 0;
+    }
+
+    uint8_t type;
+    std::string reply;
+    if (!readPacket(connectionTimeoutMs, type, reply) || type != MQTT_CONNACK || reply.size() < 2 || reply[1] != 0) {
+        lastConnectError = reply.size() >= 2 ? reply[1] : -4;
+        client->stop();
+        return 0;
+    }
+    lastConnectError = 0;
+    sessionOpen = true;
+    return 1;
+}
+
+uint8_t MqttClient::connected() {
+    if (sessionOpen && !client->connected()) {
+        sessionOpen = false;
+    }
+    return sessionOpen ? 1 : 0;
+}
+
+void MqttClient::stop() {
+    if (inCallback) {
+        stopsFromCallback++;
+    }
+    if (sessionOpen) {
+        sendPacket(MQTT_DISCONNECT, std::string());
+    }
+    sessionOpen = false;
+    client->stop();
+    rxBuffer.clear();
+}
+
+bool MqttClient::sendPacket(uint8_t type, const std::string& body) {
+    std::string frame;
+    frame += (char)type;
+    appendRemainingLength(frame, body.size());
+    frame += body;
+    lastTx = millis();
+    return client->write((const uint8_t*)frame.data(), frame.size()) == frame.size();
+}
+
+bool MqttClient::readPacket(unsigned long timeoutMs, uint8_t& type, std::string& body) {
+    unsigned long start = millis();
+    while (true) {
+        // Complete packet buffered?
+        if (rxBuffer.size() >= 2) {
+            size_t length = 0;
+            size_t multiplier = 1;
+            size_t pos = 1;
+            bool complete = false;
+            while (pos < rxBuffer.size() && pos <= 4) {
+                uint8_t digit = (uint8_t)rxBuffer[pos++];
+                length += (digit & 0x7F) * multiplier;
+                multiplier *= 128;
+                if ((digit & 0x80) == 0) {
+                    complete = true;
+                    break;
+                }
+            }
+            if (complete && rxBuffer.size() >= pos + length) {
+                type = (uint8_t)rxBuffer[0];
+                body.assign(rxBuffer, pos, length);
+                rxBuffer.erase(0, pos + length);
+                return true;
+            }
+        }
+
+        uint8_t chunk[1024];
+        int n = client->available() > 0 ? client->read(chunk, sizeof(chunk)) : 0;
+        if (n > 0) {
+            rxBuffer.append((const char*)chunk, (size_t)n);
+            continue;
+        }
+        if (!client->connected()) {
+            sessionOpen = false;
+            return false;
+        }
+        if (millis() - start >= timeoutMs) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+}
+
+void MqttClient::handlePacket(uint8_t type, const std::string& body) {
+    if ((type & 0xF0) == MQTT_PUBLISH && body.size() >= 2) {
+        size_t topicLength = ((uint8_t)body[0] << 8) | (uint8_t)body[1];
+        size_t pos = 2 + topicLength;
+        if (((type >> 1) & 0x03) > 0) {
+            pos += 2;  // Packet id (QoS 1/2 are not requested, but skip it anyway)
+        }
+        if (pos > body.size()) {
+            return;
+        }
+        rxTopic.assign(body, 2, topicLength);
+        rxPayload = (const uint8_t*)body.data() + pos;
+        rxPayloadLength = body.size() - pos;
+        rxPayloadPos = 0;
+        if (messageCallback != nullptr) {
+            inCallback = true;
+            messageCallback(this, (int)rxPayloadLength);
+            inCallback = false;
+        }
+        rxPayload = nullptr;
+        rxPayloadLength = 0;
+        rxPayloadPos = 0;
+    } else if (type == MQTT_SUBACK || type == MQTT_UNSUBACK) {
+        if (body.size() >= 2) {
+            ackedType = type;
+            ackedPacketId = (uint16_t)(((uint8_t)body[0] << 8) | (uint8_t)body[1]);
+        }
+    }
+}
+
+void MqttClient::poll() {
+    if (!connected()) {
+        return;
+    }
+    uint8_t type;
+    static thread_local std::string body;
+    if (body.capacity() < MQTT_BUFFER_RESERVE) {
+        body.reserve(MQTT_BUFFER_RESERVE);
+    }
+    while (readPacket(0, type, body)) {
+        handlePacket(type, body);
+    }
+    if (sessionOpen && millis() - lastTx >= keepAliveMs) {
+        sendPacket(MQTT_PINGREQ, std::string());
+    }
+}
+
+bool MqttClient::waitForAck(uint8_t type, uint16_t packetId) {
+    // Inbound messages are delivered while waiting, as in the real client
+    unsigned long start = millis();
+    uint8_t receivedType;
+    std::string body;
+    while (millis() - start < connectionTimeoutMs) {
+        if (!readPacket(connectionTimeoutMs - (millis() - start), receivedType, body)) {
+            return false;
+        }
+        handlePacket(receivedType, body);
+        if (ackedType == type && ackedPacketId == packetId) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int MqttClient::subscribe(const char* topic, uint8_t qos) {
+    if (!connected()) {
+        return 0;
+    }
+    uint16_t packetId = nextPacketId++;
+    if (nextPacketId == 0) {
+        nextPacketId = 1;
+    }
+    std::string body;
+    body += (char)(packetId >> 8);
+    body += (char)(packetId & 0xFF);
+    appendString(body, topic);
+    body += (char)qos;
+    return sendPacket(MQTT_SUBSCRIBE, body) && waitForAck(MQTT_SUBACK, packetId) ? 1 : 0;
+}
+
+int MqttClient::unsubscribe(const char* topic) {
+    if (!connected()) {
+        return 0;
+    }
+    uint16_t packetId = nextPacketId++;
+    if (nextPacketId == 0) {
+        nextPacketId = 1;
+    }
+    std::string body;
+    body += (char)(packetId >> 8);
+    body += (char)(packetId & 0xFF);
+    appendString(body, topic);
+    return sendPacket(MQTT_UNSUBSCRIBE, body) && waitForAck(MQTT_UNSUBACK, packetId) ? 1 : 0;
+}
+
+int MqttClient::beginMessage(const char* topic, unsigned long size, bool retain, uint8_t qos, bool dup) {
+    return beginMessage(topic, retain, qos, dup);
+}
+
+int MqttClient::beginMessage(const char* topic, bool retain, uint8_t qos, bool dup) {
+    txOpen = true;
+    txTopic.assign(topic);
+    txRetain = retain;
+    txPayload.clear();
+    return 1;
+}
+
+size_t MqttClient::write(const uint8_t* buffer, size_t size) {
+    if (txOpen) {
+        txPayload.append((const char*)buffer, size);
+        return size;
+    }
+    return client->write(buffer, size);
+}
+
+int MqttClient::endMessage() {
+    if (!txOpen) {
+        return 0;
+    }
+    txOpen = false;
+    if (!connected()) {
+        return 0;
+    }
+
+    // Header, topic and payload go out in one write, built in the reserved payload buffer
+    uint8_t header[7];
+    size_t headerLength = 0;
+    header[headerLength++] = (uint8_t)(MQTT_PUBLISH | (txRetain ? 0x01 : 0x00));
+    size_t remaining = 2 + txTopic.size() + txPayload.size();
+    do {
+        uint8_t digit = remaining % 128;
+        remaining /= 128;
+        header[headerLength++] = remaining > 0 ? digit | 0x80 : digit;
+    } while (remaining > 0);
+    header[headerLength++] = (uint8_t)(txTopic.size() >> 8);
+    header[headerLength++] = (uint8_t)(txTopic.size() & 0xFF);
+    txPayload.insert(0, txTopic);
+    txPayload.insert(0, (const char*)header, headerLength);
+    lastTx = millis();
+    return client->write((const uint8_t*)txPayload.data(), txPayload.size()) == txPayload.size() ? 1 : 0;
+}
+
+int MqttClient::read() {
+    return rxPayloadPos < rxPayloadLength ? rxPayload[rxPayloadPos++] : -1;
+}
+
+int MqttClient::read(uint8_t* buffer, size_t size) {
+    size_t n = rxPayloadLength - rxPayloadPos < size ? rxPayloadLength - rxPayloadPos : size;
+    memcpy(buffer, rxPayload + rxPayloadPos, n);
+    rxPayloadPos += n;
+    return (int)n;
+}
+
+int MqttClient::peek() {
+    return rxPayloadPos < rxPayloadLength ? rxPayload[rxPayloadPos] : -1;
+}
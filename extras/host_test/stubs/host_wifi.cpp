@@ -0,0 +1,253 @@
+#include "WiFi.h"
+#include <atomic>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+WiFiClass WiFi;
+
+static std::atomic<int> hostWiFiStatus{WL_CONNECTED};
+
+void hostSetWiFiStatus(int status) {
+    hostWiFiStatus = status;
+}
+
+int WiFiClass::status() {
+    return hostWiFiStatus;
+}
+
+static bool resolveHost(const char* host, sockaddr_in& address) {
+    addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    addrinfo* result = nullptr;
+    if (getaddrinfo(host, nullptr, &hints, &result) != 0 || result == nullptr) {
+        return false;
+    }
+    address = *(const sockaddr_in*)result->ai_addr;
+    freeaddrinfo(result);
+    return true;
+}
+
+static sockaddr_in socketAddress(IPAddress ip, uint16_t port) {
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    uint8_t* octets = (uint8_t*)&address.sin_addr.s_addr;
+    for (int i = 0; i < 4; i++) {
+        octets[i] = ip[i];
+    }
+    return address;
+}
+
+bool WiFiClass::hostByName(const char* host, IPAddress& result) {
+    sockaddr_in address;
+    if (!resolveHost(host, address)) {
+        return false;
+    }
+    const uint8_t* octets = (const uint8_t*)&address.sin_addr.s_addr;
+    result = IPAddress(octets[0], octets[1], octets[2], octets[3]);
+    return true;
+}
+
+HostSocket::~HostSocket() {
+    close(fd);
+}
+
+int WiFiClient::connect(IPAddress ip, uint16_t port) {
+    stop();
+    int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return 0;
+    }
+    sockaddr_in address = socketAddress(ip, port);
+    if (::connect(fd, (const sockaddr*)&address, sizeof(address)) != 0) {
+        close(fd);
+        return 0;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    socket = std::make_shared<HostSocket>(fd);
+    return 1;
+}
+
+int WiFiClient::connect(const char* host, uint16_t port) {
+    IPAddress ip;
+    if (!WiFi.hostByName(host, ip)) {
+        return 0;
+    }
+    return connect(ip, port);
+}
+
+uint8_t WiFiClient::connected() {
+    if (socket == nullptr) {
+        return 0;
+    }
+    // Connected while the peer has not closed, or unread data is left
+    uint8_t c;
+    ssize_t n = recv(socket->fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    if (n > 0 || (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))) {
+        return 1;
+    }
+    return 0;
+}
+
+int WiFiClient::available() {
+    if (socket == nullptr) {
+        return 0;
+    }
+    int count = 0;
+    if (ioctl(socket->fd, FIONREAD, &count) != 0) {
+        return 0;
+    }
+    return count;
+}
+
+int WiFiClient::read() {
+    uint8_t c;
+    return read(&c, 1) == 1 ? c : -1;
+}
+
+int WiFiClient::read(uint8_t* buffer, size_t size) {
+    if (socket == nullptr) {
+        return -1;
+    }
+    ssize_t n = recv(socket->fd, buffer, size, MSG_DONTWAIT);
+    return n > 0 ? (int)n : -1;
+}
+
+int WiFiClient::peek() {
+    if (socket == nullptr) {
+        return -1;
+    }
+    uint8_t c;
+    return recv(socket->fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) == 1 ? c : -1;
+}
+
+size_t WiFiClient::write(const uint8_t* buffer, size_t size) {
+    if (socket == nullptr) {
+        return 0;
+    }
+    size_t sent = 0;
+    while (sent < size) {
+        ssize_t n = send(socket->fd, buffer + sent, size - sent, MSG_NOSIGNAL);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        sent += (size_t)n;
+    }
+    return sent;
+}
+
+WiFiServer::~WiFiServer() {
+    end();
+}
+
+void WiFiServer::begin() {
+    end();
+    listenFd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    int one = 1;
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in address = socketAddress(IPAddress(127, 0, 0, 1), port);
+    if (bind(listenFd, (const sockaddr*)&address, sizeof(address)) != 0 || listen(listenFd, maxClients) != 0) {
+        close(listenFd);
+        listenFd = -1;
+    }
+}
+
+void WiFiServer::end() {
+    if (listenFd >= 0) {
+        close(listenFd);
+        listenFd = -1;
+    }
+}
+
+WiFiClient WiFiServer::available() {
+    if (listenFd < 0) {
+        return WiFiClient();
+    }
+    int fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0) {
+        return WiFiClient();
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return WiFiClient(fd);
+}
+
+bool WiFiServer::hasClient() {
+    if (listenFd < 0) {
+        return false;
+    }
+    fd_set readSet;
+    FD_ZERO(&readSet);
+    FD_SET(listenFd, &readSet);
+    timeval timeout = {0, 0};
+    return select(listenFd + 1, &readSet, nullptr, nullptr, &timeout) > 0;
+}
+
+uint8_t WiFiUDP::begin(uint16_t port) {
+    stop();
+    fd = ::socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    sockaddr_in address = socketAddress(IPAddress(127, 0, 0, 1), port);
+    if (fd < 0 || bind(fd, (const sockaddr*)&address, sizeof(address)) != 0) {
+        stop();
+        return 0;
+    }
+    return 1;
+}
+
+void WiFiUDP::stop() {
+    if (fd >= 0) {
+        close(fd);
+        fd = -1;
+    }
+}
+
+int WiFiUDP::beginPacket(IPAddress ip, uint16_t port) {
+    if (fd < 0) {
+        fd = ::socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    }
+    txAddress = ip;
+    txPort = port;
+    txPacket.clear();
+    return fd >= 0 ? 1 : 0;
+}
+
+int WiFiUDP::beginPacket(const char* host, uint16_t port) {
+    IPAddress ip;
+    return WiFi.hostByName(host, ip) ? beginPacket(ip, port) : 0;
+}
+
+size_t WiFiUDP::write(const uint8_t* buffer, size_t size) {
+    txPacket.insert(txPacket.end(), buffer, buffer + size);
+    return size;
+}
+
+int WiFiUDP::endPacket() {
+    sockaddr_in address = socketAddress(txAddress, txPort);
+    ssize_t n = sendto(fd, txPacket.data(), txPacket.size(), 0, (const sockaddr*)&address, sizeof(address));
+    return n == (ssize_t)txPacket.size() ? 1 : 0;
+}
+
+int WiFiUDP::parsePacket() {
+    rxPacket.resize(1500);
+    ssize_t n = fd >= 0 ? recv(fd, rxPacket.data(), rxPacket.size(), MSG_DONTWAIT) : -1;
+    rxPacket.resize(n > 0 ? (size_t)n : 0);
+    rxPos = 0;
+    return (int)rxPacket.size();
+}
+
+int WiFiUDP::read(uint8_t* buffer, size_t size) {
+    size_t n = rxPacket.size() - rxPos < size ? rxPacket.size() - rxPos : size;
+    memcpy(buffer, rxPacket.data() + rxPos, n);
+    rxPos += n;
+    return (int)n;
+}
@@ -0,0 +1,12 @@
+// lwIP's BSD socket API maps directly onto the host's
+#ifndef HOST_LWIP_SOCKETS_H
+#define HOST_LWIP_SOCKETS_H
+
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#endif // HOST_LWIP_SOCKETS_H
@@ -0,0 +1,102 @@
+// Subscription dispatch benchmark: 120 filters shaped like per-device command, config and
+// sensor filters, dispatched through the trie and through a per-filter linear scan.
+//
+// Built with MAX_SUBSCRIPTIONS=128; the default of 8 cannot hold the filter set.
+//
+// Usage: subscription_bench [messages]
+#include "host_test.h"
+#include <random>
+
+// Matches one filter against a topic without allocating: the cost of a linear scan per filter
+static bool linearMatch(const char* filter, const char* topic) {
+    if (*topic == '$' && (*filter == '+' || *filter == '#')) {
+        return false;
+    }
+    while (*filter) {
+        if (*filter == '#') {
+            return true;
+        }
+        if (*filter == '+') {
+            while (*topic && *topic != '/') {
+                topic++;
+            }
+            filter++;
+        } else {
+            while (*filter && *filter != '/' && *filter == *topic) {
+                filter++;
+                topic++;
+            }
+            if ((*filter && *filter != '/') || (*topic && *topic != '/')) {
+                return false;
+            }
+        }
+        if (!*filter) {
+            return !*topic;
+        }
+        if (!*topic) {
+            return strcmp(filter, "/#") == 0;
+        }
+        filter++;
+        topic++;
+    }
+    return !*topic;
+}
+
+static long handled = 0;
+static void onMessage(const char* topic, const char* payload, size_t length, void* context) {
+    handled++;
+}
+
+int main(int argc, char** argv) {
+    long messages = argc > 1 ? atol(argv[1]) : 2000000;
+    std::mt19937 random(42);
+    static ESPRazorBlade rb;
+    CHECK(hostAttachMqttTask(rb));
+
+    std::vector<std::string> filters;
+    for (int i = 0; i < 40; i++) {
+        filters.push_back("site/dev" + std::to_string(i) + "/cmd/+");
+        filters.push_back("site/dev" + std::to_string(i) + "/config/#");
+        filters.push_back("site/+/sensor" + std::to_string(i) + "/value");
+    }
+    for (auto& filter : filters) {
+        CHECK(rb.subscribe(filter.c_str(), onMessage));
+    }
+
+    // A third of the device ids have no filters; a quarter of the topics match nothing
+    std::vector<std::string> topics;
+    for (int i = 0; i < 1000; i++) {
+        std::string device = std::to_string(random() % 60);
+        switch (random() % 4) {
+            case 0: topics.push_back("site/dev" + device + "/cmd/reboot"); break;
+            case 1: topics.push_back("site/dev" + device + "/config/telemetry/rate"); break;
+            case 2: topics.push_back("site/dev" + device + "/sensor" + device + "/value"); break;
+            default: topics.push_back("other/topic/with/levels"); break;
+        }
+    }
+
+    double start = hostSeconds();
+    for (long i = 0; i < messages; i++) {
+        rb.dispatchMessage(topics[i % 1000].c_str(), "1", 1);
+    }
+    double trieSeconds = hostSeconds() - start;
+
+    long linearMatches = 0;
+    long linearMessages = messages / 10;
+    start = hostSeconds();
+    for (long i = 0; i < linearMessages; i++) {
+        for (auto& filter : filters) {
+            linearMatches += linearMatch(filter.c_str(), topics[i % 1000].c_str()) ? 1 : 0;
+        }
+    }
+    double linearSeconds = hostSeconds() - start;
+
+    printf("subscription_bench: %zu filters, %ld messages\n", filters.size(), messages);
+    printf("subscription_bench: trie   %.2f M msg/s (%.0f ns/msg), %ld handler calls\n",
+           messages / trieSeconds / 1e6, trieSeconds / messages * 1e9, handled);
+    printf("subscription_bench: linear %.2f M msg/s (%.0f ns/msg), %ld matches\n",
+           linearMessages / linearSeconds / 1e6, linearSeconds / linearMessages * 1e9, linearMatches * 10);
+    printf("subscription_bench: trie speedup %.1fx\n", (linearSeconds / linearMessages) / (trieSeconds / messages));
+    CHECK(handled == linearMatches * 10);
+    hostExit(0);
+}
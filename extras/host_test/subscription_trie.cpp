@@ -0,0 +1,168 @@
+// Subscription trie test: dispatch results against a reference matcher over random filter
+// sets, then subscribe/unsubscribe churn from several threads while the MQTT task dispatches.
+// Fails on a wrong match set, or on a handler running after unsubscribe() returned.
+//
+// Built with MAX_SUBSCRIPTIONS=128 so rounds can hold up to 120 filters.
+//
+// Usage: subscription_trie [seed]
+#include "host_test.h"
+#include <random>
+
+static thread_local std::vector<int>* hits;
+static void onHit(const char* topic, const char* payload, size_t length, void* context) {
+    if (hits) {
+        hits->push_back((int)(intptr_t)context);
+    }
+}
+
+static const int CHURN_THREADS = 4;
+static std::atomic<bool> live[CHURN_THREADS];  // True between subscribe and unsubscribe returning
+static std::atomic<long> delivered{0};
+static std::atomic<long> lateCalls{0};
+
+static void onChurn(const char* topic, const char* payload, size_t length, void* context) {
+    int i = (int)(intptr_t)context;
+    if (!live[i]) {
+        lateCalls++;
+    }
+    delivered++;
+    std::this_thread::sleep_for(std::chrono::microseconds(20));  // Widen the race window
+    if (!live[i]) {
+        lateCalls++;
+    }
+}
+
+static const char* levels[] = {"dev", "sensor", "a", "b", "temp", "hum", "x1", "cmd", "status", "$SYS", "", "longer_level"};
+static const int LEVEL_COUNT = sizeof(levels) / sizeof(levels[0]);
+
+int main(int argc, char** argv) {
+    std::mt19937 random(argc > 1 ? atoi(argv[1]) : 42);
+    static ESPRazorBlade rb;
+    CHECK(hostAttachMqttTask(rb));
+
+    // Random filter sets against random topics, including empty levels and $ topics
+    long checks = 0;
+    long mismatches = 0;
+    for (int round = 0; round < 200; round++) {
+        std::vector<std::string> filters;
+        int wanted = 1 + random() % 120;
+        for (int i = 0; i < wanted; i++) {
+            std::string filter;
+            int depth = 1 + random() % 5;
+            for (int d = 0; d < depth; d++) {
+                if (d > 0) {
+                    filter += "/";
+                }
+                int kind = random() % 10;
+                if (kind == 0 && d == depth - 1) {
+                    filter += "#";
+                } else if (kind < 3) {
+                    filter += "+";
+                } else {
+                    filter += levels[random() % LEVEL_COUNT];
+                }
+            }
+            if (filter.empty() || std::find(filters.begin(), filters.end(), filter) != filters.end()) {
+                continue;
+            }
+            CHECK(rb.subscribe(filter.c_str(), onHit, (void*)(intptr_t)filters.size()));
+            filters.push_back(filter);
+        }
+
+        for (int q = 0; q < 300; q++) {
+            std::string topic;
+            int depth = 1 + random() % 6;
+            for (int d = 0; d < depth; d++) {
+                if (d > 0) {
+                    topic += "/";
+                }
+                topic += levels[random() % LEVEL_COUNT];
+            }
+            std::vector<int> got;
+            hits = &got;
+            rb.dispatchMessage(topic.c_str(), "p", 1);
+            hits = nullptr;
+            std::vector<int> want;
+            for (size_t i = 0; i < filters.size(); i++) {
+                if (HostBroker::topicMatches(filters[i], topic)) {  // Reference matcher
+                    want.push_back((int)i);
+                }
+            }
+            std::sort(got.begin(), got.end());
+            // At most SUBSCRIPTION_MAX_MATCHES (8) handlers run per message
+            bool capped = want.size() > 8 && got.size() == 8 &&
+                          std::includes(want.begin(), want.end(), got.begin(), got.end());
+            if (got != want && !capped) {
+                if (mismatches++ < 5) {
+                    fprintf(stderr, "mismatch: topic '%s' matched %zu filters, expected %zu\n",
+                            topic.c_str(), got.size(), want.size());
+                }
+            }
+            checks++;
+        }
+
+        for (size_t i = 0; i < filters.size(); i += 2) {
+            CHECK(rb.unsubscribe(filters[i].c_str()));
+        }
+        for (size_t i = 1; i < filters.size(); i += 2) {
+            CHECK(rb.unsubscribe(filters[i].c_str()));
+        }
+        rb.pendingUnsubscribeCount = 0;  // No broker session to mirror them to
+    }
+    printf("subscription_trie: %ld topics checked, %ld mismatches\n", checks, mismatches);
+    CHECK(mismatches == 0);
+    CHECK(rb.subscriptionSets[rb.activeSubscriptionSet].nodeCount == 1);
+
+    // Churn: threads subscribe and unsubscribe while another thread acts as the MQTT task
+    std::atomic<bool> attached{false};
+    std::atomic<bool> stop{false};
+    std::thread mqtt([&] {
+        rb.mqttTaskHandle = xTaskGetCurrentTaskHandle();
+        attached = true;
+        long k = 0;
+        while (!stop) {
+            __atomic_add_fetch(&rb.schedulerEpoch, 1, __ATOMIC_SEQ_CST);
+            std::string topic = "churn/" + std::to_string(k++ % CHURN_THREADS) + "/x";
+            rb.dispatchMessage(topic.c_str(), "v", 1);
+            __atomic_add_fetch(&rb.schedulerEpoch, 1, __ATOMIC_SEQ_CST);
+        }
+    });
+    CHECK(hostWaitFor([&] { return attached.load(); }, 5000));
+
+    std::atomic<long> failedOperations{0};
+    std::vector<std::thread> writers;
+    for (int w = 0; w < CHURN_THREADS; w++) {
+        writers.emplace_back([&, w] {
+            std::string filter = w == 0 ? "churn/+/x" : w == 1 ? "churn/1/#" : "churn/" + std::to_string(w) + "/x";
+            for (int i = 0; i < 3000; i++) {
+                live[w] = true;
+                if (!rb.subscribe(filter.c_str(), onChurn, (void*)(intptr_t)w)) {
+                    failedOperations++;
+                }
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+                if (!rb.unsubscribe(filter.c_str())) {
+                    failedOperations++;
+                }
+                live[w] = false;
+                if (xSemaphoreTake(rb.subscriptionMutex, portMAX_DELAY) == pdTRUE) {
+                    rb.pendingUnsubscribeCount = 0;
+                    xSemaphoreGive(rb.subscriptionMutex);
+                }
+            }
+        });
+    }
+    for (auto& thread : writers) {
+        thread.join();
+    }
+    stop = true;
+    mqtt.join();
+
+    printf("subscription_trie: churn delivered=%ld late_handler_calls=%ld failed_operations=%ld\n",
+           delivered.load(), lateCalls.load(), failedOperations.load());
+    CHECK(delivered > 0);
+    CHECK(lateCalls == 0);
+    CHECK(failedOperations == 0);
+    CHECK(rb.subscriptionSets[rb.activeSubscriptionSet].nodeCount == 1);
+    printf("subscription_trie: PASS\n");
+    hostExit(0);
+}
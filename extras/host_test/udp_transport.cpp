@@ -0,0 +1,267 @@
+// UDP telemetry transport test: several devices with the same topic id base send telemetry
+// to a gateway that maps (sender address, sender port, topic id) to the topic from the
+// devices' REGISTER datagrams, as extras/udp_gateway.py does. Fails if a datagram arrives
+// before its REGISTER, if a value is attributed to the wrong device, or if a restarted
+// gateway does not learn the topic ids again. Also measures the application bytes of one
+// telemetry message over MQTT and over UDP, and the messages/sec of the same telemetry sent
+// back to back over each transport; fails if MQTT loses a message, if UDP loses more than
+// 1% on loopback or if either rate falls below MIN_MESSAGES_PER_SECOND.
+//
+// Built with TELEMETRY_TRANSPORT_UDP and UDP_REGISTER_INTERVAL_MS=500.
+//
+// Usage: udp_transport [devices] [seconds] [rate seconds]
+#include "host_test.h"
+#include <set>
+
+static const uint8_t REGISTER = 0x0A;
+static const uint8_t PUBLISH = 0x0C;
+
+// Timed run: messages not yet at the broker or gateway before the sender waits, and the rate
+// each transport must reach on the host
+static const long IN_FLIGHT = 256;
+static const double MIN_MESSAGES_PER_SECOND = 2000;
+
+// Each device reports its own index, so a value under another device's topic is a misroute
+template <int N>
+static void deviceIndex(char* buffer, size_t size) {
+    snprintf(buffer, size, "%d", N);
+}
+static const TelemetryBufferCallback DEVICE_CALLBACKS[] = {
+    deviceIndex<0>, deviceIndex<1>, deviceIndex<2>, deviceIndex<3>,
+    deviceIndex<4>, deviceIndex<5>, deviceIndex<6>, deviceIndex<7>,
+};
+static const int MAX_DEVICES = sizeof(DEVICE_CALLBACKS) / sizeof(DEVICE_CALLBACKS[0]);
+
+static void rssi(char* buffer, size_t size) {
+    snprintf(buffer, size, "-61");
+}
+
+class Gateway {
+public:
+    uint16_t start() {
+        fd = socket(AF_INET, SOCK_DGRAM, 0);
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t length = sizeof(address);
+        CHECK(bind(fd, (sockaddr*)&address, sizeof(address)) == 0);
+        CHECK(getsockname(fd, (sockaddr*)&address, &length) == 0);
+        timeval timeout = {0, 100000};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        thread = std::thread([this] { receiveLoop(); });
+        thread.detach();
+        return ntohs(address.sin_port);
+    }
+
+    void restart() {  // Forget every registration, as a restarted gateway would
+        std::lock_guard<std::mutex> guard(lock);
+        topics.clear();
+    }
+
+    std::mutex lock;
+    std::map<std::string, std::vector<std::string>> forwarded;  // Topic -> payloads
+    std::map<std::string, size_t> datagramBytes;                // Topic -> size of the last PUBLISH
+    std::map<std::string, size_t> registerBytes;                // Topic -> size of the last REGISTER
+    long registers = 0;
+    long unknown = 0;
+
+private:
+    void receiveLoop() {
+        uint8_t datagram[512];
+        for (;;) {
+            sockaddr_in sender;
+            socklen_t length = sizeof(sender);
+            ssize_t n = recvfrom(fd, datagram, sizeof(datagram), 0, (sockaddr*)&sender, &length);
+            if (n < 2 || datagram[0] != n) {
+                continue;  // The library only sends the 1-byte length form
+            }
+            uint64_t source = ((uint64_t)ntohl(sender.sin_addr.s_addr) << 16) | ntohs(sender.sin_port);
+            std::lock_guard<std::mutex> guard(lock);
+            if (datagram[1] == REGISTER && n >= 6) {
+                uint16_t topicId = (uint16_t)((datagram[2] << 8) | datagram[3]);
+                std::string topic((const char*)datagram + 6, n - 6);
+                topics[{source, topicId}] = topic;
+                registerBytes[topic] = n;
+                registers++;
+            } else if (datagram[1] == PUBLISH && n >= 7) {
+                uint16_t topicId = (uint16_t)((datagram[3] << 8) | datagram[4]);
+                auto topic = topics.find({source, topicId});
+                if (topic == topics.end()) {
+                    unknown++;
+                    continue;
+                }
+                forwarded[topic->second].push_back(std::string((const char*)datagram + 7, n - 7));
+                datagramBytes[topic->second] = n;
+            }
+        }
+    }
+
+    int fd = -1;
+    std::thread thread;
+    std::map<std::pair<uint64_t, uint16_t>, std::string> topics;
+};
+
+int main(int argc, char** argv) {
+    int devices = argc > 1 ? std::min(atoi(argv[1]), MAX_DEVICES) : MAX_DEVICES;
+    int seconds = argc > 2 ? atoi(argv[2]) : 2;
+    double rateSeconds = argc > 3 ? atof(argv[3]) : 1.0;
+    static HostBroker broker;
+    hostSetBroker("127.0.0.1", broker.start());
+    static Gateway gateway;
+    hostSetUdpGateway(gateway.start());
+
+    // Bytes of one telemetry message over each transport, from a quiet instance
+    static ESPRazorBlade probe("my-esp32");
+    CHECK(hostAttachMqttTask(probe));
+    CHECK(probe.registerTelemetry("my-esp32/telemetry/wifi_rssi", rssi, 60000));
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    long before = broker.bytesReceived();
+    CHECK(probe.publish("my-esp32/telemetry/wifi_rssi", "-61"));
+    CHECK(hostWaitFor([&] { return broker.bytesReceived() > before; }, 2000));
+    long mqttBytes = broker.bytesReceived() - before;
+    probe.registerUdpTopicIds(millis());
+    CHECK(probe.sendUdpTelemetry(0, "-61"));
+    size_t udpBytes = 0;
+    size_t registerBytes = 0;
+    CHECK(hostWaitFor([&] {
+        std::lock_guard<std::mutex> guard(gateway.lock);
+        udpBytes = gateway.datagramBytes["my-esp32/telemetry/wifi_rssi"];
+        registerBytes = gateway.registerBytes["my-esp32/telemetry/wifi_rssi"];
+        return udpBytes > 0;
+    }, 2000));
+    printf("udp_transport: my-esp32/telemetry/wifi_rssi = -61: MQTT PUBLISH %ld bytes, MQTT-SN PUBLISH %zu bytes, "
+           "MQTT-SN REGISTER %zu bytes (measured, without transport headers)\n", mqttBytes, udpBytes, registerBytes);
+    CHECK(mqttBytes == 35);
+    CHECK(udpBytes == 10);
+
+    // Messages/sec: the same telemetry sent back to back from the MQTT task over each
+    // transport, with at most IN_FLIGHT messages not yet delivered. Rates count delivered
+    // messages, up to the arrival of the last one
+    struct Rate {
+        long sent;
+        long delivered;
+        double seconds;
+    };
+    auto timedRun = [&](const std::function<bool()>& send, const std::function<long()>& delivered) {
+        long base = delivered();
+        Rate rate = {0, 0, 0};
+        double start = hostSeconds();
+        while (hostSeconds() - start < rateSeconds) {
+            if (rate.sent - (delivered() - base) >= IN_FLIGHT) {
+                std::this_thread::sleep_for(std::chrono::microseconds(50));  // Leave the CPU to the receiver
+                continue;
+            }
+            CHECK(send());
+            rate.sent++;
+        }
+        // Drain until everything arrived or nothing more arrives for 100 ms (lost datagrams)
+        double lastArrival = hostSeconds();
+        rate.delivered = delivered() - base;
+        while (rate.delivered < rate.sent && hostSeconds() - lastArrival < 0.1) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            long now = delivered() - base;
+            if (now != rate.delivered) {
+                rate.delivered = now;
+                lastArrival = hostSeconds();
+            }
+        }
+        rate.seconds = lastArrival - start;
+        return rate;
+    };
+    Rate mqtt = timedRun([&] { return probe.publish("my-esp32/telemetry/wifi_rssi", "-61"); },
+                         [&] { return broker.publishesReceived(); });
+    Rate udp = timedRun([&] { return probe.sendUdpTelemetry(0, "-61"); }, [&] {
+        std::lock_guard<std::mutex> guard(gateway.lock);
+        return (long)gateway.forwarded["my-esp32/telemetry/wifi_rssi"].size();
+    });
+    double mqttRate = mqtt.delivered / mqtt.seconds;
+    double udpRate = udp.delivered / udp.seconds;
+    printf("udp_transport: same telemetry for %.1f s: MQTT %.0f messages/s (%ld of %ld delivered, %.0f KB/s), "
+           "UDP %.0f messages/s (%ld of %ld delivered, %.0f KB/s), UDP/MQTT %.2fx (host loopback)\n", rateSeconds,
+           mqttRate, mqtt.delivered, mqtt.sent, mqttRate * mqttBytes / 1e3, udpRate, udp.delivered, udp.sent,
+           udpRate * udpBytes / 1e3, udpRate / mqttRate);
+    CHECK(mqtt.delivered == mqtt.sent);
+    CHECK(udp.delivered >= udp.sent * 0.99);
+    CHECK(mqttRate >= MIN_MESSAGES_PER_SECOND);
+    CHECK(udpRate >= MIN_MESSAGES_PER_SECOND);
+
+    // Devices with identical topic ids: slot 0 is the device metric, the built-ins follow
+    std::vector<ESPRazorBlade*> fleet;
+    for (int d = 0; d < devices; d++) {
+        char id[24];
+        snprintf(id, sizeof(id), "udp-%02d", d);
+        fleet.push_back(new ESPRazorBlade(id));
+        CHECK(fleet.back()->registerTelemetry((std::string(id) + "/telemetry/device").c_str(), DEVICE_CALLBACKS[d], 50));
+        CHECK(fleet.back()->begin());
+    }
+    CHECK(hostWaitFor([&] {
+        for (auto* rb : fleet) {
+            if (!rb->isMQTTConnected()) {
+                return false;
+            }
+        }
+        return true;
+    }, 20000));
+
+    // A metric registered while running gets its id registered before its first datagram
+    std::this_thread::sleep_for(std::chrono::milliseconds(seconds * 500));
+    CHECK(fleet[0]->registerTelemetry("udp-00/telemetry/late", DEVICE_CALLBACKS[0], 50));
+    std::this_thread::sleep_for(std::chrono::milliseconds(seconds * 500));
+
+    auto checkRouting = [&](std::map<std::string, size_t>& counts) {
+        std::lock_guard<std::mutex> guard(gateway.lock);
+        long misrouted = 0;
+        for (int d = 0; d < devices; d++) {
+            char prefix[24];
+            snprintf(prefix, sizeof(prefix), "udp-%02d/", d);
+            for (auto& topic : gateway.forwarded) {
+                if (topic.first.compare(0, strlen(prefix), prefix) != 0 || topic.first.find("/telemetry/device") == std::string::npos) {
+                    continue;
+                }
+                counts[topic.first] = topic.second.size();
+                for (auto& value : topic.second) {
+                    misrouted += atoi(value.c_str()) == d ? 0 : 1;
+                }
+            }
+        }
+        return misrouted;
+    };
+    std::map<std::string, size_t> counts;
+    long misrouted = checkRouting(counts);
+    long unknown;
+    long registers;
+    size_t late;
+    {
+        std::lock_guard<std::mutex> guard(gateway.lock);
+        unknown = gateway.unknown;
+        registers = gateway.registers;
+        late = gateway.forwarded["udp-00/telemetry/late"].size();
+    }
+    printf("udp_transport: %d devices sharing topic ids, %ld REGISTER datagrams, %ld values misrouted, "
+           "%ld datagrams before their REGISTER\n", devices, registers, misrouted, unknown);
+    CHECK(misrouted == 0);
+    CHECK(unknown == 0);
+    CHECK((int)counts.size() == devices);
+    for (auto& count : counts) {
+        CHECK(count.second > 0);
+    }
+    CHECK(late > 0);
+
+    // A restarted gateway drops datagrams until the periodic REGISTER comes round again
+    gateway.restart();
+    std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+    std::map<std::string, size_t> after;
+    CHECK(checkRouting(after) == 0);
+    long recovered = 0;
+    for (auto& count : after) {
+        recovered += count.second > counts[count.first] ? 1 : 0;
+    }
+    {
+        std::lock_guard<std::mutex> guard(gateway.lock);
+        printf("udp_transport: after a gateway restart %ld of %d devices recovered, %ld datagrams dropped meanwhile\n",
+               recovered, devices, gateway.unknown);
+    }
+    CHECK(recovered == devices);
+    printf("udp_transport: PASS\n");
+    hostExit(0);
+}
@@ -0,0 +1,126 @@
+// MQTT task wake-up test: how long an inbound config update and read command take from
+// the broker to their handler, how many times an idle connected MQTT task wakes per minute,
+// and how long a message queued by another task waits before the MQTT task sends it.
+//
+// The idle window spans several MQTT_MAX_IDLE_WAIT_MS caps (5 s) and is scaled to a minute.
+// Fails if a handler waits for a poll interval or the idle cap, if the idle task wakes more
+// often than its idle cap and telemetry deadlines explain, or if the idle wait cannot be woken.
+//
+// Usage: wake_latency [idle seconds]   (default 20, at least 15)
+#include "host_test.h"
+
+static std::atomic<double> readAt{0};
+static std::atomic<long> reads{0};
+static void readProbe(char* buffer, size_t size) {
+    readAt = hostSeconds();
+    reads++;
+    snprintf(buffer, size, "1");
+}
+
+// Config updates land in the registry; the test thread watches the interval change
+static unsigned long wifiInterval(ESPRazorBlade& rb) {
+    ESPRazorBlade::TelemetryConfig config;
+    int slot = rb.findTelemetrySlot("host-device/telemetry/wifi_rssi", config);
+    return slot >= 0 ? config.intervalMs : 0;
+}
+
+int main(int argc, char** argv) {
+    int idleSeconds = argc > 1 ? std::max(atoi(argv[1]), 15) : 20;
+    static HostBroker broker;
+    hostSetBroker("127.0.0.1", broker.start());
+
+    std::mutex lock;
+    std::map<unsigned, double> queuedAt;
+    std::vector<double> latencies;
+    broker.onPublish([&](const std::string& clientId, const std::string& topic, const std::string& payload) {
+        double now = hostSeconds();
+        if (topic == "host-device/wake") {
+            std::lock_guard<std::mutex> guard(lock);
+            auto queued = queuedAt.find((unsigned)atol(payload.c_str()));
+            if (queued != queuedAt.end()) {
+                latencies.push_back((now - queued->second) * 1e6);
+                queuedAt.erase(queued);
+            }
+        }
+    });
+
+    static ESPRazorBlade rb;
+    CHECK(rb.registerTelemetry("host-device/telemetry/probe", readProbe, 86400000));
+    rb.begin();
+    CHECK(rb.wakeSocket >= 0);  // Opened by begin(), not later by the MQTT task
+    CHECK(hostWaitFor([&] { return rb.isMQTTConnected() && rb.configTimeoutsPublished; }, 10000));
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));  // Let the connect burst settle
+
+    // Inbound: broker publish to the read callback (command) and to the registry update (config),
+    // each sent while the task is in its idle wait
+    const int INBOUND = 100;
+    std::vector<double> commandLatencies;
+    std::vector<double> configLatencies;
+    for (int n = 0; n < INBOUND; n++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        long before = reads;
+        double sent = hostSeconds();
+        broker.publish("host-device/cmd/read/probe", "wake-" + std::to_string(n));
+        CHECK(hostWaitFor([&] { return reads > before; }, 5000));
+        commandLatencies.push_back((readAt - sent) * 1e6);
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        unsigned long interval = n % 2 ? 30000 : 30001;
+        sent = hostSeconds();
+        broker.publish("host-device/config/telemetry/timeouts/wifi_rssi", std::to_string(interval));
+        while (wifiInterval(rb) != interval) {
+            CHECK(hostSeconds() - sent < 5);
+            std::this_thread::sleep_for(std::chrono::microseconds(20));  // Leave the CPU to the MQTT task
+        }
+        configLatencies.push_back((hostSeconds() - sent) * 1e6);
+    }
+    printf("wake_latency: broker-to-handler latency over %d messages: read command p50 %.0f us, p99 %.0f us; "
+           "config update p50 %.0f us, p99 %.0f us\n", INBOUND, hostPercentile(commandLatencies, 50),
+           hostPercentile(commandLatencies, 99), hostPercentile(configLatencies, 50),
+           hostPercentile(configLatencies, 99));
+    CHECK(hostPercentile(commandLatencies, 99) < 20000);  // Far below the 100 ms poll interval
+    CHECK(hostPercentile(configLatencies, 99) < 20000);
+
+    // Idle: each connected scheduler cycle moves the epoch by two. The config updates above
+    // made wifi_rssi publish right away; give its next deadline a clean start
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    uint32_t epoch = __atomic_load_n(&rb.schedulerEpoch, __ATOMIC_SEQ_CST);
+    double idleStart = hostSeconds();
+    std::this_thread::sleep_for(std::chrono::seconds(idleSeconds));
+    uint32_t idleCycles = (__atomic_load_n(&rb.schedulerEpoch, __ATOMIC_SEQ_CST) - epoch) / 2;
+    double perMinute = idleCycles * 60.0 / (hostSeconds() - idleStart);
+
+    // Expected per minute: 12 idle caps (5 s), the built-in telemetry deadlines (wifi_rssi and
+    // free_heap every 30 s, time_alive every 60 s) and one PINGRESP. A cycle that handles
+    // several of these at once counts once, so this is an upper bound
+    const double IDLE_WAKES_PER_MINUTE_MAX = 12 + 2 + 2 + 1 + 1;
+
+    // Wake-up: queue directly (the path publish() takes when the connection is busy) and
+    // time until the broker has the message
+    const unsigned WAKES = 200;
+    for (unsigned n = 0; n < WAKES; n++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));  // Task back in its idle wait
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            queuedAt[n] = hostSeconds();
+        }
+        CHECK(rb.enqueueMessage("host-device/wake", String(n).c_str(), false, PRIORITY_NORMAL));
+    }
+    hostWaitFor([&] {
+        std::lock_guard<std::mutex> guard(lock);
+        return queuedAt.empty();
+    }, 10000);
+
+    std::lock_guard<std::mutex> guard(lock);
+    printf("wake_latency: idle MQTT task woke %u times in %d s: %.1f per minute (bound %.0f)\n", idleCycles,
+           idleSeconds, perMinute, IDLE_WAKES_PER_MINUTE_MAX);
+    printf("wake_latency: queued-to-broker latency over %zu wake-ups: p50 %.0f us, p99 %.0f us, max %.0f us\n",
+           latencies.size(), hostPercentile(latencies, 50), hostPercentile(latencies, 99),
+           hostPercentile(latencies, 100));
+    CHECK(queuedAt.empty());
+    CHECK(perMinute <= IDLE_WAKES_PER_MINUTE_MAX);
+    CHECK(perMinute >= 60.0 / 5 * 0.75);  // The idle cap still wakes the task for the keepalive
+    CHECK(hostPercentile(latencies, 99) < 20000);  // Far below the 5 s idle wait
+    printf("wake_latency: PASS\n");
+    hostExit(0);
+}
@@ -0,0 +1,127 @@
+#!/usr/bin/env python3
+"""
+ESPRazorBlade UDP gateway stand-in
+
+Receives the MQTT-SN style telemetry datagrams sent when TELEMETRY_TRANSPORT_UDP
+is enabled, maps predefined topic ids back to topics, and republishes them to an
+MQTT broker. Intended for local testing on Linux, not as a production gateway.
+
+Topic ids are only unique per device, so they are kept per sender address: each
+device sends an MQTT-SN REGISTER datagram (topic id and full topic name) for every
+metric before using its id, and repeats it periodically. PUBLISH datagrams from a
+sender whose id is not registered yet are counted as unknown and dropped.
+
+This is not standard MQTT-SN registration: the device chooses the topic id in its
+REGISTER (MQTT-SN clients send 0 and take the id from the gateway's REGACK), no
+REGACK is expected, and no CONNECT precedes the PUBLISH datagrams.
+
+Usage:
+    pip install paho-mqtt
+    python3 udp_gateway.py --broker localhost            # forward to the broker
+    python3 udp_gateway.py --broker localhost --no-forward  # only print and count
+
+Every 10 seconds the gateway prints datagrams/sec and datagram bytes/sec received.
+"""
+
+import argparse
+import socket
+import struct
+import time
+
+import paho.mqtt.client as mqtt
+
+MQTTSN_REGISTER = 0x0A
+MQTTSN_PUBLISH = 0x0C
+TOPIC_ID_TYPE_PREDEFINED = 0x01
+
+
+def message_body(datagram):
+    """Return the MQTT-SN message after the length field (type first), or None."""
+    if len(datagram) < 2:
+        return None
+    if datagram[0] == 0x01:
+        # 3-byte length form
+        if len(datagram) < 4:
+            return None
+        length = struct.unpack(">H", datagram[1:3])[0]
+        return datagram[3:length]
+    return datagram[1:datagram[0]]
+
+
+def parse_register(body):
+    """Return (topic_id, topic) for an MQTT-SN REGISTER, or None."""
+    if len(body) < 6 or body[0] != MQTTSN_REGISTER:
+        return None
+    topic_id = struct.unpack(">H", body[1:3])[0]
+    return topic_id, body[5:].decode(errors="replace")
+
+
+def parse_publish(body):
+    """Return (topic_id, payload) for an MQTT-SN PUBLISH, or None."""
+    if len(body) < 6 or body[0] != MQTTSN_PUBLISH:
+        return None
+    flags = body[1]
+    if flags & 0x03 != TOPIC_ID_TYPE_PREDEFINED:
+        return None
+    topic_id = struct.unpack(">H", body[2:4])[0]
+    return topic_id, body[6:]
+
+
+def main():
+    parser = argparse.ArgumentParser(description="ESPRazorBlade UDP gateway stand-in")
+    parser.add_argument("--broker", default="localhost", help="MQTT broker host")
+    parser.add_argument("--broker-port", type=int, default=1883, help="MQTT broker port")
+    parser.add_argument("--listen", default="0.0.0.0", help="UDP listen address")
+    parser.add_argument("--port", type=int, default=1885, help="UDP listen port (UDP_GATEWAY_PORT)")
+    parser.add_argument("--no-forward", action="store_true", help="Do not republish to the broker")
+    args = parser.parse_args()
+
+    # (sender address, sender port, topic id) -> topic
+    topics = {}
+
+    client = None
+    if not args.no_forward:
+        client = mqtt.Client()
+        client.connect(args.broker, args.broker_port)
+        client.loop_start()
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind((args.listen, args.port))
+    sock.settimeout(1.0)
+    print(f"Listening on udp://{args.listen}:{args.port}")
+
+    datagrams = 0
+    datagram_bytes = 0
+    window_start = time.monotonic()
+    while True:
+        try:
+            datagram, sender = sock.recvfrom(2048)
+            body = message_body(datagram)
+            registered = parse_register(body) if body else None
+            if registered is not None:
+                topic_id, topic = registered
+                topics[(sender[0], sender[1], topic_id)] = topic
+                continue
+            parsed = parse_publish(body) if body else None
+            if parsed is not None:
+                topic_id, payload = parsed
+                datagrams += 1
+                datagram_bytes += len(datagram)
+                topic = topics.get((sender[0], sender[1], topic_id))
+                if topic is None:
+                    print(f"Unknown topic id {topic_id} from {sender[0]}:{sender[1]}: {payload!r}")
+                elif client is not None:
+                    client.publish(topic, payload)
+        except socket.timeout:
+            pass
+
+        elapsed = time.monotonic() - window_start
+        if elapsed >= 10.0:
+            print(f"{datagrams / elapsed:.1f} datagrams/s, {datagram_bytes / elapsed:.0f} B/s")
+            datagrams = 0
+            datagram_bytes = 0
+            window_start = time.monotonic()
+
+
+if __name__ == "__main__":
+    main()